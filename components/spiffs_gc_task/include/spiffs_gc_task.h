@@ -0,0 +1,88 @@
+/* Proactive SPIFFS garbage collection
+ *
+ * When SPIFFS runs out of erased pages it garbage-collects inside the write
+ * that needs them, stalling that write for hundreds of milliseconds. This
+ * component runs `esp_spiffs_gc` from a low-priority task ahead of time, so
+ * writes normally find erased pages ready.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief GC task configuration.
+ */
+typedef struct {
+    const char *partition_label;    /*!< SPIFFS partition label, NULL for the default partition */
+    size_t target_free;             /*!< Bytes `esp_spiffs_gc` should keep available */
+    uint32_t check_interval_ms;     /*!< Usage polling interval */
+    uint32_t priority;              /*!< Task priority */
+    uint32_t stack_size;            /*!< Task stack size */
+} spiffs_gc_task_config_t;
+
+/** Default configuration, from Kconfig. */
+#define SPIFFS_GC_TASK_CONFIG_DEFAULT() {                           \
+    .partition_label = NULL,                                        \
+    .target_free = CONFIG_SPIFFS_GC_TASK_TARGET_FREE,               \
+    .check_interval_ms = CONFIG_SPIFFS_GC_TASK_CHECK_INTERVAL_MS,   \
+    .priority = CONFIG_SPIFFS_GC_TASK_PRIORITY,                     \
+    .stack_size = CONFIG_SPIFFS_GC_TASK_STACK_SIZE,                 \
+}
+
+/**
+ * @brief GC metrics.
+ */
+typedef struct {
+    uint32_t checks;        /*!< Usage checks done */
+    uint32_t runs;          /*!< esp_spiffs_gc calls */
+    uint32_t failures;      /*!< esp_spiffs_gc calls that did not reach the target */
+    int64_t total_us;       /*!< Time spent in esp_spiffs_gc */
+    int64_t max_us;         /*!< Longest esp_spiffs_gc call */
+    int64_t last_us;        /*!< Duration of the last esp_spiffs_gc call */
+    size_t total;           /*!< Partition size at the last check */
+    size_t used;            /*!< Used bytes at the last check */
+} spiffs_gc_task_stats_t;
+
+/**
+ * @brief Start the GC task. The partition must be mounted.
+ *
+ * @param config - Task configuration, copied.
+ *
+ * @return
+ *  - ESP_OK on success.
+ *  - ESP_ERR_INVALID_STATE if the task is already running.
+ *  - ESP_ERR_NO_MEM if the task could not be created.
+ */
+esp_err_t spiffs_gc_task_start(const spiffs_gc_task_config_t *config);
+
+/**
+ * @brief Stop the GC task, waiting for a GC in progress to finish.
+ *
+ * Must be called before the partition is unmounted.
+ */
+void spiffs_gc_task_stop(void);
+
+/**
+ * @brief Wake the GC task now instead of at the next check interval.
+ *
+ * Useful after large deletes, e.g. retention or vacuum.
+ */
+void spiffs_gc_task_request(void);
+
+/**
+ * @brief Read the GC metrics.
+ *
+ * @param stats - Receives a copy of the metrics.
+ */
+void spiffs_gc_task_get_stats(spiffs_gc_task_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
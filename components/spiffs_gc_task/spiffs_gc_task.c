@@ -0,0 +1,123 @@
+/* Proactive SPIFFS garbage collection
+ *
+ * See spiffs_gc_task.h. The task sleeps on its notification value, so it is
+ * woken either by the check interval or by spiffs_gc_task_request().
+ */
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_spiffs.h"
+#include "esp_timer.h"
+#include "spiffs_gc_task.h"
+
+static const char *TAG = "spiffs_gc_task";
+
+static spiffs_gc_task_config_t gc_config;
+static spiffs_gc_task_stats_t gc_stats;
+static portMUX_TYPE gc_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t gc_task = NULL;
+static SemaphoreHandle_t gc_stopped = NULL;
+static volatile bool gc_stop = false;
+
+/**
+ * @brief Run one GC if the partition changed since the last one.
+ */
+static void spiffs_gc_task_check(size_t *last_used) {
+    size_t total = 0, used = 0;
+    if (esp_spiffs_info(gc_config.partition_label, &total, &used) != ESP_OK) {
+        return;
+    }
+    portENTER_CRITICAL(&gc_stats_lock);
+    gc_stats.checks++;
+    gc_stats.total = total;
+    gc_stats.used = used;
+    portEXIT_CRITICAL(&gc_stats_lock);
+    if (used == *last_used) {
+        return;
+    }
+
+    // esp_spiffs_gc cannot make more space available than is not in use
+    size_t target = gc_config.target_free;
+    if (total - used < target) {
+        target = total - used;
+    }
+    if (target == 0) {
+        return;
+    }
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = esp_spiffs_gc(gc_config.partition_label, target);
+    int64_t elapsed = esp_timer_get_time() - start;
+    esp_spiffs_info(gc_config.partition_label, &total, last_used);
+
+    portENTER_CRITICAL(&gc_stats_lock);
+    gc_stats.runs++;
+    gc_stats.failures += (ret != ESP_OK);
+    gc_stats.total_us += elapsed;
+    gc_stats.last_us = elapsed;
+    if (elapsed > gc_stats.max_us) {
+        gc_stats.max_us = elapsed;
+    }
+    portEXIT_CRITICAL(&gc_stats_lock);
+    if (ret != ESP_OK) {
+        ESP_LOGD(TAG, "GC for %d bytes: %s (%lld us)", (int)target, esp_err_to_name(ret), elapsed);
+    } else {
+        ESP_LOGD(TAG, "GC for %d bytes done in %lld us", (int)target, elapsed);
+    }
+}
+
+static void spiffs_gc_task_main(void *arg) {
+    size_t last_used = (size_t)-1;
+    while (!gc_stop) {
+        spiffs_gc_task_check(&last_used);
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(gc_config.check_interval_ms));
+    }
+    xSemaphoreGive(gc_stopped);
+    vTaskDelete(NULL);
+}
+
+esp_err_t spiffs_gc_task_start(const spiffs_gc_task_config_t *config) {
+    if (gc_task != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (gc_stopped == NULL && (gc_stopped = xSemaphoreCreateBinary()) == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    gc_config = *config;
+    gc_stop = false;
+    if (xTaskCreate(spiffs_gc_task_main, "spiffs_gc", config->stack_size, NULL, config->priority,
+                    &gc_task) != pdPASS) {
+        gc_task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Started, keeping %d bytes collected", (int)config->target_free);
+    return ESP_OK;
+}
+
+void spiffs_gc_task_stop(void) {
+    if (gc_task == NULL) {
+        return;
+    }
+    gc_stop = true;
+    xTaskNotifyGive(gc_task);
+    xSemaphoreTake(gc_stopped, portMAX_DELAY);
+    gc_task = NULL;
+
+    spiffs_gc_task_stats_t stats;
+    spiffs_gc_task_get_stats(&stats);
+    ESP_LOGI(TAG, "Stopped: %d GC runs (%d short), %lld us total, %lld us max", (int)stats.runs,
+             (int)stats.failures, stats.total_us, stats.max_us);
+}
+
+void spiffs_gc_task_request(void) {
+    if (gc_task != NULL) {
+        xTaskNotifyGive(gc_task);
+    }
+}
+
+void spiffs_gc_task_get_stats(spiffs_gc_task_stats_t *stats) {
+    portENTER_CRITICAL(&gc_stats_lock);
+    *stats = gc_stats;
+    portEXIT_CRITICAL(&gc_stats_lock);
+}
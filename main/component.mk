@@ -3,3 +3,4 @@
 #
 # (Uses default behaviour of compiling all source files in directory, adding 'include' to include path.)
 
+COMPONENT_EMBED_TXTFILES := schema/test1_001.sql schema/test2_001.sql
@@ -0,0 +1,422 @@
+/* Query-plan advisor
+ *
+ * See db_advisor.h. Candidate indexes are evaluated in a scratch ":memory:"
+ * database holding only the schema: without sqlite_stat1 the planner picks an
+ * index for an equality or range constraint whether the table is empty or
+ * not, so the plans match the device database at no I/O cost.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "esp_log.h"
+#include "db_advisor.h"
+
+static const char *TAG = "db_advisor";
+
+#define DB_ADVISOR_MAX_COLUMNS 8
+#define DB_ADVISOR_NAME_LEN 64
+
+typedef struct {
+    char *sql;
+    uint32_t runs;
+    sqlite3_int64 total_ns;
+} db_advisor_query_t;
+
+struct db_advisor {
+    sqlite3 *db;
+    bool paused;                /* ignore statements run by the advisor itself */
+    size_t count;
+    db_advisor_query_t queries[DB_ADVISOR_MAX_QUERIES];
+};
+
+/**
+ * @brief Problems found in a query plan.
+ */
+typedef struct {
+    int score;                          /* full scans + temp B-trees, lower is better */
+    bool full_scan;
+    bool temp_btree;
+    bool covering;                      /* a covering index is used */
+    char table[DB_ADVISOR_NAME_LEN];    /* table to index */
+} db_advisor_plan_t;
+
+/**
+ * @brief Columns of one table read by a query, collected by the authorizer.
+ */
+typedef struct {
+    const char *table;
+    char *names[DB_ADVISOR_MAX_COLUMNS];
+    int count;
+} db_advisor_columns_t;
+
+static bool db_advisor_is_query(const char *sql) {
+    while (*sql == ' ' || *sql == '\t' || *sql == '\n' || *sql == '\r') {
+        sql++;
+    }
+    return strncasecmp(sql, "SELECT", 6) == 0 || strncasecmp(sql, "UPDATE", 6) == 0 ||
+           strncasecmp(sql, "DELETE", 6) == 0 || strncasecmp(sql, "WITH", 4) == 0;
+}
+
+static int db_advisor_trace(unsigned type, void *ctx, void *p, void *x) {
+    db_advisor_t *advisor = ctx;
+    if (type != SQLITE_TRACE_PROFILE || advisor->paused) {
+        return 0;
+    }
+    const char *sql = sqlite3_sql((sqlite3_stmt *)p);
+    if (sql == NULL || !db_advisor_is_query(sql)) {
+        return 0;
+    }
+    sqlite3_int64 ns = *(sqlite3_int64 *)x;
+    for (size_t i = 0; i < advisor->count; i++) {
+        if (strcmp(advisor->queries[i].sql, sql) == 0) {
+            advisor->queries[i].runs++;
+            advisor->queries[i].total_ns += ns;
+            return 0;
+        }
+    }
+    if (advisor->count < DB_ADVISOR_MAX_QUERIES) {
+        db_advisor_query_t *query = &advisor->queries[advisor->count];
+        query->sql = sqlite3_mprintf("%s", sql);
+        if (query->sql != NULL) {
+            query->runs = 1;
+            query->total_ns = ns;
+            advisor->count++;
+        }
+    }
+    return 0;
+}
+
+int db_advisor_start(sqlite3 *db, db_advisor_t **advisor) {
+    db_advisor_t *a = sqlite3_malloc(sizeof(db_advisor_t));
+    if (a == NULL) {
+        return SQLITE_NOMEM;
+    }
+    memset(a, 0, sizeof(*a));
+    a->db = db;
+    int rc = sqlite3_trace_v2(db, SQLITE_TRACE_PROFILE, db_advisor_trace, a);
+    if (rc != SQLITE_OK) {
+        sqlite3_free(a);
+        return rc;
+    }
+    *advisor = a;
+    return SQLITE_OK;
+}
+
+void db_advisor_stop(db_advisor_t *advisor) {
+    if (advisor == NULL) {
+        return;
+    }
+    sqlite3_trace_v2(advisor->db, 0, NULL, NULL);
+    for (size_t i = 0; i < advisor->count; i++) {
+        sqlite3_free(advisor->queries[i].sql);
+    }
+    sqlite3_free(advisor);
+}
+
+/**
+ * @brief Check that a name in a plan is a table of the scratch schema.
+ */
+static bool db_advisor_is_table(sqlite3 *scratch, const char *name) {
+    sqlite3_stmt *stmt;
+    bool found = false;
+    if (sqlite3_prepare_v2(scratch, "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = ?", -1, &stmt,
+                           NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+        found = sqlite3_step(stmt) == SQLITE_ROW;
+        sqlite3_finalize(stmt);
+    }
+    return found;
+}
+
+/**
+ * @brief Run EXPLAIN QUERY PLAN on the scratch database and score the plan.
+ *
+ * Handles both detail formats, "SCAN TABLE t" (before 3.36) and "SCAN t".
+ */
+static int db_advisor_plan(sqlite3 *scratch, const char *sql, db_advisor_plan_t *plan) {
+    memset(plan, 0, sizeof(*plan));
+    char *eqp = sqlite3_mprintf("EXPLAIN QUERY PLAN %s", sql);
+    if (eqp == NULL) {
+        return SQLITE_NOMEM;
+    }
+    sqlite3_stmt *stmt;
+    int rc = sqlite3_prepare_v2(scratch, eqp, -1, &stmt, NULL);
+    sqlite3_free(eqp);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    char last_table[DB_ADVISOR_NAME_LEN] = "";
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const char *detail = (const char *)sqlite3_column_text(stmt, 3);
+        if (detail == NULL) {
+            continue;
+        }
+        bool scan = strncmp(detail, "SCAN ", 5) == 0;
+        if (scan || strncmp(detail, "SEARCH ", 7) == 0) {
+            const char *name = detail + (scan ? 5 : 7);
+            if (strncmp(name, "TABLE ", 6) == 0) {
+                name += 6;
+            }
+            size_t len = strcspn(name, " ");
+            if (len >= sizeof(last_table)) {
+                continue;
+            }
+            memcpy(last_table, name, len);
+            last_table[len] = '\0';
+            if (strstr(detail, "COVERING INDEX") != NULL) {
+                plan->covering = true;
+            }
+            // Subqueries, constant rows and virtual tables cannot be indexed
+            if (scan && strstr(detail, "VIRTUAL TABLE") == NULL && db_advisor_is_table(scratch, last_table)) {
+                plan->score++;
+                if (!plan->full_scan) {
+                    plan->full_scan = true;
+                    strcpy(plan->table, last_table);
+                }
+            }
+        } else if (strncmp(detail, "USE TEMP B-TREE", 15) == 0) {
+            plan->score++;
+            if (!plan->temp_btree) {
+                plan->temp_btree = true;
+                if (!plan->full_scan) {
+                    strcpy(plan->table, last_table);
+                }
+            }
+        }
+    }
+    sqlite3_finalize(stmt);
+    return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+static void db_advisor_add_column(db_advisor_columns_t *columns, const char *name) {
+    if (name == NULL || name[0] == '\0' || columns->count >= DB_ADVISOR_MAX_COLUMNS) {
+        return;
+    }
+    for (int i = 0; i < columns->count; i++) {
+        if (strcasecmp(columns->names[i], name) == 0) {
+            return;
+        }
+    }
+    char *copy = sqlite3_mprintf("%s", name);
+    if (copy != NULL) {
+        columns->names[columns->count++] = copy;
+    }
+}
+
+static int db_advisor_authorize(void *ctx, int action, const char *table, const char *column, const char *db,
+                                const char *trigger) {
+    db_advisor_columns_t *columns = ctx;
+    if (action == SQLITE_READ && table != NULL && strcmp(table, columns->table) == 0) {
+        db_advisor_add_column(columns, column);
+    }
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Collect the columns of `columns->table` read by a query.
+ *
+ * Falls back to every column of the table if the authorizer reports none.
+ */
+static void db_advisor_read_columns(sqlite3 *scratch, const char *sql, db_advisor_columns_t *columns) {
+    sqlite3_stmt *stmt;
+    sqlite3_set_authorizer(scratch, db_advisor_authorize, columns);
+    if (sqlite3_prepare_v2(scratch, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_set_authorizer(scratch, NULL, NULL);
+    if (columns->count > 0) {
+        return;
+    }
+    char *info = sqlite3_mprintf("PRAGMA table_info(\"%w\")", columns->table);
+    if (info != NULL && sqlite3_prepare_v2(scratch, info, -1, &stmt, NULL) == SQLITE_OK) {
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            db_advisor_add_column(columns, (const char *)sqlite3_column_text(stmt, 1));
+        }
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_free(info);
+}
+
+/**
+ * @brief Build `"a", "b", ...` from the first column, then the others if `all`.
+ */
+static char *db_advisor_column_list(const db_advisor_columns_t *columns, int first, bool all) {
+    char *list = sqlite3_mprintf("\"%w\"", columns->names[first]);
+    for (int i = 0; all && list != NULL && i < columns->count; i++) {
+        if (i != first) {
+            char *longer = sqlite3_mprintf("%s, \"%w\"", list, columns->names[i]);
+            sqlite3_free(list);
+            list = longer;
+        }
+    }
+    return list;
+}
+
+/**
+ * @brief Score a query with a trial index on the scratch database.
+ */
+static int db_advisor_try(sqlite3 *scratch, const char *sql, const char *table, const char *list,
+                          db_advisor_plan_t *plan) {
+    char *ddl = sqlite3_mprintf("CREATE INDEX advisor_trial ON \"%w\"(%s)", table, list);
+    int rc = ddl ? sqlite3_exec(scratch, ddl, NULL, NULL, NULL) : SQLITE_NOMEM;
+    sqlite3_free(ddl);
+    if (rc == SQLITE_OK) {
+        rc = db_advisor_plan(scratch, sql, plan);
+        sqlite3_exec(scratch, "DROP INDEX advisor_trial", NULL, NULL, NULL);
+    }
+    return rc;
+}
+
+/**
+ * @brief Whether `column` is declared INTEGER in a table without a primary key.
+ *
+ * Such a column can become the rowid itself with `INTEGER PRIMARY KEY`, which
+ * is faster than any index and needs no extra storage.
+ */
+static bool db_advisor_can_alias_rowid(sqlite3 *scratch, const char *table, const char *column) {
+    sqlite3_stmt *stmt;
+    bool integer = false;
+    bool has_pk = false;
+    char *info = sqlite3_mprintf("PRAGMA table_info(\"%w\")", table);
+    if (info != NULL && sqlite3_prepare_v2(scratch, info, -1, &stmt, NULL) == SQLITE_OK) {
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            const char *name = (const char *)sqlite3_column_text(stmt, 1);
+            const char *type = (const char *)sqlite3_column_text(stmt, 2);
+            if (name && strcasecmp(name, column) == 0 && type && strcasecmp(type, "INTEGER") == 0) {
+                integer = true;
+            }
+            has_pk |= sqlite3_column_int(stmt, 5) != 0;
+        }
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_free(info);
+    return integer && !has_pk;
+}
+
+/**
+ * @brief Find an index for one flagged query, log it and optionally create it.
+ *
+ * @return SQLITE_OK whether or not an index was found, or an SQLite error
+ *         code if creating it failed.
+ */
+static int db_advisor_suggest(db_advisor_t *advisor, sqlite3 *scratch, const char *sql,
+                              const db_advisor_plan_t *plan, const db_advisor_options_t *options, int *suggested) {
+    db_advisor_columns_t columns = { .table = plan->table };
+    db_advisor_read_columns(scratch, sql, &columns);
+
+    int best = -1;
+    int best_score = plan->score;
+    bool covering = false;
+    db_advisor_plan_t trial;
+    for (int i = 0; i < columns.count; i++) {
+        char *list = db_advisor_column_list(&columns, i, false);
+        if (list != NULL && db_advisor_try(scratch, sql, plan->table, list, &trial) == SQLITE_OK &&
+            trial.score < best_score) {
+            best = i;
+            best_score = trial.score;
+        }
+        sqlite3_free(list);
+    }
+
+    int rc = SQLITE_OK;
+    if (best < 0) {
+        ESP_LOGI(TAG, "  no single-column index on %s helps", plan->table);
+    } else {
+        if (options && options->covering && columns.count > 1) {
+            char *list = db_advisor_column_list(&columns, best, true);
+            covering = list != NULL && db_advisor_try(scratch, sql, plan->table, list, &trial) == SQLITE_OK &&
+                       trial.score <= best_score && trial.covering;
+            sqlite3_free(list);
+        }
+        char *list = db_advisor_column_list(&columns, best, covering);
+        char *ddl = list ? sqlite3_mprintf("CREATE INDEX IF NOT EXISTS \"%w_%w_idx\" ON \"%w\"(%s)", plan->table,
+                                           columns.names[best], plan->table, list)
+                         : NULL;
+        sqlite3_free(list);
+        if (ddl == NULL) {
+            rc = SQLITE_NOMEM;
+        } else {
+            ESP_LOGW(TAG, "  suggest: %s", ddl);
+            (*suggested)++;
+            if (!covering && db_advisor_can_alias_rowid(scratch, plan->table, columns.names[best])) {
+                ESP_LOGI(TAG, "  or declare %s.%s INTEGER PRIMARY KEY to use it as the rowid", plan->table,
+                         columns.names[best]);
+            }
+            // Later queries are analyzed with this index in place
+            sqlite3_exec(scratch, ddl, NULL, NULL, NULL);
+            if (options && options->create_indexes) {
+                rc = sqlite3_exec(advisor->db, ddl, NULL, NULL, NULL);
+                if (rc != SQLITE_OK) {
+                    ESP_LOGE(TAG, "  create failed: %s", sqlite3_errmsg(advisor->db));
+                }
+            }
+            sqlite3_free(ddl);
+        }
+    }
+    for (int i = 0; i < columns.count; i++) {
+        sqlite3_free(columns.names[i]);
+    }
+    return rc;
+}
+
+/**
+ * @brief Copy the schema of the database into an empty in-memory database.
+ *
+ * Tables come first so their indexes can be created. Statements the scratch
+ * database cannot run, like CREATE VIRTUAL TABLE for an unregistered module,
+ * are skipped.
+ */
+static int db_advisor_copy_schema(sqlite3 *db, sqlite3 *scratch) {
+    sqlite3_stmt *stmt;
+    int rc = sqlite3_prepare_v2(db,
+                                "SELECT sql FROM sqlite_master WHERE sql IS NOT NULL AND name NOT LIKE 'sqlite_%' "
+                                "ORDER BY type = 'table' DESC",
+                                -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const char *sql = (const char *)sqlite3_column_text(stmt, 0);
+        if (sqlite3_exec(scratch, sql, NULL, NULL, NULL) != SQLITE_OK) {
+            ESP_LOGD(TAG, "skipped: %s", sql);
+        }
+    }
+    sqlite3_finalize(stmt);
+    return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+int db_advisor_analyze(db_advisor_t *advisor, const db_advisor_options_t *options, int *suggested) {
+    sqlite3 *scratch;
+    int count = 0;
+    int rc = sqlite3_open(":memory:", &scratch);
+    advisor->paused = true;
+    if (rc == SQLITE_OK) {
+        rc = db_advisor_copy_schema(advisor->db, scratch);
+    }
+    for (size_t i = 0; rc == SQLITE_OK && i < advisor->count; i++) {
+        const db_advisor_query_t *query = &advisor->queries[i];
+        db_advisor_plan_t plan;
+        if (db_advisor_plan(scratch, query->sql, &plan) != SQLITE_OK) {
+            ESP_LOGD(TAG, "cannot plan: %s", query->sql);
+            continue;
+        }
+        if (plan.score == 0) {
+            continue;
+        }
+        ESP_LOGW(TAG, "%s", query->sql);
+        ESP_LOGW(TAG, "  %lu run(s), avg %lld us:%s%s", (unsigned long)query->runs,
+                 (long long)(query->total_ns / query->runs / 1000), plan.full_scan ? " full scan" : "",
+                 plan.temp_btree ? " temp b-tree" : "");
+        if (plan.table[0] != '\0') {
+            rc = db_advisor_suggest(advisor, scratch, query->sql, &plan, options, &count);
+        }
+    }
+    sqlite3_close(scratch);
+    advisor->paused = false;
+    ESP_LOGI(TAG, "%d statement(s) analyzed, %d index(es) suggested", (int)advisor->count, count);
+    if (suggested) {
+        *suggested = count;
+    }
+    return rc;
+}
@@ -0,0 +1,83 @@
+/* Query-plan advisor
+ *
+ * Records the statements a connection runs (via sqlite3_trace_v2) and, on
+ * request, runs EXPLAIN QUERY PLAN for each of them to flag full table scans
+ * and temporary B-trees built for ORDER BY, GROUP BY or DISTINCT. For each
+ * flagged query it tries candidate indexes on an empty in-memory copy of the
+ * schema, so no flash I/O or write lock is needed, and suggests (optionally
+ * creates) the first one that removes the scan.
+ *
+ *     db_advisor_t *advisor;
+ *     db_advisor_start(db, &advisor);
+ *     ... run the workload ...
+ *     db_advisor_analyze(advisor, &options, &suggested);
+ *     db_advisor_stop(advisor);
+ *
+ * Suggestions are logged as CREATE INDEX statements; to keep them, add them
+ * as a new migration file under main/schema.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include "sqlite3.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of distinct statements recorded, later ones are ignored. */
+#define DB_ADVISOR_MAX_QUERIES 16
+
+typedef struct db_advisor db_advisor_t;
+
+/**
+ * @brief Analysis options.
+ */
+typedef struct {
+    bool create_indexes;    /*!< Create the suggested indexes on the database */
+    bool covering;          /*!< Append the other columns the query reads, so it never reads the table */
+} db_advisor_options_t;
+
+/**
+ * @brief Start recording the statements run on a connection.
+ *
+ * Only SELECT, UPDATE, DELETE and WITH statements are recorded, keyed by
+ * their SQL text with `?` parameters, along with run count and total time.
+ * Times come from the VFS clock and may only have millisecond resolution;
+ * use db_bench.h for precise latencies.
+ * Replaces any trace callback set on the connection.
+ *
+ * @param db - A pointer to the SQLite database connection.
+ * @param advisor - Receives the advisor.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - SQLITE_NOMEM if the advisor cannot be allocated.
+ */
+int db_advisor_start(sqlite3 *db, db_advisor_t **advisor);
+
+/**
+ * @brief Analyze the recorded statements and log the findings.
+ *
+ * Must run on the task that owns the connection.
+ *
+ * @param advisor - Advisor returned by `db_advisor_start`.
+ * @param options - Analysis options, NULL to only log suggestions.
+ * @param suggested - Optional, receives the number of suggested indexes.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - An SQLite error code on failure, e.g. if a suggested index cannot be created.
+ */
+int db_advisor_analyze(db_advisor_t *advisor, const db_advisor_options_t *options, int *suggested);
+
+/**
+ * @brief Stop recording and free the advisor.
+ *
+ * @param advisor - Advisor returned by `db_advisor_start`, or NULL.
+ */
+void db_advisor_stop(db_advisor_t *advisor);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,289 @@
+/* Asynchronous durability mode
+ *
+ * See db_async.h. Records are appended to the active one of two buffers.
+ * A flush swaps the buffers under `lock` and commits the full one through
+ * `db_service_call`, so writers keep appending meanwhile; `flush_lock`
+ * serializes flushes, which makes `db_flush` a barrier for everything
+ * appended before it. A writer that finds the active buffer full flushes it
+ * itself.
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "db_async.h"
+
+static const char *TAG = "db_async";
+
+#define DB_ASYNC_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+typedef struct {
+    sqlite3 *db;
+    db_service_fn fn;
+    size_t size;                /* padded size of the record data that follows */
+} db_async_record_t;
+
+typedef struct {
+    uint8_t *data;
+    size_t used;
+    uint32_t count;
+    int64_t oldest_us;          /* time the first record was appended */
+} db_async_buffer_t;
+
+static struct {
+    db_async_config_t config;
+    db_async_buffer_t buffers[2];
+    db_async_buffer_t *active;
+    SemaphoreHandle_t lock;         /* protects `active`, its contents and `stats` */
+    SemaphoreHandle_t flush_lock;
+    SemaphoreHandle_t stopped;
+    TaskHandle_t task;
+    volatile bool stopping;
+    db_async_stats_t stats;
+} s_async;
+
+/**
+ * @brief Commit the open transactions of a flush.
+ *
+ * @return SQLITE_OK, or the first COMMIT error.
+ */
+static int db_async_commit_all(sqlite3 **dbs, const uint32_t *records, int count, uint32_t *committed,
+                               uint32_t *failed) {
+    int result = SQLITE_OK;
+    for (int i = 0; i < count; i++) {
+        int rc = sqlite3_exec(dbs[i], "COMMIT", NULL, NULL, NULL);
+        if (rc == SQLITE_OK) {
+            *committed += records[i];
+            continue;
+        }
+        ESP_LOGE(TAG, "Commit of %d records failed: %s", (int)records[i], sqlite3_errmsg(dbs[i]));
+        if (!sqlite3_get_autocommit(dbs[i])) {
+            sqlite3_exec(dbs[i], "ROLLBACK", NULL, NULL, NULL);
+        }
+        *failed += records[i];
+        if (result == SQLITE_OK) {
+            result = rc;
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Commit the records of a buffer, one transaction per connection. Runs on the service task.
+ *
+ * @param arg - The `db_async_buffer_t`.
+ *
+ * @return SQLITE_OK, or the first error of a record or a transaction.
+ */
+static int db_async_commit(void *arg) {
+    db_async_buffer_t *buffer = arg;
+    sqlite3 *dbs[DB_ASYNC_MAX_DBS];
+    uint32_t records[DB_ASYNC_MAX_DBS] = {0};
+    int count = 0;
+    uint32_t committed = 0;
+    uint32_t failed = 0;
+    int result = SQLITE_OK;
+    int rc;
+
+    size_t offset = 0;
+    while (offset < buffer->used) {
+        db_async_record_t *record = (db_async_record_t *)(buffer->data + offset);
+        offset += DB_ASYNC_ALIGN(sizeof(db_async_record_t)) + record->size;
+        int i = 0;
+        while (i < count && dbs[i] != record->db) {
+            i++;
+        }
+        if (i == count) {
+            if (count == DB_ASYNC_MAX_DBS) {
+                rc = db_async_commit_all(dbs, records, count, &committed, &failed);
+                result = result != SQLITE_OK ? result : rc;
+                count = i = 0;
+            }
+            rc = sqlite3_exec(record->db, "BEGIN IMMEDIATE", NULL, NULL, NULL);
+            if (rc != SQLITE_OK) {
+                ESP_LOGE(TAG, "Cannot begin the flush: %s", sqlite3_errmsg(record->db));
+                failed++;
+                result = result != SQLITE_OK ? result : rc;
+                continue;
+            }
+            dbs[count] = record->db;
+            records[count++] = 0;
+        }
+        rc = db_service_run_savepoint(record->db, record->fn, (uint8_t *)record + DB_ASYNC_ALIGN(sizeof(*record)));
+        if (rc != SQLITE_OK) {
+            failed++;
+            result = result != SQLITE_OK ? result : rc;
+        } else {
+            records[i]++;
+        }
+    }
+    rc = db_async_commit_all(dbs, records, count, &committed, &failed);
+    result = result != SQLITE_OK ? result : rc;
+
+    int64_t loss_us = esp_timer_get_time() - buffer->oldest_us;
+    xSemaphoreTake(s_async.lock, portMAX_DELAY);
+    s_async.stats.committed += committed;
+    s_async.stats.failed += failed;
+    s_async.stats.flushes++;
+    if (loss_us > s_async.stats.max_loss_us) {
+        s_async.stats.max_loss_us = loss_us;
+    }
+    xSemaphoreGive(s_async.lock);
+    return result;
+}
+
+int db_flush(void) {
+    if (s_async.flush_lock == NULL) {
+        return SQLITE_OK;
+    }
+    xSemaphoreTake(s_async.flush_lock, portMAX_DELAY);
+    xSemaphoreTake(s_async.lock, portMAX_DELAY);
+    db_async_buffer_t *full = s_async.active;
+    s_async.active = full == &s_async.buffers[0] ? &s_async.buffers[1] : &s_async.buffers[0];
+    xSemaphoreGive(s_async.lock);
+
+    int rc = SQLITE_OK;
+    if (full->count > 0) {
+        rc = db_service_call(db_async_commit, full);
+        xSemaphoreTake(s_async.lock, portMAX_DELAY);
+        s_async.stats.pending -= full->count;
+        xSemaphoreGive(s_async.lock);
+        full->used = 0;
+        full->count = 0;
+    }
+    xSemaphoreGive(s_async.flush_lock);
+    return rc;
+}
+
+int db_async_write(sqlite3 *db, db_service_fn fn, const void *record, size_t size) {
+    if (s_async.task == NULL) {
+        return db_service_write(db, fn, (void *)record);
+    }
+    size_t need = DB_ASYNC_ALIGN(sizeof(db_async_record_t)) + DB_ASYNC_ALIGN(size);
+    if (need > s_async.config.buffer_size) {
+        return SQLITE_TOOBIG;
+    }
+    while (true) {
+        xSemaphoreTake(s_async.lock, portMAX_DELAY);
+        if (s_async.task == NULL) {
+            // Stopping: write synchronously
+            xSemaphoreGive(s_async.lock);
+            return db_service_write(db, fn, (void *)record);
+        }
+        db_async_buffer_t *buffer = s_async.active;
+        if (buffer->used + need <= s_async.config.buffer_size) {
+            db_async_record_t *header = (db_async_record_t *)(buffer->data + buffer->used);
+            header->db = db;
+            header->fn = fn;
+            header->size = DB_ASYNC_ALIGN(size);
+            memcpy((uint8_t *)header + DB_ASYNC_ALIGN(sizeof(*header)), record, size);
+            buffer->used += need;
+            if (buffer->count++ == 0) {
+                buffer->oldest_us = esp_timer_get_time();
+            }
+            s_async.stats.writes++;
+            s_async.stats.pending++;
+            // Wake the flusher to arm the loss window, or to flush early
+            // Under `lock`, so the task cannot have been stopped and deleted meanwhile
+            if (buffer->count == 1 || buffer->count >= s_async.config.flush_rows) {
+                xTaskNotifyGive(s_async.task);
+            }
+            xSemaphoreGive(s_async.lock);
+            return SQLITE_OK;
+        }
+        xSemaphoreGive(s_async.lock);
+        // Full: make room by flushing it ourselves
+        db_flush();
+    }
+}
+
+static void db_async_task(void *arg) {
+    const int64_t tick_us = portTICK_PERIOD_MS * 1000;
+    while (!s_async.stopping) {
+        TickType_t wait = portMAX_DELAY;
+        xSemaphoreTake(s_async.lock, portMAX_DELAY);
+        const db_async_buffer_t *buffer = s_async.active;
+        if (buffer->count >= s_async.config.flush_rows) {
+            wait = 0;
+        } else if (buffer->count > 0) {
+            int64_t remaining = buffer->oldest_us + s_async.config.max_loss_ms * 1000LL - esp_timer_get_time();
+            wait = remaining > 0 ? (TickType_t)((remaining + tick_us - 1) / tick_us) : 0;
+        }
+        xSemaphoreGive(s_async.lock);
+        if (wait > 0 && ulTaskNotifyTake(pdTRUE, wait) != 0) {
+            continue;   // new records: recompute the deadline
+        }
+        if (!s_async.stopping) {
+            db_flush();
+        }
+    }
+    xSemaphoreGive(s_async.stopped);
+    vTaskDelete(NULL);
+}
+
+esp_err_t db_async_start(const db_async_config_t *config) {
+    if (s_async.task != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    memset(&s_async, 0, sizeof(s_async));
+    s_async.config = *config;
+    s_async.buffers[0].data = malloc(config->buffer_size);
+    s_async.buffers[1].data = malloc(config->buffer_size);
+    s_async.lock = xSemaphoreCreateMutex();
+    s_async.flush_lock = xSemaphoreCreateMutex();
+    s_async.stopped = xSemaphoreCreateBinary();
+    s_async.active = &s_async.buffers[0];
+    if (s_async.buffers[0].data == NULL || s_async.buffers[1].data == NULL || s_async.lock == NULL ||
+        s_async.flush_lock == NULL || s_async.stopped == NULL ||
+        xTaskCreate(db_async_task, "db_async", config->stack_size, NULL, config->priority, &s_async.task) != pdPASS) {
+        s_async.task = NULL;
+        db_async_stop();
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Started, loss window %d ms or %d records", (int)config->max_loss_ms, (int)config->flush_rows);
+    return ESP_OK;
+}
+
+void db_async_stop(void) {
+    if (s_async.task != NULL) {
+        // Writers check `task` under `lock` and no longer notify it once it is cleared
+        xSemaphoreTake(s_async.lock, portMAX_DELAY);
+        TaskHandle_t task = s_async.task;
+        s_async.task = NULL;
+        s_async.stopping = true;
+        xSemaphoreGive(s_async.lock);
+        xTaskNotifyGive(task);
+        xSemaphoreTake(s_async.stopped, portMAX_DELAY);
+        db_flush();
+        ESP_LOGI(TAG, "%d records acknowledged, %d committed in %d flushes, %d failed, max %lld us in RAM",
+                 (int)s_async.stats.writes, (int)s_async.stats.committed, (int)s_async.stats.flushes,
+                 (int)s_async.stats.failed, s_async.stats.max_loss_us);
+    }
+    free(s_async.buffers[0].data);
+    free(s_async.buffers[1].data);
+    s_async.buffers[0].data = s_async.buffers[1].data = NULL;
+    if (s_async.lock) {
+        vSemaphoreDelete(s_async.lock);
+    }
+    if (s_async.flush_lock) {
+        vSemaphoreDelete(s_async.flush_lock);
+    }
+    if (s_async.stopped) {
+        vSemaphoreDelete(s_async.stopped);
+    }
+    s_async.lock = s_async.flush_lock = s_async.stopped = NULL;
+}
+
+void db_async_get_stats(db_async_stats_t *stats) {
+    if (s_async.lock == NULL) {
+        *stats = s_async.stats;
+        return;
+    }
+    xSemaphoreTake(s_async.lock, portMAX_DELAY);
+    *stats = s_async.stats;
+    xSemaphoreGive(s_async.lock);
+}
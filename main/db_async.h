@@ -0,0 +1,126 @@
+/* Asynchronous durability mode
+ *
+ * For data where losing the last moments is acceptable, such as telemetry,
+ * `db_async_write` copies a record into a RAM buffer and returns at once,
+ * without waiting for a commit. A flusher task commits the buffered records
+ * through the database service, in one transaction per connection, every
+ * `max_loss_ms` or as soon as `flush_rows` records are waiting. The database
+ * itself keeps its journal mode and `synchronous` setting, so a power loss
+ * loses at most the records still in RAM and never corrupts the file.
+ *
+ *     db_async_write(db, insert_reading, &reading, sizeof(reading));
+ *     ...
+ *     db_flush();     // everything written so far is on flash
+ *
+ * Records are copied, so they must not point to memory of the caller. Writes
+ * and `db_flush` must not be called from the database service task.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "sqlite3.h"
+#include "db_service.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Connections one flush can commit to. */
+#define DB_ASYNC_MAX_DBS 4
+
+/**
+ * @brief Asynchronous writer configuration.
+ */
+typedef struct {
+    size_t buffer_size;         /*!< Bytes of each of the two record buffers */
+    uint32_t max_loss_ms;       /*!< Flush interval, the longest an acknowledged record waits in RAM */
+    uint32_t flush_rows;        /*!< Buffered records that start a flush before the interval ends */
+    uint32_t priority;          /*!< Priority of the flusher task */
+    uint32_t stack_size;        /*!< Stack size of the flusher task */
+} db_async_config_t;
+
+/** Default configuration, from Kconfig. */
+#define DB_ASYNC_CONFIG_DEFAULT() {                                 \
+    .buffer_size = CONFIG_EXAMPLE_DB_ASYNC_BUFFER_KB * 1024,        \
+    .max_loss_ms = CONFIG_EXAMPLE_DB_ASYNC_MAX_LOSS_MS,             \
+    .flush_rows = CONFIG_EXAMPLE_DB_ASYNC_FLUSH_ROWS,               \
+    .priority = CONFIG_EXAMPLE_DB_SERVICE_PRIORITY,                 \
+    .stack_size = 3072,                                             \
+}
+
+/**
+ * @brief Asynchronous writer metrics.
+ */
+typedef struct {
+    uint32_t writes;            /*!< Records acknowledged by `db_async_write` */
+    uint32_t committed;         /*!< Records committed */
+    uint32_t failed;            /*!< Records whose function or commit failed, and were dropped */
+    uint32_t flushes;           /*!< Flushes that committed records */
+    uint32_t pending;           /*!< Records in RAM now */
+    int64_t max_loss_us;        /*!< Longest time from acknowledgement to commit */
+} db_async_stats_t;
+
+/**
+ * @brief Start the flusher task. The database service should be running.
+ *
+ * @param config - Configuration, copied.
+ *
+ * @return
+ *  - ESP_OK on success.
+ *  - ESP_ERR_INVALID_STATE if it is already running.
+ *  - ESP_ERR_NO_MEM if the buffers or the task could not be created.
+ */
+esp_err_t db_async_start(const db_async_config_t *config);
+
+/**
+ * @brief Flush the remaining records and stop the flusher task.
+ *
+ * Call before stopping the database service. Writes that start once the stop
+ * has begun are committed synchronously; no write may still be running when
+ * it returns, as the buffers are freed.
+ */
+void db_async_stop(void);
+
+/**
+ * @brief Buffer a write and return without waiting for it to be committed.
+ *
+ * `fn` is later run on the database service task with a copy of `record`,
+ * under its own savepoint in a transaction shared with the other buffered
+ * records for `db`. It must not begin or end transactions. If the buffer is
+ * full the caller flushes it first. If the flusher is not running the write
+ * is committed synchronously with `db_service_write`.
+ *
+ * @param db - Connection the write uses.
+ * @param fn - Function issuing the statements, called with the copy of `record`.
+ * @param record - Data for `fn`, copied.
+ * @param size - Size of `record`.
+ *
+ * @return
+ *  - SQLITE_OK (0) once the record is buffered.
+ *  - SQLITE_TOOBIG if the record does not fit in a buffer.
+ *  - Without the flusher task, the result of `db_service_write`.
+ */
+int db_async_write(sqlite3 *db, db_service_fn fn, const void *record, size_t size);
+
+/**
+ * @brief Commit every record written so far.
+ *
+ * Returns once all records acknowledged before the call are committed.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success, also if nothing was buffered.
+ *  - The first error of a record function or a commit; those records are dropped.
+ */
+int db_flush(void);
+
+/**
+ * @brief Read the asynchronous writer metrics.
+ */
+void db_async_get_stats(db_async_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
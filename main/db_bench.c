@@ -0,0 +1,55 @@
+/* Statement benchmarks
+ *
+ * See db_bench.h.
+ */
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "db_bench.h"
+
+static const char *TAG = "db_bench";
+
+int db_bench_run(sqlite3 *db, const char *name, const char *sql, uint32_t runs, db_bench_bind_fn bind, void *ctx,
+                 db_bench_result_t *result) {
+    db_bench_result_t r;
+    memset(&r, 0, sizeof(r));
+    sqlite3_stmt *stmt;
+    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    for (uint32_t i = 0; rc == SQLITE_OK && i < runs; i++) {
+        int64_t start = esp_timer_get_time();
+        if (bind) {
+            rc = bind(stmt, i, ctx);
+        }
+        while (rc == SQLITE_OK && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            rc = SQLITE_OK;
+        }
+        if (rc == SQLITE_DONE) {
+            rc = sqlite3_reset(stmt);
+        }
+        int64_t elapsed = esp_timer_get_time() - start;
+        if (rc != SQLITE_OK) {
+            break;
+        }
+        if (r.runs == 0 || elapsed < r.min_us) {
+            r.min_us = elapsed;
+        }
+        if (elapsed > r.max_us) {
+            r.max_us = elapsed;
+        }
+        r.total_us += elapsed;
+        r.runs++;
+    }
+    sqlite3_finalize(stmt);
+
+    if (rc != SQLITE_OK) {
+        ESP_LOGE(TAG, "%s: %s", name, sqlite3_errmsg(db));
+    } else if (r.runs > 0) {
+        r.avg_us = r.total_us / r.runs;
+        ESP_LOGI(TAG, "%s: %lu runs, avg %lld us, min %lld us, max %lld us", name, (unsigned long)r.runs, r.avg_us,
+                 r.min_us, r.max_us);
+    }
+    if (result) {
+        *result = r;
+    }
+    return rc;
+}
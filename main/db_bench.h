@@ -0,0 +1,61 @@
+/* Statement benchmarks
+ *
+ * Times a prepared statement over many runs, with optional per-run binding,
+ * to compare schema, index or configuration changes on the device.
+ */
+#pragma once
+
+#include <stdint.h>
+#include "sqlite3.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Bind the parameters of one benchmark run.
+ *
+ * @param stmt - The prepared statement, already reset.
+ * @param iteration - Run number, from 0.
+ * @param ctx - User context passed to `db_bench_run`.
+ *
+ * @return SQLITE_OK, or an SQLite error code to abort the benchmark.
+ */
+typedef int (*db_bench_bind_fn)(sqlite3_stmt *stmt, uint32_t iteration, void *ctx);
+
+/**
+ * @brief Benchmark results.
+ */
+typedef struct {
+    uint32_t runs;          /*!< Completed runs */
+    int64_t total_us;       /*!< Total time of all runs */
+    int64_t avg_us;         /*!< Average time of one run */
+    int64_t min_us;         /*!< Fastest run */
+    int64_t max_us;         /*!< Slowest run */
+} db_bench_result_t;
+
+/**
+ * @brief Run a statement `runs` times and log its latency.
+ *
+ * The statement is prepared once; each run binds, steps it to completion and
+ * resets it. Writes are not wrapped in a transaction, so each run of a write
+ * statement includes its commit.
+ *
+ * @param db - A pointer to the SQLite database connection.
+ * @param name - Label used in the log.
+ * @param sql - Statement to run.
+ * @param runs - Number of runs.
+ * @param bind - Optional, binds each run.
+ * @param ctx - Passed to `bind`.
+ * @param result - Optional, receives the results.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - An SQLite error code on failure.
+ */
+int db_bench_run(sqlite3 *db, const char *name, const char *sql, uint32_t runs, db_bench_bind_fn bind, void *ctx,
+                 db_bench_result_t *result);
+
+#ifdef __cplusplus
+}
+#endif
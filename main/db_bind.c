@@ -0,0 +1,92 @@
+/* Typed parameter binding
+ *
+ * See db_bind.h.
+ */
+#include <stdarg.h>
+#include "db_bind.h"
+
+int db_bind_row(sqlite3_stmt *stmt, const db_bind_column_t *columns, size_t count, const void *row) {
+    const uint8_t *base = row;
+    int rc = SQLITE_OK;
+    for (size_t i = 0; i < count && rc == SQLITE_OK; i++) {
+        const db_bind_column_t *col = &columns[i];
+        const void *field = base + col->offset;
+        int param = (int)i + 1;
+        switch (col->type) {
+        case DB_BIND_TYPE_INT:
+            rc = sqlite3_bind_int(stmt, param, *(const int *)field);
+            break;
+        case DB_BIND_TYPE_INT64:
+            rc = sqlite3_bind_int64(stmt, param, *(const int64_t *)field);
+            break;
+        case DB_BIND_TYPE_DOUBLE:
+            rc = sqlite3_bind_double(stmt, param, *(const double *)field);
+            break;
+        case DB_BIND_TYPE_TEXT:
+            rc = sqlite3_bind_text(stmt, param, *(const char *const *)field, -1, SQLITE_STATIC);
+            break;
+        case DB_BIND_TYPE_TEXT_ARRAY:
+            rc = sqlite3_bind_text(stmt, param, (const char *)field, -1, SQLITE_STATIC);
+            break;
+        case DB_BIND_TYPE_BLOB:
+            rc = sqlite3_bind_blob(stmt, param, *(const void *const *)field,
+                                   (int)*(const size_t *)(base + col->len_offset), SQLITE_STATIC);
+            break;
+        default:
+            rc = sqlite3_bind_null(stmt, param);
+            break;
+        }
+    }
+    return rc;
+}
+
+int db_bind(sqlite3_stmt *stmt, const char *types, ...) {
+    va_list ap;
+    int rc = SQLITE_OK;
+    va_start(ap, types);
+    for (int param = 1; *types && rc == SQLITE_OK; types++, param++) {
+        switch (*types) {
+        case 'i':
+            rc = sqlite3_bind_int(stmt, param, va_arg(ap, int));
+            break;
+        case 'I':
+            rc = sqlite3_bind_int64(stmt, param, va_arg(ap, int64_t));
+            break;
+        case 'd':
+            rc = sqlite3_bind_double(stmt, param, va_arg(ap, double));
+            break;
+        case 't':
+            rc = sqlite3_bind_text(stmt, param, va_arg(ap, const char *), -1, SQLITE_STATIC);
+            break;
+        case 'b': {
+            const void *data = va_arg(ap, const void *);
+            rc = sqlite3_bind_blob(stmt, param, data, va_arg(ap, int), SQLITE_STATIC);
+            break;
+        }
+        case 'z':
+            rc = sqlite3_bind_zeroblob(stmt, param, va_arg(ap, int));
+            break;
+        case 'n':
+            rc = sqlite3_bind_null(stmt, param);
+            break;
+        default:
+            rc = SQLITE_MISUSE;
+            break;
+        }
+    }
+    va_end(ap);
+    return rc;
+}
+
+int db_bind_exec(sqlite3_stmt *stmt, const db_bind_column_t *columns, size_t count, const void *row) {
+    int rc = db_bind_row(stmt, columns, count, row);
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_step(stmt);
+        if (rc == SQLITE_DONE || rc == SQLITE_ROW) {
+            rc = SQLITE_OK;
+        }
+    }
+    int reset_rc = sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    return rc != SQLITE_OK ? rc : reset_rc;
+}
@@ -0,0 +1,124 @@
+/* Typed parameter binding
+ *
+ * Binds C values to a prepared statement with sqlite3_bind_* instead of
+ * formatting them into SQL text. Text and blobs are bound with SQLITE_STATIC,
+ * so SQLite reads them in place and a prepared insert runs without building,
+ * quoting or parsing SQL and without copying the values.
+ *
+ * Two forms are provided:
+ *
+ *     // Variadic, one letter per parameter
+ *     db_bind(stmt, "it", 1, "Hello");
+ *
+ *     // Descriptor table over a struct
+ *     static const db_bind_column_t columns[] = {
+ *         DB_BIND_INT(test_row_t, id),
+ *         DB_BIND_TEXT(test_row_t, content),
+ *     };
+ *     db_bind_row(stmt, columns, 2, &row);
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sqlite3.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Type of a bound struct field.
+ */
+typedef enum {
+    DB_BIND_TYPE_NULL,      /*!< Always binds NULL */
+    DB_BIND_TYPE_INT,       /*!< int */
+    DB_BIND_TYPE_INT64,     /*!< int64_t */
+    DB_BIND_TYPE_DOUBLE,    /*!< double */
+    DB_BIND_TYPE_TEXT,      /*!< const char *, NUL terminated, NULL binds NULL */
+    DB_BIND_TYPE_TEXT_ARRAY,/*!< char[], NUL terminated, stored in the struct */
+    DB_BIND_TYPE_BLOB,      /*!< const void * plus a size_t length field */
+} db_bind_type_t;
+
+/**
+ * @brief Binding of one struct field to one statement parameter.
+ *
+ * Entry N of a descriptor table binds parameter N+1.
+ */
+typedef struct {
+    db_bind_type_t type;
+    uint16_t offset;        /*!< Offset of the field in the struct */
+    uint16_t len_offset;    /*!< DB_BIND_TYPE_BLOB: offset of the size_t length field */
+} db_bind_column_t;
+
+#define DB_BIND_NULL()                  { DB_BIND_TYPE_NULL, 0, 0 }
+#define DB_BIND_INT(type, field)        { DB_BIND_TYPE_INT, offsetof(type, field), 0 }
+#define DB_BIND_INT64(type, field)      { DB_BIND_TYPE_INT64, offsetof(type, field), 0 }
+#define DB_BIND_DOUBLE(type, field)     { DB_BIND_TYPE_DOUBLE, offsetof(type, field), 0 }
+#define DB_BIND_TEXT(type, field)       { DB_BIND_TYPE_TEXT, offsetof(type, field), 0 }
+#define DB_BIND_TEXT_ARRAY(type, field) { DB_BIND_TYPE_TEXT_ARRAY, offsetof(type, field), 0 }
+#define DB_BIND_BLOB(type, field, len)  { DB_BIND_TYPE_BLOB, offsetof(type, field), offsetof(type, len) }
+
+/**
+ * @brief Bind the fields of a struct to the parameters of a statement.
+ *
+ * Values are bound with SQLITE_STATIC: the struct and the buffers it points
+ * to must stay valid until the statement has been stepped and reset, or use
+ * `db_bind_exec` which clears the bindings afterwards.
+ *
+ * @param stmt - Prepared statement.
+ * @param columns - Descriptor table, entry N binds parameter N+1.
+ * @param count - Number of entries in `columns`.
+ * @param row - Struct to read the values from.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - An SQLite error code on failure, e.g. SQLITE_RANGE for too many columns.
+ */
+int db_bind_row(sqlite3_stmt *stmt, const db_bind_column_t *columns, size_t count, const void *row);
+
+/**
+ * @brief Bind variadic arguments to the parameters of a statement.
+ *
+ * Each letter of `types` consumes arguments for the next parameter:
+ *  - `i`: int
+ *  - `I`: int64_t
+ *  - `d`: double
+ *  - `t`: const char *, NUL terminated
+ *  - `b`: const void *, int length
+ *  - `z`: int length, binds a zeroblob to be filled with db_blob.h
+ *  - `n`: no argument, binds NULL
+ *
+ * Same lifetime rules as `db_bind_row`.
+ *
+ * @param stmt - Prepared statement.
+ * @param types - Parameter types.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - SQLITE_MISUSE for an unknown type letter.
+ *  - An SQLite error code on failure.
+ */
+int db_bind(sqlite3_stmt *stmt, const char *types, ...);
+
+/**
+ * @brief Bind a struct, run the statement once and make it reusable.
+ *
+ * Binds `row`, steps the statement once, then resets it and clears
+ * the bindings, so no pointer into `row` is kept. Meant for inserts and
+ * updates prepared once and executed many times.
+ *
+ * @param stmt - Prepared statement.
+ * @param columns - Descriptor table.
+ * @param count - Number of entries in `columns`.
+ * @param row - Struct to read the values from.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - An SQLite error code on failure.
+ */
+int db_bind_exec(sqlite3_stmt *stmt, const db_bind_column_t *columns, size_t count, const void *row);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,70 @@
+/* Incremental BLOB I/O
+ *
+ * See db_blob.h.
+ */
+#include <stddef.h>
+#include "esp_log.h"
+#include "db_blob.h"
+
+static const char *TAG = "db_blob";
+
+int db_blob_open(sqlite3 *db, const char *table, const char *column, sqlite3_int64 rowid, bool write,
+                 db_blob_t *blob) {
+    blob->size = 0;
+    blob->offset = 0;
+    int rc = sqlite3_blob_open(db, "main", table, column, rowid, write ? 1 : 0, &blob->handle);
+    if (rc != SQLITE_OK) {
+        ESP_LOGE(TAG, "%s.%s row %lld: %s", table, column, (long long)rowid, sqlite3_errmsg(db));
+        sqlite3_blob_close(blob->handle);
+        blob->handle = NULL;
+        return rc;
+    }
+    blob->size = sqlite3_blob_bytes(blob->handle);
+    return SQLITE_OK;
+}
+
+int db_blob_write(db_blob_t *blob, const void *data, int len) {
+    if (len > blob->size - blob->offset) {
+        return SQLITE_FULL;
+    }
+    int rc = sqlite3_blob_write(blob->handle, data, len, blob->offset);
+    if (rc == SQLITE_OK) {
+        blob->offset += len;
+    }
+    return rc;
+}
+
+int db_blob_read(db_blob_t *blob, void *buf, int len, int *read) {
+    int n = blob->size - blob->offset;
+    if (n > len) {
+        n = len;
+    }
+    *read = 0;
+    if (n == 0) {
+        return SQLITE_OK;
+    }
+    int rc = sqlite3_blob_read(blob->handle, buf, n, blob->offset);
+    if (rc == SQLITE_OK) {
+        blob->offset += n;
+        *read = n;
+    }
+    return rc;
+}
+
+int db_blob_close(db_blob_t *blob) {
+    int rc = sqlite3_blob_close(blob->handle);
+    blob->handle = NULL;
+    return rc;
+}
+
+int db_blob_chunk_size(sqlite3 *db) {
+    sqlite3_stmt *stmt;
+    int size = 1024;
+    if (sqlite3_prepare_v2(db, "PRAGMA page_size", -1, &stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            size = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    return size;
+}
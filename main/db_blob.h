@@ -0,0 +1,111 @@
+/* Incremental BLOB I/O
+ *
+ * Streams large values in and out of a row with sqlite3_blob_* instead of
+ * binding or selecting the whole value at once. The row is first inserted
+ * with a zeroblob of the final size (`db_bind(stmt, "iz", id, size)`), then
+ * filled chunk by chunk straight from the producer's buffers, so RAM use is
+ * bounded by the chunk size and the page cache whatever the blob size.
+ *
+ *     db_blob_t blob;
+ *     db_blob_open(db, "test1", "content", rowid, true, &blob);
+ *     while (have_data) {
+ *         db_blob_write(&blob, dma_buf, len);
+ *     }
+ *     db_blob_close(&blob);
+ *
+ * Wrap the insert and the writes in one transaction to store the blob
+ * atomically; a blob handle opened in autocommit mode holds its own
+ * transaction until it is closed.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include "sqlite3.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Open blob with a sequential read/write position.
+ */
+typedef struct {
+    sqlite3_blob *handle;
+    int size;                   /*!< Size of the blob, fixed when it was inserted */
+    int offset;                 /*!< Position of the next read or write */
+} db_blob_t;
+
+/**
+ * @brief Open the blob stored in a column of a row.
+ *
+ * @param db - A pointer to the SQLite database connection.
+ * @param table - Table of the "main" database.
+ * @param column - Column holding the blob.
+ * @param rowid - Rowid of the row.
+ * @param write - Open for writing, otherwise read-only.
+ * @param blob - Receives the open blob, positioned at offset 0.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - An SQLite error code on failure, e.g. SQLITE_ERROR when the row does not exist.
+ */
+int db_blob_open(sqlite3 *db, const char *table, const char *column, sqlite3_int64 rowid, bool write,
+                 db_blob_t *blob);
+
+/**
+ * @brief Write the next chunk of a blob.
+ *
+ * Blobs cannot grow: writing past `size` fails without writing anything.
+ *
+ * @param blob - Blob opened for writing.
+ * @param data - Data to write at the current position.
+ * @param len - Number of bytes.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - SQLITE_FULL if `len` exceeds the space left in the blob.
+ *  - SQLITE_ABORT if the row was changed since the blob was opened.
+ *  - An SQLite error code on failure.
+ */
+int db_blob_write(db_blob_t *blob, const void *data, int len);
+
+/**
+ * @brief Read the next chunk of a blob.
+ *
+ * @param blob - Open blob.
+ * @param buf - Buffer for the data.
+ * @param len - Size of `buf`.
+ * @param read - Receives the number of bytes read, 0 at the end of the blob.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - SQLITE_ABORT if the row was changed since the blob was opened.
+ *  - An SQLite error code on failure.
+ */
+int db_blob_read(db_blob_t *blob, void *buf, int len, int *read);
+
+/**
+ * @brief Close a blob, committing its writes when no transaction was open.
+ *
+ * @param blob - Open blob, or one whose open failed.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - An SQLite error code if the implicit commit failed.
+ */
+int db_blob_close(db_blob_t *blob);
+
+/**
+ * @brief Preferred chunk size for streaming, the database page size.
+ *
+ * Chunks that are a multiple of the page size fill whole pages per call.
+ *
+ * @param db - A pointer to the SQLite database connection.
+ *
+ * @return Page size in bytes.
+ */
+int db_blob_chunk_size(sqlite3 *db);
+
+#ifdef __cplusplus
+}
+#endif
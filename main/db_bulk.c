@@ -0,0 +1,158 @@
+/* Bulk loading
+ *
+ * See db_bulk.h. Compared to one `db_exec` per formatted INSERT this avoids
+ * building and parsing SQL for every row, pays a single journal sync for the
+ * whole batch and builds each secondary index once, in sorted order, instead
+ * of updating it row by row.
+ */
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "db_bulk.h"
+
+static const char *TAG = "db_bulk";
+
+/**
+ * @brief Secondary indexes of a table, saved so they can be recreated.
+ */
+typedef struct {
+    char *drop_sql;
+    char *sql;
+} db_bulk_index_t;
+
+typedef struct {
+    db_bulk_index_t *items;
+    int count;
+} db_bulk_indexes_t;
+
+static void db_bulk_indexes_free(db_bulk_indexes_t *indexes) {
+    for (int i = 0; i < indexes->count; i++) {
+        sqlite3_free(indexes->items[i].drop_sql);
+        sqlite3_free(indexes->items[i].sql);
+    }
+    sqlite3_free(indexes->items);
+    indexes->items = NULL;
+    indexes->count = 0;
+}
+
+/**
+ * @brief Save and drop the explicit indexes of a table.
+ *
+ * Indexes SQLite creates for UNIQUE/PRIMARY KEY constraints have no SQL and
+ * cannot be dropped, so they are left alone.
+ */
+static int db_bulk_drop_indexes(sqlite3 *db, const char *table, db_bulk_indexes_t *indexes) {
+    sqlite3_stmt *stmt;
+    int rc = sqlite3_prepare_v2(db, "SELECT name, sql FROM sqlite_master "
+                                    "WHERE type = 'index' AND tbl_name = ? AND sql IS NOT NULL",
+                                -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    sqlite3_bind_text(stmt, 1, table, -1, SQLITE_STATIC);
+
+    // Collect first: the schema cannot change while sqlite_master is being read
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        db_bulk_index_t *items = sqlite3_realloc(indexes->items, (indexes->count + 1) * sizeof(db_bulk_index_t));
+        if (items == NULL) {
+            rc = SQLITE_NOMEM;
+            break;
+        }
+        indexes->items = items;
+        db_bulk_index_t *index = &indexes->items[indexes->count++];
+        index->drop_sql = sqlite3_mprintf("DROP INDEX \"%w\"", (const char *)sqlite3_column_text(stmt, 0));
+        index->sql = sqlite3_mprintf("%s", (const char *)sqlite3_column_text(stmt, 1));
+        if (index->drop_sql == NULL || index->sql == NULL) {
+            rc = SQLITE_NOMEM;
+            break;
+        }
+    }
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        return rc;
+    }
+
+    for (int i = 0; i < indexes->count; i++) {
+        rc = sqlite3_exec(db, indexes->items[i].drop_sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) {
+            return rc;
+        }
+    }
+    if (indexes->count > 0) {
+        ESP_LOGI(TAG, "%s: deferred %d index(es)", table, indexes->count);
+    }
+    return SQLITE_OK;
+}
+
+static int db_bulk_create_indexes(sqlite3 *db, const db_bulk_indexes_t *indexes) {
+    for (int i = 0; i < indexes->count; i++) {
+        int rc = sqlite3_exec(db, indexes->items[i].sql, NULL, NULL, NULL);
+        if (rc != SQLITE_OK) {
+            return rc;
+        }
+    }
+    return SQLITE_OK;
+}
+
+int db_bulk_load(sqlite3 *db, const db_bulk_config_t *config, const void *rows, size_t count, size_t row_size,
+                 db_bulk_stats_t *stats) {
+    db_bulk_indexes_t indexes = { 0 };
+    sqlite3_stmt *stmt = NULL;
+    int64_t start = esp_timer_get_time();
+    int64_t rebuild_us = 0;
+    size_t done = 0;
+
+    int rc = sqlite3_exec(db, "BEGIN IMMEDIATE", NULL, NULL, NULL);
+    if (rc == SQLITE_OK && config->defer_indexes) {
+        rc = db_bulk_drop_indexes(db, config->table, &indexes);
+    }
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_prepare_v2(db, config->sql, -1, &stmt, NULL);
+    }
+
+    const uint8_t *row = rows;
+    for (; rc == SQLITE_OK && done < count; done++, row += row_size) {
+        if (config->bind) {
+            rc = config->bind(stmt, row, config->ctx);
+        } else {
+            rc = db_bind_row(stmt, config->columns, config->column_count, row);
+        }
+        if (rc != SQLITE_OK) {
+            break;
+        }
+        rc = sqlite3_step(stmt);
+        if (rc != SQLITE_DONE) {
+            break;
+        }
+        rc = sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+
+    if (rc == SQLITE_OK && indexes.count > 0) {
+        int64_t rebuild_start = esp_timer_get_time();
+        rc = db_bulk_create_indexes(db, &indexes);
+        rebuild_us = esp_timer_get_time() - rebuild_start;
+    }
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+    }
+    db_bulk_indexes_free(&indexes);
+
+    if (rc != SQLITE_OK) {
+        ESP_LOGE(TAG, "%s: bulk load failed at row %d: %s", config->table, (int)done, sqlite3_errmsg(db));
+        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+        return rc;
+    }
+
+    int64_t elapsed = esp_timer_get_time() - start;
+    uint32_t rate = elapsed > 0 ? (uint32_t)((int64_t)count * 1000000 / elapsed) : 0;
+    ESP_LOGI(TAG, "%s: loaded %d rows in %lld us (%u rows/s, index rebuild %lld us)", config->table, (int)count,
+             elapsed, (unsigned)rate, rebuild_us);
+    if (stats) {
+        stats->rows = count;
+        stats->elapsed_us = elapsed;
+        stats->index_rebuild_us = rebuild_us;
+        stats->rows_per_sec = rate;
+    }
+    return SQLITE_OK;
+}
@@ -0,0 +1,75 @@
+/* Bulk loading
+ *
+ * Inserts an array of structs through a single prepared statement inside one
+ * transaction, optionally dropping the table's secondary indexes first and
+ * rebuilding them once at the end.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sqlite3.h"
+#include "db_bind.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Bind one row to the insert statement.
+ *
+ * @param stmt - The prepared insert statement, already reset.
+ * @param row - Pointer to the row struct to bind.
+ * @param ctx - User context from `db_bulk_config_t`.
+ *
+ * @return SQLITE_OK, or an SQLite error code to abort the load.
+ */
+typedef int (*db_bulk_bind_fn)(sqlite3_stmt *stmt, const void *row, void *ctx);
+
+/**
+ * @brief Bulk load configuration.
+ */
+typedef struct {
+    const char *table;          /*!< Target table, used to find its secondary indexes */
+    const char *sql;            /*!< INSERT statement with `?` placeholders */
+    db_bulk_bind_fn bind;       /*!< Binds one row to `sql`, or NULL to use `columns` */
+    void *ctx;                  /*!< Passed to `bind` */
+    const db_bind_column_t *columns; /*!< Descriptor table binding each row when `bind` is NULL */
+    size_t column_count;        /*!< Number of entries in `columns` */
+    bool defer_indexes;         /*!< Drop secondary indexes during the load and rebuild them at the end */
+} db_bulk_config_t;
+
+/**
+ * @brief Bulk load statistics.
+ */
+typedef struct {
+    size_t rows;                /*!< Rows inserted */
+    int64_t elapsed_us;         /*!< Total time, including index rebuild and commit */
+    int64_t index_rebuild_us;   /*!< Time spent recreating deferred indexes */
+    uint32_t rows_per_sec;      /*!< Throughput over `elapsed_us` */
+} db_bulk_stats_t;
+
+/**
+ * @brief Insert an array of rows in one transaction.
+ *
+ * The statement is prepared once and reused for every row. If anything fails
+ * the whole transaction is rolled back, including dropped indexes.
+ *
+ * @param db - A pointer to the SQLite database connection.
+ * @param config - Bulk load configuration.
+ * @param rows - First row of the array.
+ * @param count - Number of rows.
+ * @param row_size - Distance in bytes between consecutive rows, usually `sizeof` the row struct.
+ * @param stats - Optional, receives load statistics.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - An SQLite error code on failure.
+ */
+int db_bulk_load(sqlite3 *db, const db_bulk_config_t *config, const void *rows, size_t count, size_t row_size,
+                 db_bulk_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,414 @@
+/* Change data capture
+ *
+ * See db_cdc.h. Every attached connection has a buffer for the records of
+ * its open transaction, filled by the update hook. The hook remembers the
+ * index of the last table it saw, so only a change to another table looks the
+ * table up under `lock`; entries of `tables` never change once registered,
+ * so the remembered one is compared without locking. The commit
+ * hook copies them into the ring under `lock` and wakes readers through
+ * `available`. When records do not fit, the tables they belong to are merged
+ * into `lost_table` and a DB_CDC_RESYNC record naming them is published as
+ * soon as the ring has room again.
+ *
+ * SQLite does not call the update hook for WITHOUT ROWID tables, for virtual
+ * tables or for a DELETE without WHERE, but counts those rows in
+ * `sqlite3_total_changes`. The commit and rollback hooks compare that count
+ * with the rows the update hook reported and publish a DB_CDC_RESYNC of all
+ * tables when more rows changed. A statement run outside BEGIN commits
+ * before its own changes are counted, so its reported rows are carried in
+ * `reported` and checked against the count at the next commit or rollback of
+ * the connection; a missed change by such a statement is only flagged then.
+ *
+ * The commit hook runs before the commit is durable, so a commit that then
+ * fails still publishes its records. Rows changed in a savepoint that is
+ * rolled back are also reported. Both are harmless, as a record only tells
+ * the consumer to read the row again.
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "db_cdc.h"
+#include "db_hooks.h"
+
+static const char *TAG = "db_cdc";
+
+typedef struct {
+    sqlite3 *db;
+    char *schema;
+    char *name;
+} db_cdc_table_t;
+
+typedef struct {
+    sqlite3 *db;
+    db_cdc_record_t *pending;   /* records of the open transaction */
+    size_t count;
+    uint32_t dropped;           /* records that did not fit in `pending` */
+    uint8_t dropped_table;      /* table of the dropped records, DB_CDC_ALL_TABLES if several */
+    uint32_t hooked;            /* rows reported by the update hook in the open transaction */
+    uint32_t reported;          /* rows reported by a committed statement not yet in `changes` */
+    int changes;                /* sqlite3_total_changes at the last commit or rollback */
+    int last_table;             /* index of the table of the last update, -1 if none */
+} db_cdc_conn_t;
+
+static struct {
+    db_cdc_config_t config;
+    db_cdc_record_t *ring;
+    size_t head;                /* oldest record */
+    size_t count;
+    uint32_t seq;
+    bool lost;                  /* a DB_CDC_RESYNC record is owed */
+    uint8_t lost_table;
+    db_cdc_table_t tables[DB_CDC_MAX_TABLES];
+    int table_count;
+    db_cdc_conn_t conns[DB_HOOKS_MAX_DBS];
+    SemaphoreHandle_t lock;         /* protects the ring, `tables` and `stats` */
+    SemaphoreHandle_t available;
+    db_cdc_stats_t stats;
+} s_cdc;
+
+/**
+ * @brief Merge a table into the set a DB_CDC_RESYNC record names.
+ *
+ * @param current - Table named so far, valid only if `any` is set.
+ * @param any - Whether a table is named so far.
+ * @param table - Table to add.
+ *
+ * @return The single table, or DB_CDC_ALL_TABLES if they differ.
+ */
+static uint8_t db_cdc_merge_table(uint8_t current, bool any, uint8_t table) {
+    return !any || current == table ? table : DB_CDC_ALL_TABLES;
+}
+
+/**
+ * @brief Find or register a table. Called with `lock` held.
+ *
+ * @return The table index, or DB_CDC_ALL_TABLES if there is no slot left.
+ */
+static uint8_t db_cdc_table_index(sqlite3 *db, const char *schema, const char *name) {
+    for (int i = 0; i < s_cdc.table_count; i++) {
+        db_cdc_table_t *table = &s_cdc.tables[i];
+        if (table->db == db && strcmp(table->name, name) == 0 && strcmp(table->schema, schema) == 0) {
+            return i;
+        }
+    }
+    if (s_cdc.table_count == DB_CDC_MAX_TABLES) {
+        return DB_CDC_ALL_TABLES;
+    }
+    db_cdc_table_t *table = &s_cdc.tables[s_cdc.table_count];
+    table->schema = strdup(schema);
+    table->name = strdup(name);
+    if (table->schema == NULL || table->name == NULL) {
+        free(table->schema);
+        free(table->name);
+        return DB_CDC_ALL_TABLES;
+    }
+    table->db = db;
+    return s_cdc.table_count++;
+}
+
+/**
+ * @brief Append a record to the ring. Called with `lock` held and room in the ring.
+ */
+static void db_cdc_push(uint8_t op, uint8_t table, sqlite3_int64 rowid) {
+    db_cdc_record_t *record = &s_cdc.ring[(s_cdc.head + s_cdc.count) % s_cdc.config.records];
+    record->seq = s_cdc.seq++;
+    record->op = op;
+    record->table = table;
+    record->rowid = rowid;
+    s_cdc.count++;
+}
+
+/**
+ * @brief Publish the owed DB_CDC_RESYNC record if the ring has room. Called with `lock` held.
+ */
+static void db_cdc_push_resync(void) {
+    if (s_cdc.lost && s_cdc.count < s_cdc.config.records) {
+        db_cdc_push(DB_CDC_RESYNC, s_cdc.lost_table, 0);
+        s_cdc.lost = false;
+    }
+}
+
+static void db_cdc_update(void *ctx, int op, const char *db_name, const char *table, sqlite3_int64 rowid) {
+    db_cdc_conn_t *conn = ctx;
+    conn->hooked++;
+    uint8_t index;
+    const db_cdc_table_t *last = conn->last_table >= 0 ? &s_cdc.tables[conn->last_table] : NULL;
+    if (last != NULL && strcmp(last->name, table) == 0 && strcmp(last->schema, db_name) == 0) {
+        index = conn->last_table;
+    } else {
+        xSemaphoreTake(s_cdc.lock, portMAX_DELAY);
+        index = db_cdc_table_index(conn->db, db_name, table);
+        xSemaphoreGive(s_cdc.lock);
+        conn->last_table = index == DB_CDC_ALL_TABLES ? -1 : index;
+    }
+
+    if (index == DB_CDC_ALL_TABLES || conn->count == s_cdc.config.txn_records) {
+        conn->dropped_table = db_cdc_merge_table(conn->dropped_table, conn->dropped > 0, index);
+        conn->dropped++;
+        return;
+    }
+    db_cdc_record_t *record = &conn->pending[conn->count++];
+    record->op = op;
+    record->table = index;
+    record->rowid = rowid;
+}
+
+/**
+ * @brief Whether a statement that writes is running, i.e. the transaction ends with that statement.
+ *
+ * COMMIT and ROLLBACK are read-only statements.
+ */
+static bool db_cdc_statement_running(sqlite3 *db) {
+    for (sqlite3_stmt *stmt = sqlite3_next_stmt(db, NULL); stmt; stmt = sqlite3_next_stmt(db, stmt)) {
+        if (sqlite3_stmt_busy(stmt) && !sqlite3_stmt_readonly(stmt)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Compare the changes SQLite counted with the rows the update hook reported, as a transaction ends.
+ *
+ * @param committed - Whether the transaction commits; the rows of a rolled back statement are never counted.
+ *
+ * @return true if rows changed without being reported.
+ */
+static bool db_cdc_missed(db_cdc_conn_t *conn, bool committed) {
+    int changes = sqlite3_total_changes(conn->db);
+    bool running = db_cdc_statement_running(conn->db);
+    uint32_t expected = conn->reported + (running ? 0 : conn->hooked);
+    bool missed = (uint32_t)changes - (uint32_t)conn->changes > expected;
+    conn->changes = changes;
+    conn->reported = running && committed ? conn->hooked : 0;
+    conn->hooked = 0;
+    return missed;
+}
+
+static int db_cdc_commit(void *ctx) {
+    db_cdc_conn_t *conn = ctx;
+    if (db_cdc_missed(conn, true)) {
+        conn->dropped_table = DB_CDC_ALL_TABLES;
+        conn->dropped++;
+    }
+    if (conn->count == 0 && conn->dropped == 0) {
+        return 0;
+    }
+    xSemaphoreTake(s_cdc.lock, portMAX_DELAY);
+    if (conn->dropped > 0) {
+        s_cdc.lost_table = db_cdc_merge_table(s_cdc.lost_table, s_cdc.lost, conn->dropped_table);
+        s_cdc.lost = true;
+        s_cdc.stats.dropped += conn->dropped;
+    }
+    size_t needed = conn->count + (s_cdc.lost ? 1 : 0);
+    if (s_cdc.config.records - s_cdc.count >= needed) {
+        db_cdc_push_resync();
+        for (size_t i = 0; i < conn->count; i++) {
+            db_cdc_push(conn->pending[i].op, conn->pending[i].table, conn->pending[i].rowid);
+        }
+        s_cdc.stats.published += conn->count;
+    } else {
+        // The consumer is behind: drop the whole transaction, it is covered by the resync
+        for (size_t i = 0; i < conn->count; i++) {
+            s_cdc.lost_table = db_cdc_merge_table(s_cdc.lost_table, s_cdc.lost, conn->pending[i].table);
+            s_cdc.lost = true;
+        }
+        s_cdc.stats.dropped += conn->count;
+        db_cdc_push_resync();
+    }
+    xSemaphoreGive(s_cdc.lock);
+    xSemaphoreGive(s_cdc.available);
+
+    conn->count = 0;
+    conn->dropped = 0;
+    return 0;
+}
+
+static void db_cdc_rollback(void *ctx) {
+    db_cdc_conn_t *conn = ctx;
+    // Counted changes not reported may belong to an earlier, committed statement
+    bool missed = db_cdc_missed(conn, false);
+    if (conn->count > 0 || missed) {
+        xSemaphoreTake(s_cdc.lock, portMAX_DELAY);
+        s_cdc.stats.rolled_back += conn->count;
+        if (missed) {
+            s_cdc.lost_table = DB_CDC_ALL_TABLES;
+            s_cdc.lost = true;
+            s_cdc.stats.dropped++;
+            db_cdc_push_resync();
+        }
+        xSemaphoreGive(s_cdc.lock);
+        if (missed) {
+            xSemaphoreGive(s_cdc.available);
+        }
+    }
+    conn->count = 0;
+    conn->dropped = 0;
+}
+
+esp_err_t db_cdc_start(const db_cdc_config_t *config) {
+    if (s_cdc.lock != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    memset(&s_cdc, 0, sizeof(s_cdc));
+    s_cdc.config = *config;
+    s_cdc.ring = malloc(config->records * sizeof(db_cdc_record_t));
+    s_cdc.lock = xSemaphoreCreateMutex();
+    s_cdc.available = xSemaphoreCreateBinary();
+    if (config->records == 0 || s_cdc.ring == NULL || s_cdc.lock == NULL || s_cdc.available == NULL) {
+        db_cdc_stop();
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Started, %d records", (int)config->records);
+    return ESP_OK;
+}
+
+void db_cdc_stop(void) {
+    for (int i = 0; i < DB_HOOKS_MAX_DBS; i++) {
+        if (s_cdc.conns[i].db != NULL) {
+            db_cdc_detach(s_cdc.conns[i].db);
+        }
+    }
+    if (s_cdc.lock != NULL) {
+        ESP_LOGI(TAG, "%d records published, %d read, %d dropped, %d rolled back", (int)s_cdc.stats.published,
+                 (int)s_cdc.stats.read, (int)s_cdc.stats.dropped, (int)s_cdc.stats.rolled_back);
+    }
+    for (int i = 0; i < s_cdc.table_count; i++) {
+        free(s_cdc.tables[i].schema);
+        free(s_cdc.tables[i].name);
+    }
+    s_cdc.table_count = 0;
+    free(s_cdc.ring);
+    s_cdc.ring = NULL;
+    if (s_cdc.lock) {
+        vSemaphoreDelete(s_cdc.lock);
+    }
+    if (s_cdc.available) {
+        vSemaphoreDelete(s_cdc.available);
+    }
+    s_cdc.lock = s_cdc.available = NULL;
+}
+
+int db_cdc_attach(sqlite3 *db) {
+    if (s_cdc.lock == NULL || db == NULL) {
+        return SQLITE_MISUSE;
+    }
+    db_cdc_conn_t *conn = NULL;
+    for (int i = 0; i < DB_HOOKS_MAX_DBS; i++) {
+        if (s_cdc.conns[i].db == db) {
+            return SQLITE_OK;
+        }
+        if (conn == NULL && s_cdc.conns[i].db == NULL) {
+            conn = &s_cdc.conns[i];
+        }
+    }
+    if (conn == NULL) {
+        return SQLITE_FULL;
+    }
+    conn->pending = malloc(s_cdc.config.txn_records * sizeof(db_cdc_record_t));
+    if (conn->pending == NULL && s_cdc.config.txn_records > 0) {
+        return SQLITE_NOMEM;
+    }
+    conn->count = 0;
+    conn->dropped = 0;
+    conn->hooked = 0;
+    conn->reported = 0;
+    conn->changes = sqlite3_total_changes(db);
+    conn->last_table = -1;
+    const db_hooks_t hooks = {
+        .update = db_cdc_update,
+        .commit = db_cdc_commit,
+        .rollback = db_cdc_rollback,
+        .ctx = conn,
+    };
+    int rc = db_hooks_add(db, &hooks);
+    if (rc != SQLITE_OK) {
+        free(conn->pending);
+        conn->pending = NULL;
+        return rc;
+    }
+    conn->db = db;
+    return SQLITE_OK;
+}
+
+void db_cdc_detach(sqlite3 *db) {
+    for (int i = 0; i < DB_HOOKS_MAX_DBS; i++) {
+        db_cdc_conn_t *conn = &s_cdc.conns[i];
+        if (db != NULL && conn->db == db) {
+            db_hooks_remove(db, conn);
+            free(conn->pending);
+            conn->pending = NULL;
+            conn->db = NULL;
+        }
+    }
+}
+
+/**
+ * @brief Move records from the ring to the caller. Called with `lock` held.
+ */
+static size_t db_cdc_take(db_cdc_record_t *records, size_t max) {
+    db_cdc_push_resync();
+    size_t n = 0;
+    while (n < max && s_cdc.count > 0) {
+        records[n++] = s_cdc.ring[s_cdc.head];
+        s_cdc.head = (s_cdc.head + 1) % s_cdc.config.records;
+        s_cdc.count--;
+    }
+    // The ring has room again, the next read gets the resync
+    db_cdc_push_resync();
+    s_cdc.stats.read += n;
+    return n;
+}
+
+size_t db_cdc_read(db_cdc_record_t *records, size_t max, TickType_t wait) {
+    if (s_cdc.lock == NULL || max == 0) {
+        return 0;
+    }
+    TickType_t start = xTaskGetTickCount();
+    for (;;) {
+        xSemaphoreTake(s_cdc.lock, portMAX_DELAY);
+        size_t n = db_cdc_take(records, max);
+        xSemaphoreGive(s_cdc.lock);
+        if (n > 0) {
+            return n;
+        }
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= wait || xSemaphoreTake(s_cdc.available, wait - elapsed) != pdTRUE) {
+            return 0;
+        }
+    }
+}
+
+const char *db_cdc_table(uint8_t table, sqlite3 **db, const char **schema) {
+    if (s_cdc.lock == NULL) {
+        return NULL;
+    }
+    xSemaphoreTake(s_cdc.lock, portMAX_DELAY);
+    const char *name = NULL;
+    if (table < s_cdc.table_count) {
+        name = s_cdc.tables[table].name;
+        if (db) {
+            *db = s_cdc.tables[table].db;
+        }
+        if (schema) {
+            *schema = s_cdc.tables[table].schema;
+        }
+    }
+    xSemaphoreGive(s_cdc.lock);
+    return name;
+}
+
+void db_cdc_get_stats(db_cdc_stats_t *stats) {
+    if (s_cdc.lock == NULL) {
+        *stats = s_cdc.stats;
+        return;
+    }
+    xSemaphoreTake(s_cdc.lock, portMAX_DELAY);
+    *stats = s_cdc.stats;
+    stats->pending = s_cdc.count;
+    xSemaphoreGive(s_cdc.lock);
+}
@@ -0,0 +1,157 @@
+/* Change data capture
+ *
+ * Records which rows the attached connections change, so a sync task can
+ * read only the deltas instead of scanning whole tables. The update hook
+ * (db_hooks.h) collects a compact record (table, operation, rowid) per row
+ * changed by a transaction; the commit hook publishes them into a RAM ring
+ * buffer and the rollback hook discards them. Another task reads the ring
+ * with `db_cdc_read`.
+ *
+ *     db_cdc_config_t config = DB_CDC_CONFIG_DEFAULT();
+ *     db_cdc_start(&config);
+ *     db_cdc_attach(db1);
+ *     ...
+ *     // sync task
+ *     db_cdc_record_t records[16];
+ *     size_t n = db_cdc_read(records, 16, portMAX_DELAY);
+ *
+ * A record says the row may have changed; the consumer reads its current
+ * state by rowid (a missing row was deleted). A `DB_CDC_RESYNC` record means
+ * records were dropped, because the ring was full or a transaction changed
+ * more rows than `txn_records`, and the tables it names must be read in full.
+ * Only rows of rowid tables are captured. SQLite does not report changes to
+ * WITHOUT ROWID or virtual tables, or a `DELETE` without WHERE, to the update
+ * hook; they are detected from `sqlite3_total_changes` and published as a
+ * `DB_CDC_RESYNC` of `DB_CDC_ALL_TABLES`. For a statement run outside an
+ * explicit transaction this happens at the next commit or rollback of the
+ * connection.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "sqlite3.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Distinct tables that can be captured; changes to further tables are reported as `DB_CDC_RESYNC`. */
+#define DB_CDC_MAX_TABLES 32
+
+/** `op` of a record telling that changes were dropped. */
+#define DB_CDC_RESYNC 0
+
+/** `table` of a `DB_CDC_RESYNC` record that concerns every table. */
+#define DB_CDC_ALL_TABLES 0xff
+
+/**
+ * @brief Change data capture configuration.
+ */
+typedef struct {
+    size_t records;             /*!< Capacity of the ring buffer */
+    size_t txn_records;         /*!< Records one transaction can collect per connection */
+} db_cdc_config_t;
+
+/** Default configuration, from Kconfig. */
+#define DB_CDC_CONFIG_DEFAULT() {                                   \
+    .records = CONFIG_EXAMPLE_DB_CDC_RECORDS,                       \
+    .txn_records = CONFIG_EXAMPLE_DB_CDC_TXN_RECORDS,               \
+}
+
+/**
+ * @brief One changed row.
+ */
+typedef struct {
+    uint32_t seq;               /*!< Position in the change stream, increasing by one per record */
+    uint8_t op;                 /*!< SQLITE_INSERT, SQLITE_UPDATE, SQLITE_DELETE or DB_CDC_RESYNC */
+    uint8_t table;              /*!< Table, see `db_cdc_table`, or DB_CDC_ALL_TABLES */
+    sqlite3_int64 rowid;        /*!< Row changed, 0 for DB_CDC_RESYNC */
+} db_cdc_record_t;
+
+/**
+ * @brief Change data capture metrics.
+ */
+typedef struct {
+    uint32_t published;         /*!< Records published by committed transactions */
+    uint32_t read;              /*!< Records read by consumers */
+    uint32_t dropped;           /*!< Records dropped, replaced by DB_CDC_RESYNC */
+    uint32_t rolled_back;       /*!< Records discarded by rollbacks */
+    uint32_t pending;           /*!< Records in the ring buffer now */
+} db_cdc_stats_t;
+
+/**
+ * @brief Allocate the ring buffer.
+ *
+ * @param config - Configuration, copied.
+ *
+ * @return
+ *  - ESP_OK on success.
+ *  - ESP_ERR_INVALID_STATE if it is already started.
+ *  - ESP_ERR_NO_MEM if the buffer or the locks could not be created.
+ */
+esp_err_t db_cdc_start(const db_cdc_config_t *config);
+
+/**
+ * @brief Detach every connection and free the ring buffer.
+ *
+ * No consumer may be waiting in `db_cdc_read`.
+ */
+void db_cdc_stop(void);
+
+/**
+ * @brief Capture the changes made through a connection.
+ *
+ * Call from the task that owns the connection, or before the database
+ * service is started.
+ *
+ * @param db - A pointer to the SQLite database connection.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - SQLITE_MISUSE if capture is not started.
+ *  - SQLITE_NOMEM if the transaction buffer cannot be allocated.
+ *  - SQLITE_FULL if too many connections or hook subscribers are registered.
+ */
+int db_cdc_attach(sqlite3 *db);
+
+/**
+ * @brief Stop capturing the changes of a connection.
+ *
+ * @param db - A pointer to the SQLite database connection.
+ */
+void db_cdc_detach(sqlite3 *db);
+
+/**
+ * @brief Take the oldest records from the ring buffer.
+ *
+ * @param records - Receives the records, oldest first.
+ * @param max - Capacity of `records`.
+ * @param wait - Ticks to wait for a commit if the ring is empty.
+ *
+ * @return Number of records read, 0 if none arrived in time.
+ */
+size_t db_cdc_read(db_cdc_record_t *records, size_t max, TickType_t wait);
+
+/**
+ * @brief Name the table of a record.
+ *
+ * @param table - `table` of a record.
+ * @param db - Receives the connection of the table, may be NULL.
+ * @param schema - Receives the schema name ("main" or the ATTACH name), may be NULL.
+ *
+ * @return The table name, valid until `db_cdc_stop`, or NULL for an unknown index.
+ */
+const char *db_cdc_table(uint8_t table, sqlite3 **db, const char **schema);
+
+/**
+ * @brief Read the change data capture metrics.
+ */
+void db_cdc_get_stats(db_cdc_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
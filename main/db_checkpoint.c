@@ -0,0 +1,177 @@
+/* Idle-time checkpoints and flushes
+ *
+ * See db_checkpoint.h. Jobs only do work when the database changed since
+ * their last run, detected with sqlite3_total_changes().
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/unistd.h>
+#include "esp_log.h"
+#include "esp_spiffs.h"
+#include "esp_timer.h"
+#include "db_checkpoint.h"
+#include "db_service.h"
+
+static const char *TAG = "db_checkpoint";
+
+typedef struct {
+    db_checkpoint_config_t config;
+    int last_changes;
+} db_checkpoint_job_t;
+
+typedef struct {
+    const char *partition_label;
+    size_t size_to_gc;
+    size_t last_used;   /* used bytes after the last GC */
+} db_spiffs_gc_job_t;
+
+int db_checkpoint_set_journal_mode(sqlite3 *db, const char *mode) {
+    int rc;
+    if (strcasecmp(mode, "WAL") == 0) {
+        // No shared memory on SPIFFS: keep the WAL index in heap memory
+        rc = sqlite3_exec(db, "PRAGMA locking_mode=EXCLUSIVE", NULL, NULL, NULL);
+        if (rc != SQLITE_OK) {
+            return rc;
+        }
+    }
+
+    char sql[40];
+    sqlite3_stmt *stmt;
+    snprintf(sql, sizeof(sql), "PRAGMA journal_mode=%s", mode);
+    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW) {
+        const char *actual = (const char *)sqlite3_column_text(stmt, 0);
+        rc = (actual && strcasecmp(actual, mode) == 0) ? SQLITE_OK : SQLITE_ERROR;
+        if (rc != SQLITE_OK) {
+            ESP_LOGE(TAG, "journal_mode=%s not applied, still %s", mode, actual ? actual : "?");
+        }
+    }
+    sqlite3_finalize(stmt);
+    return rc;
+}
+
+/**
+ * @brief Read the current journal mode.
+ */
+static void db_checkpoint_journal_mode(sqlite3 *db, const char *schema, char *mode, size_t size) {
+    sqlite3_stmt *stmt;
+    char sql[48];
+    mode[0] = '\0';
+    snprintf(sql, sizeof(sql), "PRAGMA \"%s\".journal_mode", schema);
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        return;
+    }
+    if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_text(stmt, 0)) {
+        snprintf(mode, size, "%s", (const char *)sqlite3_column_text(stmt, 0));
+    }
+    sqlite3_finalize(stmt);
+}
+
+/**
+ * @brief Truncate the journal left behind by PERSIST mode.
+ *
+ * Its header is zeroed after every commit, so outside of a transaction it is
+ * not a hot journal and can be emptied.
+ */
+static void db_checkpoint_truncate_journal(const db_checkpoint_config_t *config, const char *schema) {
+    const char *filename = sqlite3_db_filename(config->db, schema);
+    if (filename == NULL || filename[0] == '\0' || !sqlite3_get_autocommit(config->db)) {
+        return;
+    }
+    // Name SQLite itself uses for the journal, never the database file
+    const char *path = sqlite3_filename_journal(filename);
+    struct stat st;
+    if (path == NULL || path[0] == '\0') {
+        return;
+    }
+    if (stat(path, &st) == 0 && st.st_size > 0) {
+        if (truncate(path, 0) == 0) {
+            ESP_LOGD(TAG, "%s: truncated %d byte journal", config->name, (int)st.st_size);
+        }
+    }
+}
+
+static bool db_checkpoint_idle(void *arg, int64_t budget_us) {
+    db_checkpoint_job_t *job = arg;
+    const db_checkpoint_config_t *config = &job->config;
+    int changes = sqlite3_total_changes(config->db);
+    if (changes == job->last_changes) {
+        return false;
+    }
+    job->last_changes = changes;
+
+    const char *schema = config->schema ? config->schema : "main";
+    char mode[16];
+    db_checkpoint_journal_mode(config->db, schema, mode, sizeof(mode));
+    int64_t start = esp_timer_get_time();
+    if (strcasecmp(mode, "wal") == 0) {
+        int log_pages = 0, checkpointed = 0;
+        int rc = sqlite3_wal_checkpoint_v2(config->db, schema, SQLITE_CHECKPOINT_TRUNCATE, &log_pages,
+                                           &checkpointed);
+        if (rc != SQLITE_OK) {
+            ESP_LOGW(TAG, "%s: checkpoint failed: %s", config->name, sqlite3_errmsg(config->db));
+            return false;
+        }
+        ESP_LOGD(TAG, "%s: checkpointed %d/%d WAL pages in %lld us", config->name, checkpointed, log_pages,
+                 esp_timer_get_time() - start);
+    } else if (strcasecmp(mode, "persist") == 0) {
+        db_checkpoint_truncate_journal(config, schema);
+    }
+    return false;
+}
+
+esp_err_t db_checkpoint_schedule(const db_checkpoint_config_t *config) {
+    db_checkpoint_job_t *job = calloc(1, sizeof(db_checkpoint_job_t));
+    if (job == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    job->config = *config;
+    job->last_changes = -1;
+    // Checkpoints normally happen here; the inline one is only a safety limit
+    sqlite3_wal_autocheckpoint(config->db, config->wal_autocheckpoint);
+    esp_err_t ret = db_service_add_idle_job(config->name, db_checkpoint_idle, job);
+    if (ret != ESP_OK) {
+        free(job);
+    }
+    return ret;
+}
+
+static bool db_spiffs_gc_idle(void *arg, int64_t budget_us) {
+    db_spiffs_gc_job_t *job = arg;
+    size_t total = 0, used = 0;
+    if (esp_spiffs_info(job->partition_label, &total, &used) != ESP_OK || used == job->last_used) {
+        // Nothing written since the last run
+        return false;
+    }
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = esp_spiffs_gc(job->partition_label, job->size_to_gc);
+    esp_spiffs_info(job->partition_label, &total, &job->last_used);
+    if (ret == ESP_OK) {
+        ESP_LOGD(TAG, "SPIFFS GC done in %lld us", esp_timer_get_time() - start);
+    } else {
+        ESP_LOGD(TAG, "SPIFFS GC: %s", esp_err_to_name(ret));
+    }
+    return false;
+}
+
+esp_err_t db_checkpoint_schedule_spiffs_gc(const char *partition_label, size_t size_to_gc) {
+    db_spiffs_gc_job_t *job = calloc(1, sizeof(db_spiffs_gc_job_t));
+    if (job == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    job->partition_label = partition_label;
+    job->size_to_gc = size_to_gc;
+    esp_err_t ret = db_service_add_idle_job("spiffs_gc", db_spiffs_gc_idle, job);
+    if (ret != ESP_OK) {
+        free(job);
+    }
+    return ret;
+}
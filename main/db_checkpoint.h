@@ -0,0 +1,75 @@
+/* Idle-time checkpoints and flushes
+ *
+ * Moves journal housekeeping off the commit path: inline WAL auto-checkpoints
+ * are disabled (up to a safety limit) and the database service runs the
+ * checkpoint, truncates persistent journals and garbage-collects SPIFFS while
+ * no requests are queued.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sqlite3.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Idle checkpoint schedule of one database.
+ */
+typedef struct {
+    sqlite3 *db;                    /*!< Database connection, used from the service task only */
+    const char *schema;             /*!< Attached database to checkpoint, NULL for "main" */
+    const char *name;               /*!< Database name, used for logging */
+    uint32_t wal_autocheckpoint;    /*!< WAL pages after which a commit still checkpoints inline, 0 never */
+} db_checkpoint_config_t;
+
+/**
+ * @brief Set the journal mode of a database.
+ *
+ * WAL requires shared memory, which the SPIFFS VFS does not provide, so it is
+ * used with `locking_mode=EXCLUSIVE` (one connection per database file).
+ * Applies to every database attached to the connection.
+ *
+ * @param db - A pointer to the SQLite database connection.
+ * @param mode - "DELETE", "TRUNCATE", "PERSIST" or "WAL".
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - SQLITE_ERROR if SQLite did not switch to the requested mode.
+ *  - An SQLite error code on failure.
+ */
+int db_checkpoint_set_journal_mode(sqlite3 *db, const char *mode);
+
+/**
+ * @brief Register an idle job checkpointing a database.
+ *
+ * After every burst of writes the job checkpoints and truncates the WAL (WAL
+ * mode) or truncates the zeroed journal file (PERSIST mode). The configuration
+ * is copied.
+ *
+ * @param config - Checkpoint schedule.
+ *
+ * @return
+ *  - ESP_OK on success.
+ *  - ESP_ERR_NO_MEM if the job could not be registered.
+ */
+esp_err_t db_checkpoint_schedule(const db_checkpoint_config_t *config);
+
+/**
+ * @brief Register an idle job running SPIFFS garbage collection.
+ *
+ * @param partition_label - SPIFFS partition label, NULL for the default partition.
+ * @param size_to_gc - Free space `esp_spiffs_gc` should make available, in bytes.
+ *
+ * @return
+ *  - ESP_OK on success.
+ *  - ESP_ERR_NO_MEM if the job could not be registered.
+ */
+esp_err_t db_checkpoint_schedule_spiffs_gc(const char *partition_label, size_t size_to_gc);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,95 @@
+/* Data change hooks shared by several users
+ *
+ * See db_hooks.h. Each connection with subscribers has a slot in a static
+ * table, passed to SQLite as the argument of its hooks.
+ */
+#include <stddef.h>
+#include <string.h>
+#include "db_hooks.h"
+
+typedef struct {
+    sqlite3 *db;
+    db_hooks_t subscribers[DB_HOOKS_MAX_SUBSCRIBERS];
+    int count;
+} db_hooks_conn_t;
+
+static db_hooks_conn_t connections[DB_HOOKS_MAX_DBS];
+
+static void db_hooks_update(void *arg, int op, const char *db_name, const char *table, sqlite3_int64 rowid) {
+    db_hooks_conn_t *conn = arg;
+    for (int i = 0; i < conn->count; i++) {
+        if (conn->subscribers[i].update) {
+            conn->subscribers[i].update(conn->subscribers[i].ctx, op, db_name, table, rowid);
+        }
+    }
+}
+
+static int db_hooks_commit(void *arg) {
+    db_hooks_conn_t *conn = arg;
+    // Every subscriber sees the commit, even if an earlier one vetoes it
+    int veto = 0;
+    for (int i = 0; i < conn->count; i++) {
+        if (conn->subscribers[i].commit && conn->subscribers[i].commit(conn->subscribers[i].ctx) != 0) {
+            veto = 1;
+        }
+    }
+    return veto;
+}
+
+static void db_hooks_rollback(void *arg) {
+    db_hooks_conn_t *conn = arg;
+    for (int i = 0; i < conn->count; i++) {
+        if (conn->subscribers[i].rollback) {
+            conn->subscribers[i].rollback(conn->subscribers[i].ctx);
+        }
+    }
+}
+
+static db_hooks_conn_t *db_hooks_find(sqlite3 *db) {
+    for (int i = 0; i < DB_HOOKS_MAX_DBS; i++) {
+        if (connections[i].db == db) {
+            return &connections[i];
+        }
+    }
+    return NULL;
+}
+
+int db_hooks_add(sqlite3 *db, const db_hooks_t *hooks) {
+    db_hooks_conn_t *conn = db_hooks_find(db);
+    if (conn == NULL) {
+        conn = db_hooks_find(NULL);
+        if (conn == NULL) {
+            return SQLITE_FULL;
+        }
+        conn->db = db;
+        conn->count = 0;
+        sqlite3_update_hook(db, db_hooks_update, conn);
+        sqlite3_commit_hook(db, db_hooks_commit, conn);
+        sqlite3_rollback_hook(db, db_hooks_rollback, conn);
+    }
+    if (conn->count == DB_HOOKS_MAX_SUBSCRIBERS) {
+        return SQLITE_FULL;
+    }
+    conn->subscribers[conn->count++] = *hooks;
+    return SQLITE_OK;
+}
+
+void db_hooks_remove(sqlite3 *db, void *ctx) {
+    db_hooks_conn_t *conn = db_hooks_find(db);
+    if (conn == NULL || db == NULL) {
+        return;
+    }
+    int kept = 0;
+    for (int i = 0; i < conn->count; i++) {
+        if (conn->subscribers[i].ctx != ctx) {
+            conn->subscribers[kept++] = conn->subscribers[i];
+        }
+    }
+    conn->count = kept;
+    if (kept == 0) {
+        sqlite3_update_hook(db, NULL, NULL);
+        sqlite3_commit_hook(db, NULL, NULL);
+        sqlite3_rollback_hook(db, NULL, NULL);
+        conn->db = NULL;
+    }
+}
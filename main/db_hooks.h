@@ -0,0 +1,70 @@
+/* Data change hooks shared by several users
+ *
+ * SQLite keeps one update, commit and rollback hook per connection, and
+ * setting one replaces the previous. This module owns the three hooks of a
+ * connection and calls every registered subscriber from them, so features
+ * reacting to writes can be combined on the same connection.
+ *
+ *     static const db_hooks_t hooks = { .update = on_update, .commit = on_commit, .ctx = &state };
+ *     db_hooks_add(db, &hooks);
+ *     ...
+ *     db_hooks_remove(db, &state);
+ *
+ * The hooks run on the task executing the statement, inside SQLite; they must
+ * not use the connection. Subscribers are added and removed from the task that
+ * owns the connection, or before the database service is started.
+ */
+#pragma once
+
+#include "sqlite3.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Connections that can have subscribers at the same time. */
+#define DB_HOOKS_MAX_DBS 4
+
+/** Subscribers per connection. */
+#define DB_HOOKS_MAX_SUBSCRIBERS 4
+
+/**
+ * @brief Callbacks of one subscriber. Any of them may be NULL.
+ */
+typedef struct {
+    /** A row of a rowid table was inserted, updated or deleted (`SQLITE_INSERT`, `SQLITE_UPDATE`, `SQLITE_DELETE`). */
+    void (*update)(void *ctx, int op, const char *db_name, const char *table, sqlite3_int64 rowid);
+    /** A transaction is about to commit; non-zero turns the commit into a rollback. */
+    int (*commit)(void *ctx);
+    /** A transaction was rolled back. */
+    void (*rollback)(void *ctx);
+    void *ctx;                  /*!< Passed to the callbacks, identifies the subscriber */
+} db_hooks_t;
+
+/**
+ * @brief Subscribe to the data changes of a connection.
+ *
+ * The first subscriber installs the SQLite hooks, replacing any set directly.
+ *
+ * @param db - A pointer to the SQLite database connection.
+ * @param hooks - Callbacks, copied.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - SQLITE_FULL if `DB_HOOKS_MAX_DBS` or `DB_HOOKS_MAX_SUBSCRIBERS` is reached.
+ */
+int db_hooks_add(sqlite3 *db, const db_hooks_t *hooks);
+
+/**
+ * @brief Remove the subscribers of a connection registered with `ctx`.
+ *
+ * The last subscriber removes the SQLite hooks.
+ *
+ * @param db - A pointer to the SQLite database connection.
+ * @param ctx - Context of the subscribers to remove.
+ */
+void db_hooks_remove(sqlite3 *db, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,69 @@
+/* Versioned schema migrations
+ *
+ * See db_migrate.h. The schema version lives in the database header
+ * (`PRAGMA user_version`), so checking it costs a single page read and no
+ * DDL is executed on an up-to-date database.
+ */
+#include <stdio.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "db_migrate.h"
+
+static const char *TAG = "db_migrate";
+
+int db_migrate_version(sqlite3 *db, int *version) {
+    sqlite3_stmt *stmt;
+    int rc = sqlite3_prepare_v2(db, "PRAGMA user_version", -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW) {
+        *version = sqlite3_column_int(stmt, 0);
+        rc = SQLITE_OK;
+    }
+    sqlite3_finalize(stmt);
+    return rc;
+}
+
+int db_migrate(sqlite3 *db, const char *name, const db_migration_t *migrations, size_t count) {
+    int version = 0;
+    int rc = db_migrate_version(db, &version);
+    if (rc != SQLITE_OK) {
+        ESP_LOGE(TAG, "%s: failed to read schema version: %s", name, sqlite3_errmsg(db));
+        return rc;
+    }
+    if (version == (int)count) {
+        ESP_LOGI(TAG, "%s: schema up to date (version %d)", name, version);
+        return SQLITE_OK;
+    }
+    if (version > (int)count) {
+        ESP_LOGE(TAG, "%s: schema version %d is newer than this firmware (%d)", name, version, (int)count);
+        return SQLITE_MISMATCH;
+    }
+
+    int64_t start = esp_timer_get_time();
+    char *errmsg = NULL;
+    rc = sqlite3_exec(db, "BEGIN IMMEDIATE", NULL, NULL, &errmsg);
+    for (size_t i = version; rc == SQLITE_OK && i < count; i++) {
+        ESP_LOGI(TAG, "%s: applying migration %d", name, (int)i + 1);
+        rc = sqlite3_exec(db, migrations[i].sql, NULL, NULL, &errmsg);
+    }
+    if (rc == SQLITE_OK) {
+        char sql[32];
+        snprintf(sql, sizeof(sql), "PRAGMA user_version=%d", (int)count);
+        rc = sqlite3_exec(db, sql, NULL, NULL, &errmsg);
+    }
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_exec(db, "COMMIT", NULL, NULL, &errmsg);
+    }
+    if (rc != SQLITE_OK) {
+        ESP_LOGE(TAG, "%s: migration failed: %s", name, errmsg ? errmsg : sqlite3_errstr(rc));
+        sqlite3_free(errmsg);
+        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+        return rc;
+    }
+    ESP_LOGI(TAG, "%s: migrated from version %d to %d in %lld us", name, version, (int)count,
+             esp_timer_get_time() - start);
+    return SQLITE_OK;
+}
@@ -0,0 +1,58 @@
+/* Versioned schema migrations
+ *
+ * Each database carries its schema version in `PRAGMA user_version`. Only the
+ * migrations newer than that version are applied, all in one transaction.
+ */
+#pragma once
+
+#include <stddef.h>
+#include "sqlite3.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A single schema migration.
+ *
+ * Migration N of an array (starting at 1) upgrades a database from schema
+ * version N-1 to N.
+ */
+typedef struct {
+    const char *sql;    /*!< SQL statements applied by this migration */
+} db_migration_t;
+
+/**
+ * @brief Read the schema version of a database.
+ *
+ * @param db - A pointer to the SQLite database connection.
+ * @param version - Receives the value of `PRAGMA user_version`.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - An SQLite error code on failure.
+ */
+int db_migrate_version(sqlite3 *db, int *version);
+
+/**
+ * @brief Bring a database up to the latest schema version.
+ *
+ * Reads `PRAGMA user_version` and applies the pending migrations plus the new
+ * version number in a single transaction. Nothing is written if the database
+ * is already up to date.
+ *
+ * @param db - A pointer to the SQLite database connection.
+ * @param name - Database name, used for logging.
+ * @param migrations - Migrations in version order; entry 0 creates version 1.
+ * @param count - Number of migrations, which is also the latest schema version.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success or if there was nothing to do.
+ *  - SQLITE_MISMATCH if the database has a newer schema than `count`.
+ *  - An SQLite error code on failure, in which case the transaction is rolled back.
+ */
+int db_migrate(sqlite3 *db, const char *name, const db_migration_t *migrations, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,566 @@
+/* Shared page cache
+ *
+ * See db_pcache.h. Each cache keeps its pages in a hash table keyed by page
+ * number; unpinned pages of purgeable caches are also linked into the LRU
+ * list of their memory tier, most recently used first. All state is
+ * protected by one mutex, since caches of different connections share the
+ * budgets and the lists.
+ */
+#include <stdbool.h>
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "db_pcache.h"
+
+static const char *TAG = "db_pcache";
+
+#define DB_PCACHE_MIN_BUCKETS 16
+
+typedef struct db_pcache db_pcache_t;
+typedef struct db_pcache_page db_pcache_page_t;
+
+struct db_pcache_page {
+    sqlite3_pcache_page base;       /* must be first */
+    unsigned key;
+    bool pinned;
+    uint8_t tier;
+    uint8_t hits;
+    db_pcache_t *cache;
+    db_pcache_page_t *hash_next;
+    db_pcache_page_t *lru_prev;     /* NULL when not on an LRU list */
+    db_pcache_page_t *lru_next;
+};
+
+struct db_pcache {
+    int page_size;
+    int extra_size;
+    bool purgeable;
+    bool fetched;                   /* a page was ever created */
+    const char *label;
+    unsigned count;
+    unsigned dram_count;
+    unsigned pinned;
+    unsigned buckets;
+    db_pcache_page_t **hash;
+    uint8_t *hot;                   /* bitmap of hot page numbers */
+    size_t hot_size;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    db_pcache_t *next;
+};
+
+typedef struct {
+    size_t budget;
+    size_t used;                    /* bytes held by purgeable pages */
+    uint32_t caps;
+    db_pcache_page_t lru;           /* list head: lru.lru_next is the most recently used */
+    uint32_t pages;
+    uint32_t hits;
+    uint32_t loads;
+    uint32_t evictions;
+} db_pcache_tier_state_t;
+
+static struct {
+    sqlite3_mutex *mutex;
+    db_pcache_tier_state_t tiers[DB_PCACHE_TIERS];
+    db_pcache_t *caches;
+    db_pcache_t *last_created;
+    const char *label;
+    size_t heap_used;               /* bytes of all pages, allocated outside the SQLite heap */
+} s_pcache = {
+    .tiers = {
+        [DB_PCACHE_DRAM] = { .caps = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT },
+        [DB_PCACHE_PSRAM] = { .caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT },
+    },
+};
+
+static size_t db_pcache_page_bytes(const db_pcache_t *cache) {
+    return sizeof(db_pcache_page_t) + cache->page_size + cache->extra_size;
+}
+
+static bool db_pcache_lru_empty(db_pcache_tier_t tier) {
+    return s_pcache.tiers[tier].lru.lru_prev == &s_pcache.tiers[tier].lru;
+}
+
+static void db_pcache_lru_remove(db_pcache_page_t *page) {
+    if (page->lru_prev) {
+        page->lru_prev->lru_next = page->lru_next;
+        page->lru_next->lru_prev = page->lru_prev;
+        page->lru_prev = page->lru_next = NULL;
+    }
+}
+
+static void db_pcache_lru_push(db_pcache_page_t *page) {
+    db_pcache_page_t *head = &s_pcache.tiers[page->tier].lru;
+    page->lru_next = head->lru_next;
+    page->lru_prev = head;
+    page->lru_next->lru_prev = page;
+    head->lru_next = page;
+}
+
+static bool db_pcache_is_hot(const db_pcache_t *cache, unsigned key) {
+    return key == 1 || (key / 8 < cache->hot_size && (cache->hot[key / 8] & (1 << (key % 8))));
+}
+
+static void db_pcache_mark_hot(db_pcache_t *cache, unsigned key) {
+    if (key / 8 >= cache->hot_size) {
+        size_t size = (key / 8 + 32) & ~(size_t)31;
+        uint8_t *hot = sqlite3_realloc64(cache->hot, size);
+        if (hot == NULL) {
+            return;     // the page just stays in its tier
+        }
+        memset(hot + cache->hot_size, 0, size - cache->hot_size);
+        cache->hot = hot;
+        cache->hot_size = size;
+    }
+    cache->hot[key / 8] |= 1 << (key % 8);
+}
+
+/**
+ * @brief Tell whether a page holds a B-tree interior node, from its page type byte.
+ */
+static bool db_pcache_is_interior(const db_pcache_page_t *page) {
+    // Page 1 starts with the 100-byte database header
+    uint8_t type = ((const uint8_t *)page->base.pBuf)[page->key == 1 ? 100 : 0];
+    return type == 0x02 || type == 0x05;
+}
+
+static db_pcache_page_t *db_pcache_find(db_pcache_t *cache, unsigned key) {
+    db_pcache_page_t *page = cache->hash[key & (cache->buckets - 1)];
+    while (page && page->key != key) {
+        page = page->hash_next;
+    }
+    return page;
+}
+
+static void db_pcache_hash_insert(db_pcache_t *cache, db_pcache_page_t *page) {
+    db_pcache_page_t **bucket = &cache->hash[page->key & (cache->buckets - 1)];
+    page->hash_next = *bucket;
+    *bucket = page;
+}
+
+static void db_pcache_hash_remove(db_pcache_t *cache, db_pcache_page_t *page) {
+    db_pcache_page_t **link = &cache->hash[page->key & (cache->buckets - 1)];
+    while (*link != page) {
+        link = &(*link)->hash_next;
+    }
+    *link = page->hash_next;
+}
+
+/**
+ * @brief Double the hash table once it holds more pages than buckets.
+ */
+static void db_pcache_hash_grow(db_pcache_t *cache) {
+    unsigned buckets = cache->buckets * 2;
+    db_pcache_page_t **hash = sqlite3_malloc64(buckets * sizeof(db_pcache_page_t *));
+    if (hash == NULL) {
+        return;     // keep the longer chains
+    }
+    memset(hash, 0, buckets * sizeof(db_pcache_page_t *));
+    for (unsigned i = 0; i < cache->buckets; i++) {
+        db_pcache_page_t *page = cache->hash[i];
+        while (page) {
+            db_pcache_page_t *next = page->hash_next;
+            page->hash_next = hash[page->key & (buckets - 1)];
+            hash[page->key & (buckets - 1)] = page;
+            page = next;
+        }
+    }
+    sqlite3_free(cache->hash);
+    cache->hash = hash;
+    cache->buckets = buckets;
+}
+
+/**
+ * @brief Remove a page from its cache and free it. Adjusts `pinned` for pinned pages.
+ */
+static void db_pcache_free_page(db_pcache_page_t *page) {
+    db_pcache_t *cache = page->cache;
+    db_pcache_hash_remove(cache, page);
+    db_pcache_lru_remove(page);
+    if (page->pinned) {
+        cache->pinned--;
+    }
+    cache->count--;
+    if (page->tier == DB_PCACHE_DRAM) {
+        cache->dram_count--;
+    }
+    if (cache->purgeable) {
+        s_pcache.tiers[page->tier].used -= db_pcache_page_bytes(cache);
+        s_pcache.tiers[page->tier].pages--;
+    }
+    s_pcache.heap_used -= db_pcache_page_bytes(cache);
+    heap_caps_free(page);
+}
+
+/**
+ * @brief Free least recently used pages of a tier, of any cache, until it uses at most `limit` bytes.
+ */
+static void db_pcache_evict(db_pcache_tier_t tier, size_t limit) {
+    db_pcache_tier_state_t *state = &s_pcache.tiers[tier];
+    while (state->used > limit && !db_pcache_lru_empty(tier)) {
+        db_pcache_page_t *victim = state->lru.lru_prev;
+        victim->cache->evictions++;
+        state->evictions++;
+        db_pcache_free_page(victim);
+    }
+}
+
+/**
+ * @brief Make room for a page of `bytes` in a tier.
+ *
+ * @return false if the tier is full of pinned pages.
+ */
+static bool db_pcache_reserve(db_pcache_tier_t tier, size_t bytes) {
+    db_pcache_tier_state_t *state = &s_pcache.tiers[tier];
+    if (state->used + bytes <= state->budget) {
+        return true;
+    }
+    db_pcache_evict(tier, state->budget > bytes ? state->budget - bytes : 0);
+    return state->used + bytes <= state->budget;
+}
+
+static int db_pcache_init(void *arg) {
+    s_pcache.mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+    for (int i = 0; i < DB_PCACHE_TIERS; i++) {
+        db_pcache_tier_state_t *state = &s_pcache.tiers[i];
+        state->used = 0;
+        state->pages = state->hits = state->loads = state->evictions = 0;
+        state->lru.lru_next = state->lru.lru_prev = &state->lru;
+    }
+    s_pcache.caches = NULL;
+    s_pcache.last_created = NULL;
+    return SQLITE_OK;
+}
+
+static void db_pcache_shutdown(void *arg) {
+    sqlite3_mutex_free(s_pcache.mutex);
+    s_pcache.mutex = NULL;
+}
+
+static sqlite3_pcache *db_pcache_create(int page_size, int extra_size, int purgeable) {
+    db_pcache_t *cache = sqlite3_malloc(sizeof(db_pcache_t));
+    if (cache == NULL) {
+        return NULL;
+    }
+    memset(cache, 0, sizeof(*cache));
+    cache->hash = sqlite3_malloc64(DB_PCACHE_MIN_BUCKETS * sizeof(db_pcache_page_t *));
+    if (cache->hash == NULL) {
+        sqlite3_free(cache);
+        return NULL;
+    }
+    memset(cache->hash, 0, DB_PCACHE_MIN_BUCKETS * sizeof(db_pcache_page_t *));
+    cache->buckets = DB_PCACHE_MIN_BUCKETS;
+    cache->page_size = page_size;
+    cache->extra_size = extra_size;
+    cache->purgeable = purgeable != 0;
+
+    sqlite3_mutex_enter(s_pcache.mutex);
+    cache->label = s_pcache.label;
+    cache->next = s_pcache.caches;
+    s_pcache.caches = cache;
+    s_pcache.last_created = cache;
+    sqlite3_mutex_leave(s_pcache.mutex);
+    return (sqlite3_pcache *)cache;
+}
+
+static void db_pcache_cachesize(sqlite3_pcache *p, int max) {
+    // The global budget applies instead of per-cache limits
+}
+
+static int db_pcache_pagecount(sqlite3_pcache *p) {
+    db_pcache_t *cache = (db_pcache_t *)p;
+    sqlite3_mutex_enter(s_pcache.mutex);
+    int count = (int)cache->count;
+    sqlite3_mutex_leave(s_pcache.mutex);
+    return count;
+}
+
+/**
+ * @brief Pick the tier of a new page and make room in it.
+ *
+ * @return The tier, or DB_PCACHE_TIERS if `create` is 1 and no page can be freed.
+ */
+static db_pcache_tier_t db_pcache_place(db_pcache_t *cache, unsigned key, int create, size_t bytes) {
+    bool tiered = s_pcache.tiers[DB_PCACHE_PSRAM].budget > 0;
+    db_pcache_tier_t tier = !tiered || db_pcache_is_hot(cache, key) ? DB_PCACHE_DRAM : DB_PCACHE_PSRAM;
+    if (db_pcache_reserve(tier, bytes)) {
+        return tier;
+    }
+    // Hot pages overflow to PSRAM rather than exceed the DRAM budget
+    if (tier == DB_PCACHE_DRAM && tiered && db_pcache_reserve(DB_PCACHE_PSRAM, bytes)) {
+        return DB_PCACHE_PSRAM;
+    }
+    // create == 1: only if a page can be recycled; create == 2: allocate regardless
+    return create == 1 ? DB_PCACHE_TIERS : tier;
+}
+
+static sqlite3_pcache_page *db_pcache_fetch(sqlite3_pcache *p, unsigned key, int create) {
+    db_pcache_t *cache = (db_pcache_t *)p;
+    sqlite3_mutex_enter(s_pcache.mutex);
+    db_pcache_page_t *page = db_pcache_find(cache, key);
+    if (page) {
+        if (!page->pinned) {
+            db_pcache_lru_remove(page);
+            page->pinned = true;
+            cache->pinned++;
+        }
+        cache->hits++;
+        if (cache->purgeable) {
+            s_pcache.tiers[page->tier].hits++;
+            if (page->tier == DB_PCACHE_PSRAM && ++page->hits >= DB_PCACHE_PROMOTE_HITS) {
+                db_pcache_mark_hot(cache, key);
+            }
+        }
+        sqlite3_mutex_leave(s_pcache.mutex);
+        return &page->base;
+    }
+    if (create == 0) {
+        sqlite3_mutex_leave(s_pcache.mutex);
+        return NULL;
+    }
+
+    size_t bytes = db_pcache_page_bytes(cache);
+    db_pcache_tier_t tier = DB_PCACHE_DRAM;
+    if (cache->purgeable) {
+        tier = db_pcache_place(cache, key, create, bytes);
+        if (tier == DB_PCACHE_TIERS) {
+            sqlite3_mutex_leave(s_pcache.mutex);
+            return NULL;
+        }
+    }
+    page = heap_caps_malloc(bytes, s_pcache.tiers[tier].caps);
+    if (page == NULL && tier == DB_PCACHE_PSRAM) {
+        tier = DB_PCACHE_DRAM;
+        page = heap_caps_malloc(bytes, s_pcache.tiers[tier].caps);
+    }
+    if (page == NULL) {
+        sqlite3_mutex_leave(s_pcache.mutex);
+        return NULL;
+    }
+    memset(page, 0, sizeof(*page));
+    page->base.pBuf = page + 1;
+    page->base.pExtra = (uint8_t *)page->base.pBuf + cache->page_size;
+    // SQLite expects the start of the extra area zeroed on new pages
+    memset(page->base.pExtra, 0, cache->extra_size < 8 ? cache->extra_size : 8);
+    page->key = key;
+    page->pinned = true;
+    page->tier = tier;
+    page->cache = cache;
+    db_pcache_hash_insert(cache, page);
+    cache->count++;
+    cache->pinned++;
+    cache->misses++;
+    cache->fetched = true;
+    if (tier == DB_PCACHE_DRAM) {
+        cache->dram_count++;
+    }
+    if (cache->purgeable) {
+        s_pcache.tiers[tier].used += bytes;
+        s_pcache.tiers[tier].pages++;
+        s_pcache.tiers[tier].loads++;
+    }
+    s_pcache.heap_used += bytes;
+    if (cache->count > cache->buckets) {
+        db_pcache_hash_grow(cache);
+    }
+    sqlite3_mutex_leave(s_pcache.mutex);
+    return &page->base;
+}
+
+static void db_pcache_unpin(sqlite3_pcache *p, sqlite3_pcache_page *pg, int discard) {
+    db_pcache_t *cache = (db_pcache_t *)p;
+    db_pcache_page_t *page = (db_pcache_page_t *)pg;
+    sqlite3_mutex_enter(s_pcache.mutex);
+    if (discard) {
+        db_pcache_free_page(page);
+    } else {
+        page->pinned = false;
+        cache->pinned--;
+        if (cache->purgeable) {
+            // Unpinned pages are clean, so the content is what the file holds
+            if (page->tier == DB_PCACHE_PSRAM && db_pcache_is_interior(page)) {
+                db_pcache_mark_hot(cache, page->key);
+            }
+            db_pcache_lru_push(page);
+            db_pcache_evict(page->tier, s_pcache.tiers[page->tier].budget);
+        }
+    }
+    sqlite3_mutex_leave(s_pcache.mutex);
+}
+
+static void db_pcache_rekey(sqlite3_pcache *p, sqlite3_pcache_page *pg, unsigned old_key, unsigned new_key) {
+    db_pcache_t *cache = (db_pcache_t *)p;
+    db_pcache_page_t *page = (db_pcache_page_t *)pg;
+    sqlite3_mutex_enter(s_pcache.mutex);
+    db_pcache_page_t *other = db_pcache_find(cache, new_key);
+    if (other && other != page) {
+        db_pcache_free_page(other);
+    }
+    db_pcache_hash_remove(cache, page);
+    page->key = new_key;
+    db_pcache_hash_insert(cache, page);
+    sqlite3_mutex_leave(s_pcache.mutex);
+}
+
+/**
+ * @brief Free the pages of a cache with key >= `limit`, or only the unpinned ones.
+ */
+static void db_pcache_free_pages(db_pcache_t *cache, unsigned limit, bool unpinned_only) {
+    for (unsigned i = 0; i < cache->buckets; i++) {
+        db_pcache_page_t *page = cache->hash[i];
+        while (page) {
+            db_pcache_page_t *next = page->hash_next;
+            if (page->key >= limit && !(unpinned_only && page->pinned)) {
+                db_pcache_free_page(page);
+            }
+            page = next;
+        }
+    }
+}
+
+static void db_pcache_truncate(sqlite3_pcache *p, unsigned limit) {
+    db_pcache_t *cache = (db_pcache_t *)p;
+    sqlite3_mutex_enter(s_pcache.mutex);
+    db_pcache_free_pages(cache, limit, false);
+    // Pages past the end get new content if the file grows again
+    for (size_t key = limit; key < cache->hot_size * 8; key++) {
+        cache->hot[key / 8] &= ~(1 << (key % 8));
+    }
+    sqlite3_mutex_leave(s_pcache.mutex);
+}
+
+static void db_pcache_destroy(sqlite3_pcache *p) {
+    db_pcache_t *cache = (db_pcache_t *)p;
+    sqlite3_mutex_enter(s_pcache.mutex);
+    db_pcache_free_pages(cache, 0, false);
+    db_pcache_t **link = &s_pcache.caches;
+    while (*link != cache) {
+        link = &(*link)->next;
+    }
+    *link = cache->next;
+    // A page size change creates the replacement cache just before destroying
+    // this one: hand the label over so the statistics stay attributed
+    db_pcache_t *last = s_pcache.last_created;
+    if (last && last != cache) {
+        if (cache->label && !last->label && !last->fetched && last->extra_size == cache->extra_size &&
+            last->purgeable == cache->purgeable) {
+            last->label = cache->label;
+        }
+    } else {
+        s_pcache.last_created = NULL;
+    }
+    sqlite3_mutex_leave(s_pcache.mutex);
+    sqlite3_free(cache->hot);
+    sqlite3_free(cache->hash);
+    sqlite3_free(cache);
+}
+
+static void db_pcache_shrink(sqlite3_pcache *p) {
+    sqlite3_mutex_enter(s_pcache.mutex);
+    db_pcache_free_pages((db_pcache_t *)p, 0, true);
+    sqlite3_mutex_leave(s_pcache.mutex);
+}
+
+static const sqlite3_pcache_methods2 db_pcache_methods = {
+    .iVersion = 1,
+    .pArg = NULL,
+    .xInit = db_pcache_init,
+    .xShutdown = db_pcache_shutdown,
+    .xCreate = db_pcache_create,
+    .xCachesize = db_pcache_cachesize,
+    .xPagecount = db_pcache_pagecount,
+    .xFetch = db_pcache_fetch,
+    .xUnpin = db_pcache_unpin,
+    .xRekey = db_pcache_rekey,
+    .xTruncate = db_pcache_truncate,
+    .xDestroy = db_pcache_destroy,
+    .xShrink = db_pcache_shrink,
+};
+
+int db_pcache_install(size_t budget_bytes) {
+    return db_pcache_install_tiered(budget_bytes, 0);
+}
+
+int db_pcache_install_tiered(size_t dram_bytes, size_t psram_bytes) {
+    s_pcache.tiers[DB_PCACHE_DRAM].budget = dram_bytes;
+    s_pcache.tiers[DB_PCACHE_PSRAM].budget = psram_bytes;
+    int rc = sqlite3_config(SQLITE_CONFIG_PCACHE2, &db_pcache_methods);
+    if (rc != SQLITE_OK) {
+        ESP_LOGE(TAG, "Cannot install the shared page cache: %s", sqlite3_errstr(rc));
+    }
+    return rc;
+}
+
+void db_pcache_set_label(const char *label) {
+    sqlite3_mutex_enter(s_pcache.mutex);
+    s_pcache.label = label;
+    sqlite3_mutex_leave(s_pcache.mutex);
+}
+
+int db_pcache_get_stats(db_pcache_stats_t *stats, int max, size_t *used_bytes) {
+    int n = 0;
+    sqlite3_mutex_enter(s_pcache.mutex);
+    for (db_pcache_t *cache = s_pcache.caches; cache && n < max; cache = cache->next) {
+        stats[n++] = (db_pcache_stats_t) {
+            .label = cache->label,
+            .page_size = cache->page_size,
+            .pages = cache->count,
+            .dram_pages = cache->dram_count,
+            .pinned = cache->pinned,
+            .hits = cache->hits,
+            .misses = cache->misses,
+            .evictions = cache->evictions,
+        };
+    }
+    if (used_bytes) {
+        *used_bytes = s_pcache.tiers[DB_PCACHE_DRAM].used + s_pcache.tiers[DB_PCACHE_PSRAM].used;
+    }
+    sqlite3_mutex_leave(s_pcache.mutex);
+    return n;
+}
+
+size_t db_pcache_memory_used(void) {
+    sqlite3_mutex_enter(s_pcache.mutex);
+    size_t used = s_pcache.heap_used;
+    sqlite3_mutex_leave(s_pcache.mutex);
+    return used;
+}
+
+void db_pcache_get_tier_stats(db_pcache_tier_t tier, db_pcache_tier_stats_t *stats) {
+    sqlite3_mutex_enter(s_pcache.mutex);
+    const db_pcache_tier_state_t *state = &s_pcache.tiers[tier];
+    *stats = (db_pcache_tier_stats_t) {
+        .budget = state->budget,
+        .used = state->used,
+        .pages = state->pages,
+        .hits = state->hits,
+        .loads = state->loads,
+        .evictions = state->evictions,
+    };
+    sqlite3_mutex_leave(s_pcache.mutex);
+}
+
+void db_pcache_log_stats(void) {
+    db_pcache_stats_t stats[DB_PCACHE_MAX_STATS];
+    int n = db_pcache_get_stats(stats, DB_PCACHE_MAX_STATS, NULL);
+    for (int tier = 0; tier < DB_PCACHE_TIERS; tier++) {
+        db_pcache_tier_stats_t t;
+        db_pcache_get_tier_stats(tier, &t);
+        if (tier == DB_PCACHE_PSRAM && t.budget == 0) {
+            continue;
+        }
+        uint32_t fetches = t.hits + t.loads;
+        ESP_LOGI(TAG, "%-5s %d of %d bytes, %d pages, hit rate %d%% (%d/%d), %d evicted",
+                 tier == DB_PCACHE_DRAM ? "DRAM" : "PSRAM", (int)t.used, (int)t.budget, (int)t.pages,
+                 fetches ? (int)(100ULL * t.hits / fetches) : 0, (int)t.hits, (int)fetches, (int)t.evictions);
+    }
+    for (int i = 0; i < n; i++) {
+        uint32_t fetches = stats[i].hits + stats[i].misses;
+        ESP_LOGI(TAG, "  %-16s %4d pages (%d in DRAM, %d pinned), hit rate %d%% (%d/%d), %d evicted",
+                 stats[i].label ? stats[i].label : "(unlabeled)", (int)stats[i].pages, (int)stats[i].dram_pages,
+                 (int)stats[i].pinned, fetches ? (int)(100ULL * stats[i].hits / fetches) : 0, (int)stats[i].hits,
+                 (int)fetches, (int)stats[i].evictions);
+    }
+}
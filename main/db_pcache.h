@@ -0,0 +1,152 @@
+/* Shared page cache
+ *
+ * A sqlite3_pcache_methods2 implementation in which every page cache (one per
+ * open or attached database file) draws from a single global memory budget.
+ * Unpinned pages of all caches sit on one LRU list, so when the budget is
+ * reached the least recently used page is recycled whichever database it
+ * belongs to: a busy database grows its share of the cache at the expense of
+ * idle ones, instead of each connection keeping a fixed `cache_size`.
+ *
+ *     db_pcache_install(64 * 1024);     // before sqlite3_initialize()
+ *     db_pcache_set_label("test1");
+ *     sqlite3_open("/spiffs/test1.db", &db);
+ *     db_pcache_set_label(NULL);
+ *
+ * With `db_pcache_install_tiered` the budget is split between internal DRAM
+ * and PSRAM, each tier with its own LRU list. Page 1 (the schema) and pages
+ * that hold B-tree interior nodes, or that were hit repeatedly from PSRAM, are
+ * marked hot and loaded into DRAM; other pages go to PSRAM. SQLite keeps
+ * pointers into a page while it is cached, so a page never moves between
+ * tiers: a page promoted on access is placed in DRAM the next time it is
+ * loaded.
+ *
+ * Caches of in-memory databases are not purgeable: their pages are kept in
+ * DRAM and do not count against the budget. `PRAGMA cache_size` is ignored.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sqlite3.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of caches `db_pcache_log_stats` reports. */
+#define DB_PCACHE_MAX_STATS 8
+
+/** PSRAM hits after which a page is loaded into DRAM. */
+#define DB_PCACHE_PROMOTE_HITS 2
+
+/**
+ * @brief Memory tiers of the page cache.
+ */
+typedef enum {
+    DB_PCACHE_DRAM = 0,     /*!< Internal RAM, for hot pages */
+    DB_PCACHE_PSRAM,        /*!< External PSRAM, for the other pages */
+    DB_PCACHE_TIERS,
+} db_pcache_tier_t;
+
+/**
+ * @brief Statistics of one memory tier, over all purgeable caches.
+ */
+typedef struct {
+    size_t budget;          /*!< Bytes the tier may use */
+    size_t used;            /*!< Bytes used */
+    uint32_t pages;         /*!< Pages held */
+    uint32_t hits;          /*!< Fetches served from a page of this tier */
+    uint32_t loads;         /*!< Pages allocated in this tier, i.e. reads from the file */
+    uint32_t evictions;     /*!< Pages freed to stay within the tier budget */
+} db_pcache_tier_stats_t;
+
+/**
+ * @brief Statistics of one page cache.
+ */
+typedef struct {
+    const char *label;      /*!< Label given with `db_pcache_set_label`, or NULL */
+    uint32_t page_size;     /*!< Database page size */
+    uint32_t pages;         /*!< Pages held, pinned or not */
+    uint32_t dram_pages;    /*!< Pages held in DRAM */
+    uint32_t pinned;        /*!< Pages in use by SQLite */
+    uint32_t hits;          /*!< Fetches served from the cache */
+    uint32_t misses;        /*!< Fetches that needed a new page, i.e. a read from the file */
+    uint32_t evictions;     /*!< Pages recycled or freed to stay within the budget */
+} db_pcache_stats_t;
+
+/**
+ * @brief Install the shared page cache, in internal RAM only.
+ *
+ * Must be called before `sqlite3_initialize()`, or after `sqlite3_shutdown()`.
+ *
+ * @param budget_bytes - Memory for the pages of all purgeable caches, including
+ *                       SQLite's per-page metadata.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - SQLITE_MISUSE if SQLite is already initialized.
+ */
+int db_pcache_install(size_t budget_bytes);
+
+/**
+ * @brief Install the shared page cache with a DRAM and a PSRAM tier.
+ *
+ * Must be called before `sqlite3_initialize()`, or after `sqlite3_shutdown()`.
+ * Pages meant for PSRAM fall back to DRAM if PSRAM cannot be allocated.
+ *
+ * @param dram_bytes - Memory for hot pages in internal RAM.
+ * @param psram_bytes - Memory for the other pages in PSRAM, 0 for a single tier.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - SQLITE_MISUSE if SQLite is already initialized.
+ */
+int db_pcache_install_tiered(size_t dram_bytes, size_t psram_bytes);
+
+/**
+ * @brief Label the page caches created from now on.
+ *
+ * Set it around `sqlite3_open` or `ATTACH` to attribute the statistics of the
+ * new cache to a database. The string must stay valid while the cache exists.
+ *
+ * @param label - Label, or NULL to stop labeling.
+ */
+void db_pcache_set_label(const char *label);
+
+/**
+ * @brief Read the statistics of the existing caches.
+ *
+ * @param stats - Receives up to `max` entries.
+ * @param max - Size of `stats`.
+ * @param used_bytes - Optional, receives the memory used by purgeable pages.
+ *
+ * @return Number of entries written.
+ */
+int db_pcache_get_stats(db_pcache_stats_t *stats, int max, size_t *used_bytes);
+
+/**
+ * @brief Memory used by the pages of all caches, purgeable or not.
+ *
+ * Pages are allocated with heap_caps_malloc, so they are not included in
+ * `sqlite3_memory_used()`.
+ *
+ * @return Bytes allocated for pages, including SQLite's per-page metadata.
+ */
+size_t db_pcache_memory_used(void);
+
+/**
+ * @brief Read the statistics of a memory tier.
+ *
+ * @param tier - DB_PCACHE_DRAM or DB_PCACHE_PSRAM.
+ * @param stats - Receives the statistics.
+ */
+void db_pcache_get_tier_stats(db_pcache_tier_t tier, db_pcache_tier_stats_t *stats);
+
+/**
+ * @brief Log the statistics of every cache and tier.
+ */
+void db_pcache_log_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
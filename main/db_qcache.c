@@ -0,0 +1,693 @@
+/* Query result cache
+ *
+ * See db_qcache.h. Results are kept in a hash table keyed by the normalized
+ * SQL followed by the exact type and bytes of every bound value, with one LRU
+ * list for the budget. SQLite cannot read bindings back, so the bind function
+ * of a cacheable query binds a probe statement `SELECT ?1, ?2, ...` with the
+ * same parameters instead; its row gives the values for the key, which are
+ * then bound to the query with `sqlite3_bind_value`. Each result stores the
+ * key, the column names and the rows as a flat sequence of strings, so it is
+ * one allocation and can be replayed without SQLite.
+ *
+ * The authorizer stays installed for the lifetime of the cache and only
+ * records what it sees while the cache prepares a statement of its own.
+ *
+ * Every tracked table has a bit; a result and a statement carry the bits of
+ * the tables they read. The update hook collects the bits of the tables a
+ * transaction writes and the commit and rollback hooks drop the results with
+ * any of them. Results are not looked up or stored while a transaction is
+ * open, so rows a transaction has not committed are never cached.
+ */
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "db_hooks.h"
+#include "db_qcache.h"
+
+#define DB_QCACHE_BUCKETS 64
+
+/* Shared by the tables beyond DB_QCACHE_MAX_TABLES - 1 */
+#define DB_QCACHE_OVERFLOW_BIT (1u << (DB_QCACHE_MAX_TABLES - 1))
+
+/* Value tags in a result; a key uses the SQLite fundamental types */
+#define DB_QCACHE_NULL 0
+#define DB_QCACHE_TEXT 1
+
+typedef struct db_qcache_result {
+    struct db_qcache_result *next;          /* hash chain */
+    struct db_qcache_result *newer;         /* LRU list */
+    struct db_qcache_result *older;
+    uint32_t hash;
+    uint32_t tables;
+    size_t size;
+    size_t key_len;
+    int columns;
+    int rows;
+    char data[];                /* key, column names, then per value a tag and the text */
+} db_qcache_result_t;
+
+typedef struct {
+    char *sql;                  /* normalized text, NULL if the slot is free */
+    sqlite3_stmt *stmt;
+    sqlite3_stmt *params;       /* probe selecting the parameters, prepared on first use */
+    uint32_t tables;
+    bool cacheable;
+    uint32_t last_used;
+} db_qcache_stmt_t;
+
+/* Growing buffer a result is built in */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    bool overflow;              /* larger than max_result, not kept */
+} db_qcache_buf_t;
+
+struct db_qcache {
+    sqlite3 *db;
+    db_qcache_config_t config;
+    db_qcache_stmt_t stmts[DB_QCACHE_MAX_STATEMENTS];
+    char *schemas[DB_QCACHE_MAX_TABLES - 1];
+    char *tables[DB_QCACHE_MAX_TABLES - 1];
+    int table_count;
+    bool tables_overflow;
+    db_qcache_result_t *buckets[DB_QCACHE_BUCKETS];
+    db_qcache_result_t *newest;
+    db_qcache_result_t *oldest;
+    uint32_t pending;           /* tables written by the open transaction */
+    uint32_t clock;
+    int hooked;                 /* row changes reported to the update hook */
+    int seen_hooked;
+    int seen_changes;
+    bool preparing;             /* a cache miss is being prepared, the authorizer records it */
+    uint32_t prepare_tables;    /* collected by the authorizer */
+    bool prepare_cacheable;
+    db_qcache_stats_t stats;
+};
+
+/* Functions whose result changes between runs with the same arguments */
+static const char *const volatile_functions[] = {
+    "random", "randomblob", "changes", "total_changes", "last_insert_rowid",
+    "date", "time", "datetime", "julianday", "unixepoch", "strftime", "timediff",
+    "current_date", "current_time", "current_timestamp",
+};
+
+static uint32_t db_qcache_hash(const void *key, size_t len) {
+    const unsigned char *p = key;
+    uint32_t hash = 2166136261u;
+    while (len--) {
+        hash = (hash ^ *p++) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief Copy a statement as a statement cache key.
+ *
+ * Comments and runs of whitespace outside quotes become one space and a
+ * trailing `;` is removed, so texts differing only in layout share a key.
+ * The copy is only compared, never prepared.
+ *
+ * @return The copy, to free with `sqlite3_free`, or NULL if out of memory.
+ */
+static char *db_qcache_normalize(const char *sql) {
+    char *out = sqlite3_malloc64(strlen(sql) + 1);
+    if (out == NULL) {
+        return NULL;
+    }
+    size_t n = 0;
+    char quote = 0;
+    bool space = false;
+    for (const char *p = sql; *p; p++) {
+        char c = *p;
+        if (quote) {
+            out[n++] = c;
+            if (c == quote) {
+                quote = 0;
+            }
+            continue;
+        }
+        if (c == '-' && p[1] == '-') {
+            while (p[1] != '\0' && p[1] != '\n') {
+                p++;
+            }
+            space = true;
+            continue;
+        }
+        if (c == '/' && p[1] == '*') {
+            p += 2;
+            while (*p != '\0' && !(p[0] == '*' && p[1] == '/')) {
+                p++;
+            }
+            if (*p == '\0') {
+                break;
+            }
+            p++;
+            space = true;
+            continue;
+        }
+        if (isspace((unsigned char)c)) {
+            space = true;
+            continue;
+        }
+        if (space && n > 0) {
+            out[n++] = ' ';
+        }
+        space = false;
+        if (c == '\'' || c == '"' || c == '`' || c == '[') {
+            quote = c == '[' ? ']' : c;
+        }
+        out[n++] = c;
+    }
+    while (n > 0 && (out[n - 1] == ';' || out[n - 1] == ' ')) {
+        n--;
+    }
+    out[n] = '\0';
+    return out;
+}
+
+/**
+ * @brief Bit of a table, optionally starting to track it.
+ *
+ * @return The bit, or 0 if the table is not tracked and `add` is false.
+ */
+static uint32_t db_qcache_table_bit(db_qcache_t *cache, const char *schema, const char *table, bool add) {
+    for (int i = 0; i < cache->table_count; i++) {
+        if (sqlite3_stricmp(cache->tables[i], table) == 0 && sqlite3_stricmp(cache->schemas[i], schema) == 0) {
+            return 1u << i;
+        }
+    }
+    if (!add) {
+        return cache->tables_overflow ? DB_QCACHE_OVERFLOW_BIT : 0;
+    }
+    if (cache->table_count < DB_QCACHE_MAX_TABLES - 1) {
+        char *s = sqlite3_mprintf("%s", schema);
+        char *t = sqlite3_mprintf("%s", table);
+        if (s != NULL && t != NULL) {
+            cache->schemas[cache->table_count] = s;
+            cache->tables[cache->table_count] = t;
+            return 1u << cache->table_count++;
+        }
+        sqlite3_free(s);
+        sqlite3_free(t);
+    }
+    cache->tables_overflow = true;
+    return DB_QCACHE_OVERFLOW_BIT;
+}
+
+static int db_qcache_authorize(void *arg, int action, const char *a1, const char *a2, const char *a3,
+                               const char *a4) {
+    db_qcache_t *cache = arg;
+    if (!cache->preparing) {
+        // Statements prepared outside the cache
+        return SQLITE_OK;
+    }
+    switch (action) {
+    case SQLITE_READ:
+        cache->prepare_tables |= db_qcache_table_bit(cache, a3 ? a3 : "main", a1, true);
+        break;
+    case SQLITE_SELECT:
+    case SQLITE_RECURSIVE:
+        break;
+    case SQLITE_FUNCTION:
+        for (size_t i = 0; i < sizeof(volatile_functions) / sizeof(volatile_functions[0]); i++) {
+            if (sqlite3_stricmp(a2, volatile_functions[i]) == 0) {
+                cache->prepare_cacheable = false;
+            }
+        }
+        break;
+    default:
+        // Writes, PRAGMA, transactions, ATTACH...
+        cache->prepare_cacheable = false;
+        break;
+    }
+    return SQLITE_OK;
+}
+
+static void db_qcache_unlink(db_qcache_t *cache, db_qcache_result_t *result) {
+    db_qcache_result_t **link = &cache->buckets[result->hash % DB_QCACHE_BUCKETS];
+    while (*link != result) {
+        link = &(*link)->next;
+    }
+    *link = result->next;
+    if (result->newer) {
+        result->newer->older = result->older;
+    } else {
+        cache->newest = result->older;
+    }
+    if (result->older) {
+        result->older->newer = result->newer;
+    } else {
+        cache->oldest = result->newer;
+    }
+    cache->stats.used -= result->size;
+    cache->stats.entries--;
+    sqlite3_free(result);
+}
+
+static void db_qcache_push_newest(db_qcache_t *cache, db_qcache_result_t *result) {
+    result->older = cache->newest;
+    result->newer = NULL;
+    if (cache->newest) {
+        cache->newest->newer = result;
+    } else {
+        cache->oldest = result;
+    }
+    cache->newest = result;
+}
+
+/**
+ * @brief Mark a result as the most recently used.
+ */
+static void db_qcache_touch(db_qcache_t *cache, db_qcache_result_t *result) {
+    if (result == cache->newest) {
+        return;
+    }
+    result->newer->older = result->older;
+    if (result->older) {
+        result->older->newer = result->newer;
+    } else {
+        cache->oldest = result->newer;
+    }
+    db_qcache_push_newest(cache, result);
+}
+
+/**
+ * @brief Drop the results reading any of `tables`.
+ */
+static void db_qcache_invalidate(db_qcache_t *cache, uint32_t tables) {
+    if (tables == 0) {
+        return;
+    }
+    db_qcache_result_t *result = cache->oldest;
+    while (result) {
+        db_qcache_result_t *newer = result->newer;
+        if (result->tables & tables) {
+            db_qcache_unlink(cache, result);
+            cache->stats.invalidations++;
+        }
+        result = newer;
+    }
+}
+
+static void db_qcache_on_update(void *ctx, int op, const char *db_name, const char *table, sqlite3_int64 rowid) {
+    db_qcache_t *cache = ctx;
+    cache->hooked++;
+    cache->pending |= db_qcache_table_bit(cache, db_name, table, false);
+}
+
+static int db_qcache_on_commit(void *ctx) {
+    db_qcache_t *cache = ctx;
+    db_qcache_invalidate(cache, cache->pending);
+    cache->pending = 0;
+    return 0;
+}
+
+static void db_qcache_on_rollback(void *ctx) {
+    db_qcache_on_commit(ctx);
+}
+
+/**
+ * @brief Clear the cache if rows changed that the update hook did not report.
+ */
+static void db_qcache_check_changes(db_qcache_t *cache) {
+    int changes = sqlite3_total_changes(cache->db);
+    if (changes - cache->seen_changes > cache->hooked - cache->seen_hooked) {
+        db_qcache_invalidate(cache, UINT32_MAX);
+    }
+    cache->seen_changes = changes;
+    cache->seen_hooked = cache->hooked;
+}
+
+static void db_qcache_buf_append(db_qcache_buf_t *buf, const void *data, size_t len, size_t max) {
+    if (buf->overflow) {
+        return;
+    }
+    if (buf->len + len > max) {
+        buf->overflow = true;
+        return;
+    }
+    if (buf->len + len > buf->cap) {
+        size_t cap = buf->cap ? buf->cap * 2 : 256;
+        while (cap < buf->len + len) {
+            cap *= 2;
+        }
+        char *data = sqlite3_realloc64(buf->data, cap);
+        if (data == NULL) {
+            buf->overflow = true;
+            return;
+        }
+        buf->data = data;
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+/**
+ * @brief Find the statement slot of a normalized SQL text, or prepare the original text into one.
+ */
+static int db_qcache_statement(db_qcache_t *cache, const char *sql, const char *normalized, db_qcache_stmt_t **slot) {
+    db_qcache_stmt_t *victim = &cache->stmts[0];
+    for (int i = 0; i < DB_QCACHE_MAX_STATEMENTS; i++) {
+        db_qcache_stmt_t *s = &cache->stmts[i];
+        if (s->sql != NULL && strcmp(s->sql, normalized) == 0) {
+            s->last_used = ++cache->clock;
+            *slot = s;
+            return SQLITE_OK;
+        }
+        if (victim->sql != NULL && (s->sql == NULL || s->last_used < victim->last_used)) {
+            victim = s;
+        }
+    }
+    sqlite3_stmt *stmt;
+    cache->prepare_tables = 0;
+    cache->prepare_cacheable = true;
+    cache->preparing = true;
+    int rc = sqlite3_prepare_v2(cache->db, sql, -1, &stmt, NULL);
+    cache->preparing = false;
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    if (stmt == NULL) {
+        return SQLITE_MISUSE;
+    }
+    char *copy = sqlite3_mprintf("%s", normalized);
+    if (copy == NULL) {
+        sqlite3_finalize(stmt);
+        return SQLITE_NOMEM;
+    }
+    sqlite3_finalize(victim->stmt);
+    sqlite3_finalize(victim->params);
+    sqlite3_free(victim->sql);
+    victim->sql = copy;
+    victim->stmt = stmt;
+    victim->params = NULL;
+    victim->tables = cache->prepare_tables;
+    victim->cacheable = cache->prepare_cacheable && sqlite3_stmt_readonly(stmt);
+    victim->last_used = ++cache->clock;
+    *slot = victim;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Prepare the statement selecting the parameters of a slot, with the same names and indexes.
+ */
+static int db_qcache_prepare_params(db_qcache_t *cache, db_qcache_stmt_t *slot) {
+    int count = sqlite3_bind_parameter_count(slot->stmt);
+    char *sql = sqlite3_mprintf("SELECT");
+    for (int i = 1; i <= count && sql != NULL; i++) {
+        const char *name = sqlite3_bind_parameter_name(slot->stmt, i);
+        char *next = name ? sqlite3_mprintf("%s%s %s", sql, i > 1 ? "," : "", name)
+                          : sqlite3_mprintf("%s%s ?%d", sql, i > 1 ? "," : "", i);
+        sqlite3_free(sql);
+        sql = next;
+    }
+    if (sql == NULL) {
+        return SQLITE_NOMEM;
+    }
+    int rc = sqlite3_prepare_v2(cache->db, sql, -1, &slot->params, NULL);
+    sqlite3_free(sql);
+    return rc;
+}
+
+/**
+ * @brief Bind the parameters of a cacheable query and build its result key.
+ *
+ * @param key - Receives the normalized SQL, then per parameter its type and
+ *              its exact value: 8 bytes of integer or double, or a 4-byte
+ *              length and the bytes of a text or blob.
+ *
+ * @return SQLITE_OK, the error of `bind`, or SQLITE_NOMEM.
+ */
+static int db_qcache_bind_key(db_qcache_t *cache, db_qcache_stmt_t *slot, db_qcache_bind_fn bind, void *ctx,
+                              db_qcache_buf_t *key) {
+    db_qcache_buf_append(key, slot->sql, strlen(slot->sql) + 1, SIZE_MAX);
+    int count = sqlite3_bind_parameter_count(slot->stmt);
+    if (count == 0 || bind == NULL) {
+        return key->overflow ? SQLITE_NOMEM : SQLITE_OK;
+    }
+    int rc = slot->params ? SQLITE_OK : db_qcache_prepare_params(cache, slot);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    rc = bind(slot->params, ctx);
+    if (rc == SQLITE_OK && sqlite3_step(slot->params) != SQLITE_ROW) {
+        rc = sqlite3_errcode(cache->db);
+    }
+    for (int i = 0; i < count && rc == SQLITE_OK; i++) {
+        sqlite3_value *value = sqlite3_column_value(slot->params, i);
+        unsigned char type = (unsigned char)sqlite3_value_type(value);
+        db_qcache_buf_append(key, &type, 1, SIZE_MAX);
+        if (type == SQLITE_INTEGER) {
+            sqlite3_int64 v = sqlite3_value_int64(value);
+            db_qcache_buf_append(key, &v, sizeof(v), SIZE_MAX);
+        } else if (type == SQLITE_FLOAT) {
+            double v = sqlite3_value_double(value);
+            db_qcache_buf_append(key, &v, sizeof(v), SIZE_MAX);
+        } else if (type != SQLITE_NULL) {
+            const void *data = type == SQLITE_TEXT ? (const void *)sqlite3_value_text(value)
+                                                   : sqlite3_value_blob(value);
+            uint32_t len = (uint32_t)sqlite3_value_bytes(value);
+            db_qcache_buf_append(key, &len, sizeof(len), SIZE_MAX);
+            db_qcache_buf_append(key, data, len, SIZE_MAX);
+        }
+        rc = sqlite3_bind_value(slot->stmt, i + 1, value);
+    }
+    sqlite3_reset(slot->params);
+    sqlite3_clear_bindings(slot->params);
+    if (rc == SQLITE_OK && key->overflow) {
+        rc = SQLITE_NOMEM;
+    }
+    return rc;
+}
+
+/**
+ * @brief Step a statement to completion, passing the rows to `callback` and optionally recording them.
+ */
+static int db_qcache_run(db_qcache_t *cache, sqlite3_stmt *stmt, sqlite3_callback callback, void *arg,
+                         db_qcache_buf_t *buf, int *rows) {
+    int columns = sqlite3_column_count(stmt);
+    char **values = NULL;
+    int rc;
+    *rows = 0;
+    if (columns > 0) {
+        values = sqlite3_malloc64(2 * columns * sizeof(char *));
+        if (values == NULL) {
+            return SQLITE_NOMEM;
+        }
+        for (int i = 0; i < columns; i++) {
+            values[columns + i] = (char *)sqlite3_column_name(stmt, i);
+            if (buf) {
+                db_qcache_buf_append(buf, values[columns + i], strlen(values[columns + i]) + 1,
+                                     cache->config.max_result);
+            }
+        }
+    }
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        for (int i = 0; i < columns; i++) {
+            values[i] = (char *)sqlite3_column_text(stmt, i);
+            if (buf) {
+                char tag = values[i] ? DB_QCACHE_TEXT : DB_QCACHE_NULL;
+                db_qcache_buf_append(buf, &tag, 1, cache->config.max_result);
+                if (values[i]) {
+                    db_qcache_buf_append(buf, values[i], strlen(values[i]) + 1, cache->config.max_result);
+                }
+            }
+        }
+        (*rows)++;
+        if (callback && callback(arg, columns, values, values + columns) != 0) {
+            rc = SQLITE_ABORT;
+            break;
+        }
+    }
+    if (rc == SQLITE_DONE) {
+        rc = SQLITE_OK;
+    }
+    sqlite3_free(values);
+    return rc;
+}
+
+/**
+ * @brief Pass the rows of a cached result to `callback`.
+ */
+static int db_qcache_replay(const db_qcache_result_t *result, sqlite3_callback callback, void *arg) {
+    if (callback == NULL || result->rows == 0) {
+        return SQLITE_OK;
+    }
+    char **values = sqlite3_malloc64(2 * result->columns * sizeof(char *));
+    if (values == NULL) {
+        return SQLITE_NOMEM;
+    }
+    const char *p = result->data + result->key_len;
+    for (int i = 0; i < result->columns; i++) {
+        values[result->columns + i] = (char *)p;
+        p += strlen(p) + 1;
+    }
+    int rc = SQLITE_OK;
+    for (int row = 0; row < result->rows && rc == SQLITE_OK; row++) {
+        for (int i = 0; i < result->columns; i++) {
+            char tag = *p++;
+            values[i] = NULL;
+            if (tag == DB_QCACHE_TEXT) {
+                values[i] = (char *)p;
+                p += strlen(p) + 1;
+            }
+        }
+        if (callback(arg, result->columns, values, values + result->columns) != 0) {
+            rc = SQLITE_ABORT;
+        }
+    }
+    sqlite3_free(values);
+    return rc;
+}
+
+/**
+ * @brief Keep a result, dropping the least recently used ones beyond the budget.
+ */
+static void db_qcache_store(db_qcache_t *cache, uint32_t hash, size_t key_len, uint32_t tables, int columns,
+                            int rows, const db_qcache_buf_t *buf) {
+    size_t size = sizeof(db_qcache_result_t) + buf->len;
+    if (size > cache->config.budget) {
+        return;
+    }
+    while (cache->oldest && cache->stats.used + size > cache->config.budget) {
+        db_qcache_unlink(cache, cache->oldest);
+        cache->stats.evictions++;
+    }
+    db_qcache_result_t *result = sqlite3_malloc64(size);
+    if (result == NULL) {
+        return;
+    }
+    result->hash = hash;
+    result->tables = tables;
+    result->size = size;
+    result->key_len = key_len;
+    result->columns = columns;
+    result->rows = rows;
+    memcpy(result->data, buf->data, buf->len);
+    result->next = cache->buckets[hash % DB_QCACHE_BUCKETS];
+    cache->buckets[hash % DB_QCACHE_BUCKETS] = result;
+    db_qcache_push_newest(cache, result);
+    cache->stats.used += size;
+    cache->stats.entries++;
+}
+
+int db_qcache_exec(db_qcache_t *cache, const char *sql, db_qcache_bind_fn bind, void *ctx, sqlite3_callback callback,
+                   void *arg) {
+    char *normalized = db_qcache_normalize(sql);
+    if (normalized == NULL) {
+        return SQLITE_NOMEM;
+    }
+    db_qcache_stmt_t *slot;
+    int rc = db_qcache_statement(cache, sql, normalized, &slot);
+    sqlite3_free(normalized);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    sqlite3_stmt *stmt = slot->stmt;
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    bool cached = slot->cacheable && sqlite3_get_autocommit(cache->db);
+    db_qcache_buf_t key = { 0 };
+    if (cached) {
+        rc = db_qcache_bind_key(cache, slot, bind, ctx, &key);
+    } else if (bind) {
+        rc = bind(stmt, ctx);
+    }
+    if (rc != SQLITE_OK) {
+        sqlite3_free(key.data);
+        sqlite3_clear_bindings(stmt);
+        return rc;
+    }
+
+    int rows;
+    if (!cached) {
+        cache->stats.uncached++;
+        rc = db_qcache_run(cache, stmt, callback, arg, NULL, &rows);
+    } else {
+        db_qcache_check_changes(cache);
+        uint32_t hash = db_qcache_hash(key.data, key.len);
+        db_qcache_result_t *result = cache->buckets[hash % DB_QCACHE_BUCKETS];
+        while (result && (result->hash != hash || result->key_len != key.len ||
+                          memcmp(result->data, key.data, key.len) != 0)) {
+            result = result->next;
+        }
+        if (result) {
+            cache->stats.hits++;
+            db_qcache_touch(cache, result);
+            rc = db_qcache_replay(result, callback, arg);
+        } else {
+            cache->stats.misses++;
+            db_qcache_buf_t buf = { 0 };
+            db_qcache_buf_append(&buf, key.data, key.len, cache->config.max_result);
+            rc = db_qcache_run(cache, stmt, callback, arg, &buf, &rows);
+            if (rc == SQLITE_OK && !buf.overflow) {
+                db_qcache_store(cache, hash, key.len, slot->tables, sqlite3_column_count(stmt), rows, &buf);
+            }
+            sqlite3_free(buf.data);
+        }
+    }
+    sqlite3_free(key.data);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    return rc;
+}
+
+int db_qcache_create(sqlite3 *db, const db_qcache_config_t *config, db_qcache_t **cache) {
+    db_qcache_t *c = sqlite3_malloc(sizeof(db_qcache_t));
+    if (c == NULL) {
+        return SQLITE_NOMEM;
+    }
+    memset(c, 0, sizeof(*c));
+    c->db = db;
+    c->config = *config;
+    c->seen_changes = sqlite3_total_changes(db);
+    const db_hooks_t hooks = {
+        .update = db_qcache_on_update,
+        .commit = db_qcache_on_commit,
+        .rollback = db_qcache_on_rollback,
+        .ctx = c,
+    };
+    int rc = db_hooks_add(db, &hooks);
+    if (rc != SQLITE_OK) {
+        sqlite3_free(c);
+        return rc;
+    }
+    // Installed once: setting an authorizer expires every prepared statement of the connection
+    sqlite3_set_authorizer(db, db_qcache_authorize, c);
+    *cache = c;
+    return SQLITE_OK;
+}
+
+void db_qcache_clear(db_qcache_t *cache) {
+    db_qcache_invalidate(cache, UINT32_MAX);
+    // The table bits of the statements may have changed with the schema
+    for (int i = 0; i < DB_QCACHE_MAX_STATEMENTS; i++) {
+        sqlite3_finalize(cache->stmts[i].stmt);
+        sqlite3_finalize(cache->stmts[i].params);
+        sqlite3_free(cache->stmts[i].sql);
+        cache->stmts[i].stmt = NULL;
+        cache->stmts[i].params = NULL;
+        cache->stmts[i].sql = NULL;
+    }
+}
+
+void db_qcache_destroy(db_qcache_t *cache) {
+    if (cache == NULL) {
+        return;
+    }
+    db_hooks_remove(cache->db, cache);
+    sqlite3_set_authorizer(cache->db, NULL, NULL);
+    db_qcache_clear(cache);
+    for (int i = 0; i < cache->table_count; i++) {
+        sqlite3_free(cache->schemas[i]);
+        sqlite3_free(cache->tables[i]);
+    }
+    sqlite3_free(cache);
+}
+
+void db_qcache_get_stats(const db_qcache_t *cache, db_qcache_stats_t *stats) {
+    *stats = cache->stats;
+}
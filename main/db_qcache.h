@@ -0,0 +1,142 @@
+/* Query result cache
+ *
+ * Keeps the rows of recently run SELECTs in RAM, keyed by the statement text
+ * with whitespace and comments normalized and the exact bound parameter values. A repeated query
+ * on tables that did not change since is answered from RAM without reading
+ * SPIFFS. The tables each statement reads are found with an authorizer when
+ * it is prepared, and the update and commit hooks (db_hooks.h) drop the
+ * results of a table once a transaction writing it commits or rolls back.
+ * Prepared statements are kept, so a hit does not parse the SQL either.
+ *
+ *     db_qcache_t *cache;
+ *     db_qcache_config_t config = DB_QCACHE_CONFIG_DEFAULT();
+ *     db_qcache_create(db, &config, &cache);
+ *     db_qcache_exec(cache, "SELECT * FROM test1 WHERE id > ?", bind_min_id, &min_id, callback, NULL);
+ *
+ * Not cached: statements that write or use PRAGMA, non-deterministic
+ * functions such as random() or the date and time functions, and anything
+ * run inside an explicit transaction. Changes SQLite does not report to the
+ * update hook, to WITHOUT ROWID tables or by `DELETE` without WHERE, are
+ * detected with `sqlite3_total_changes` and clear the whole cache. Writes
+ * from other connections to the same file are not seen, and after a schema
+ * change `db_qcache_clear` must be called.
+ *
+ * A cache belongs to one connection and must only be used from the task that
+ * owns it, e.g. inside the database service. It owns the authorizer of the
+ * connection (`sqlite3_set_authorizer`) from `db_qcache_create` until
+ * `db_qcache_destroy`: the application must not install its own meanwhile.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "sqlite3.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Prepared statements kept per cache; the least recently used one is finalized. */
+#define DB_QCACHE_MAX_STATEMENTS 8
+
+/** Distinct tables tracked per cache; further tables share one invalidation slot. */
+#define DB_QCACHE_MAX_TABLES 32
+
+typedef struct db_qcache db_qcache_t;
+
+/**
+ * @brief Bind the parameters of a cached query.
+ *
+ * Only bind values: for a cacheable query `stmt` is a statement with the same
+ * parameters whose values are copied into the query and into the cache key.
+ *
+ * @param stmt - A prepared statement with the parameters of the query, reset with its bindings cleared.
+ * @param ctx - User context passed to `db_qcache_exec`.
+ *
+ * @return SQLITE_OK, or an SQLite error code to abort the query.
+ */
+typedef int (*db_qcache_bind_fn)(sqlite3_stmt *stmt, void *ctx);
+
+/**
+ * @brief Cache configuration.
+ */
+typedef struct {
+    size_t budget;              /*!< Bytes of cached rows, the least recently used results are dropped */
+    size_t max_result;          /*!< Largest result kept, in bytes */
+} db_qcache_config_t;
+
+/** Default configuration, from Kconfig. */
+#define DB_QCACHE_CONFIG_DEFAULT() {                                \
+    .budget = CONFIG_EXAMPLE_DB_QCACHE_KB * 1024,                   \
+    .max_result = CONFIG_EXAMPLE_DB_QCACHE_KB * 1024 / 4,           \
+}
+
+/**
+ * @brief Cache metrics.
+ */
+typedef struct {
+    uint32_t hits;              /*!< Queries answered from the cache */
+    uint32_t misses;            /*!< Cacheable queries that ran on the database */
+    uint32_t uncached;          /*!< Queries that cannot be cached */
+    uint32_t invalidations;     /*!< Results dropped because a table changed */
+    uint32_t evictions;         /*!< Results dropped for the budget */
+    uint32_t entries;           /*!< Results in the cache */
+    size_t used;                /*!< Bytes of cached results */
+} db_qcache_stats_t;
+
+/**
+ * @brief Create a result cache for a connection.
+ *
+ * @param db - A pointer to the SQLite database connection.
+ * @param config - Cache configuration, copied.
+ * @param cache - Receives the cache.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - SQLITE_NOMEM if the cache cannot be allocated.
+ *  - SQLITE_FULL if the connection has too many hook subscribers.
+ *
+ * @note Installs the authorizer of the connection, replacing any other one.
+ */
+int db_qcache_create(sqlite3 *db, const db_qcache_config_t *config, db_qcache_t **cache);
+
+/**
+ * @brief Drop the cached results and statements, remove the authorizer and free the cache.
+ */
+void db_qcache_destroy(db_qcache_t *cache);
+
+/**
+ * @brief Run a query through the cache.
+ *
+ * Rows are passed to `callback` as text, as by `sqlite3_exec`, whether they
+ * come from the cache or from the database.
+ *
+ * @param cache - The result cache.
+ * @param sql - One statement, with `?` parameters.
+ * @param bind - Optional, binds the parameters.
+ * @param ctx - Passed to `bind`.
+ * @param callback - Optional, called for every row.
+ * @param arg - First argument of `callback`.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - SQLITE_ABORT if `callback` returned non-zero.
+ *  - An SQLite error code on failure.
+ */
+int db_qcache_exec(db_qcache_t *cache, const char *sql, db_qcache_bind_fn bind, void *ctx, sqlite3_callback callback,
+                   void *arg);
+
+/**
+ * @brief Drop all cached results, e.g. after a schema change.
+ */
+void db_qcache_clear(db_qcache_t *cache);
+
+/**
+ * @brief Read the cache metrics.
+ */
+void db_qcache_get_stats(const db_qcache_t *cache, db_qcache_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,145 @@
+/* Recovery after an unclean shutdown
+ *
+ * See db_recovery.h. Detection only looks at the journal and WAL files, so a
+ * clean boot costs two stat() calls per database. The replay itself is
+ * SQLite's: the first read of a database rolls back a hot journal or reads
+ * the WAL, and closing the last connection in WAL mode checkpoints it and
+ * deletes the WAL. WAL databases are opened with `locking_mode=EXCLUSIVE`,
+ * like in db_checkpoint_set_journal_mode(), as SPIFFS has no shared memory.
+ *
+ * SQLite plays the journal back and checkpoints the WAL inside the pager,
+ * where neither a progress handler nor sqlite3_interrupt() stops it, so the
+ * budget is enforced before a replay starts: its duration is estimated from
+ * the bytes per microsecond of the replays already done in this run.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "db_recovery.h"
+
+static const char *TAG = "db_recovery";
+
+/* First bytes of a rollback journal header */
+static const unsigned char journal_magic[8] = { 0xd9, 0xd5, 0x05, 0xf9, 0x20, 0xa1, 0x63, 0xd7 };
+
+/* Size of the WAL header; a shorter WAL has no frames */
+#define DB_RECOVERY_WAL_HEADER 32
+
+static int64_t recovery_time_us = 0;
+
+static const char *state_names[] = { "clean", "hot journal", "WAL" };
+
+/**
+ * @brief Size of `path` followed by `suffix`, or -1 if it does not exist.
+ */
+static long file_size(const char *path, const char *suffix) {
+    char name[128];
+    struct stat st;
+    snprintf(name, sizeof(name), "%s%s", path, suffix);
+    if (stat(name, &st) != 0) {
+        return -1;
+    }
+    return (long)st.st_size;
+}
+
+db_recovery_state_t db_recovery_detect(const char *path, size_t *pending_bytes) {
+    long size = file_size(path, "-wal");
+    db_recovery_state_t state = DB_RECOVERY_CLEAN;
+    if (size > DB_RECOVERY_WAL_HEADER) {
+        state = DB_RECOVERY_WAL;
+    } else if ((size = file_size(path, "-journal")) > 0) {
+        char name[128];
+        unsigned char header[sizeof(journal_magic)];
+        snprintf(name, sizeof(name), "%s-journal", path);
+        FILE *f = fopen(name, "rb");
+        if (f != NULL) {
+            if (fread(header, 1, sizeof(header), f) == sizeof(header) &&
+                memcmp(header, journal_magic, sizeof(header)) == 0) {
+                state = DB_RECOVERY_HOT_JOURNAL;
+            }
+            fclose(f);
+        }
+    }
+    if (pending_bytes) {
+        *pending_bytes = state != DB_RECOVERY_CLEAN ? (size_t)size : 0;
+    }
+    return state;
+}
+
+/**
+ * @brief Open a database on its own so SQLite replays its journal or WAL, then close it.
+ *
+ * @return SQLITE_OK, or the error of the open, the read or the checkpoint.
+ */
+static int db_recovery_replay(const db_recovery_file_t *file) {
+    sqlite3 *db;
+    int rc = sqlite3_open_v2(file->path, &db, SQLITE_OPEN_READWRITE, NULL);
+    if (rc == SQLITE_OK && file->state == DB_RECOVERY_WAL) {
+        rc = sqlite3_exec(db, "PRAGMA locking_mode=EXCLUSIVE", NULL, NULL, NULL);
+    }
+    if (rc == SQLITE_OK) {
+        // The first read takes the lock that triggers the replay
+        rc = sqlite3_exec(db, "PRAGMA schema_version", NULL, NULL, NULL);
+    }
+    if (rc == SQLITE_OK && file->state == DB_RECOVERY_WAL) {
+        rc = sqlite3_exec(db, "PRAGMA wal_checkpoint(TRUNCATE)", NULL, NULL, NULL);
+    }
+    if (rc != SQLITE_OK) {
+        ESP_LOGE(TAG, "%s: %s", file->path, sqlite3_errmsg(db));
+    }
+    sqlite3_close(db);
+    return rc;
+}
+
+int db_recovery_run(db_recovery_file_t *files, size_t count, const db_recovery_config_t *config) {
+    int64_t start = esp_timer_get_time();
+    int64_t deadline = config->budget_ms > 0 ? start + config->budget_ms * 1000LL : INT64_MAX;
+    int result = SQLITE_OK;
+    int replayed = 0;
+    // Replay rate so far, to estimate the next replay
+    size_t replayed_bytes = 0;
+    int64_t replay_us = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        db_recovery_file_t *file = &files[i];
+        file->state = db_recovery_detect(file->path, &file->pending_bytes);
+        file->deferred = false;
+        file->result = SQLITE_OK;
+        file->duration_us = 0;
+        if (file->state == DB_RECOVERY_CLEAN) {
+            continue;
+        }
+        // A replay cannot be interrupted, so one that would not end within the budget is not started
+        int64_t file_start = esp_timer_get_time();
+        int64_t estimate_us = replayed_bytes > 0 ? (int64_t)file->pending_bytes * replay_us / (int64_t)replayed_bytes : 0;
+        if (file_start + estimate_us >= deadline) {
+            file->deferred = true;
+            ESP_LOGW(TAG, "%s: %s of %d bytes left to the first query, estimated %lld us, budget of %d ms",
+                     file->path, state_names[file->state], (int)file->pending_bytes, estimate_us,
+                     (int)config->budget_ms);
+            continue;
+        }
+        file->result = db_recovery_replay(file);
+        file->duration_us = esp_timer_get_time() - file_start;
+        replayed++;
+        replayed_bytes += file->pending_bytes;
+        replay_us += file->duration_us;
+        if (file->result != SQLITE_OK && result == SQLITE_OK) {
+            result = file->result;
+        }
+        ESP_LOGI(TAG, "%s: %s of %d bytes replayed in %lld us", file->path, state_names[file->state],
+                 (int)file->pending_bytes, file->duration_us);
+    }
+
+    recovery_time_us = esp_timer_get_time() - start;
+    if (replayed > 0) {
+        ESP_LOGI(TAG, "Recovered %d databases in %lld us", replayed, recovery_time_us);
+    }
+    return result;
+}
+
+int64_t db_recovery_time_us(void) {
+    return recovery_time_us;
+}
@@ -0,0 +1,106 @@
+/* Recovery after an unclean shutdown
+ *
+ * A transaction interrupted by a reset or power loss leaves a hot rollback
+ * journal or a non-empty WAL next to the database. SQLite replays it on the
+ * first read of the file, so without this step the first query after such a
+ * boot takes an unpredictable amount of time. `db_recovery_run` finds these
+ * files at startup, before the databases are opened and the services start,
+ * replays them one database at a time and logs how long each one took. Once
+ * the time budget is used up the remaining databases are left to SQLite's
+ * own recovery at their first read.
+ *
+ * A replay cannot be interrupted once started. A database is only started if
+ * its replay, estimated from the size of its journal or WAL and the rate of
+ * the replays before it, ends within the budget. The first replay has no
+ * estimate and is always started, so a large first journal, or a replay that
+ * is slower than estimated, can still overrun the budget.
+ *
+ *     db_recovery_file_t files[] = { { .path = "/spiffs/test1.db" }, { .path = "/spiffs/test2.db" } };
+ *     db_recovery_config_t config = DB_RECOVERY_CONFIG_DEFAULT();
+ *     db_recovery_run(files, 2, &config);
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "sqlite3.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief What a database needs after an unclean shutdown.
+ */
+typedef enum {
+    DB_RECOVERY_CLEAN,              /*!< Nothing to replay */
+    DB_RECOVERY_HOT_JOURNAL,        /*!< A rollback journal to roll back */
+    DB_RECOVERY_WAL,                /*!< A WAL to read and checkpoint */
+} db_recovery_state_t;
+
+/**
+ * @brief Recovery configuration.
+ */
+typedef struct {
+    uint32_t budget_ms;             /*!< No replay is started that is estimated to end after this much time, 0 for no limit */
+} db_recovery_config_t;
+
+/** Default configuration, from Kconfig. */
+#define DB_RECOVERY_CONFIG_DEFAULT() {                              \
+    .budget_ms = CONFIG_EXAMPLE_DB_RECOVERY_BUDGET_MS,              \
+}
+
+/**
+ * @brief A database to recover, and the outcome.
+ */
+typedef struct {
+    const char *path;               /*!< Database file, set by the caller */
+    db_recovery_state_t state;      /*!< What was found */
+    size_t pending_bytes;           /*!< Size of the hot journal or WAL */
+    bool deferred;                  /*!< Left to SQLite because the replay would not end within the budget */
+    int result;                     /*!< SQLITE_OK, or the error of the replay */
+    int64_t duration_us;            /*!< Replay time */
+} db_recovery_file_t;
+
+/**
+ * @brief Check whether a database has a hot journal or WAL, without opening it.
+ *
+ * A journal is hot if it is not empty and starts with a journal header;
+ * PERSIST mode zeroes the header at commit.
+ *
+ * @param path - Database file.
+ * @param pending_bytes - Set to the size of the journal or WAL, may be NULL.
+ *
+ * @return What the database needs.
+ */
+db_recovery_state_t db_recovery_detect(const char *path, size_t *pending_bytes);
+
+/**
+ * @brief Replay the hot journals and WALs of the given databases.
+ *
+ * Each database that needs it is opened on its own, read once so SQLite
+ * replays the journal or WAL, checkpointed in WAL mode, and closed. Must run
+ * before the databases are opened by the application.
+ *
+ * @param files - Databases, updated with the outcome.
+ * @param count - Number of databases.
+ * @param config - Recovery configuration.
+ *
+ * @return
+ *  - SQLITE_OK (0) if nothing failed, also when databases were deferred.
+ *  - The first SQLite error of a replay.
+ */
+int db_recovery_run(db_recovery_file_t *files, size_t count, const db_recovery_config_t *config);
+
+/**
+ * @brief Time spent in `db_recovery_run`, in microseconds.
+ *
+ * @return Duration of the last run, 0 if it did not run.
+ */
+int64_t db_recovery_time_us(void);
+
+#ifdef __cplusplus
+}
+#endif
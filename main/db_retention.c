@@ -0,0 +1,242 @@
+/* Ring-buffer retention for regular tables
+ *
+ * See db_retention.h. Every check below is a read of the row counter, an
+ * index lookup at one end of the rowid B-tree or a header read (page counts),
+ * never a scan of the table, so the cost of a call does not depend on the
+ * table size. Finding the end of a batch walks at most `batch_rows` rows.
+ *
+ * The row count of a `max_rows` table is kept in `db_retention_rows` of the
+ * table's database by two triggers, installed and seeded with one count on
+ * the first call. The insert trigger runs BEFORE the row is stored and does
+ * not count a row replacing one with the same rowid, since `INSERT OR REPLACE`
+ * does not fire delete triggers while `recursive_triggers` is off (the
+ * default).
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_log.h"
+#include "db_retention.h"
+
+static const char *TAG = "db_retention";
+
+/**
+ * @brief Run a query returning a single integer.
+ *
+ * @return SQLITE_OK with `*value` set, SQLITE_DONE if the query returned no row
+ *         or NULL, or an SQLite error code.
+ */
+static int db_retention_query(sqlite3 *db, const char *sql, int64_t *value) {
+    if (sql == NULL) {
+        return SQLITE_NOMEM;
+    }
+    sqlite3_stmt *stmt;
+    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW) {
+        if (sqlite3_column_type(stmt, 0) == SQLITE_NULL) {
+            rc = SQLITE_DONE;
+        } else {
+            *value = sqlite3_column_int64(stmt, 0);
+            rc = SQLITE_OK;
+        }
+    }
+    sqlite3_finalize(stmt);
+    return rc;
+}
+
+/**
+ * @brief Run a query returning a single integer, then free its text.
+ */
+static int db_retention_query_free(sqlite3 *db, char *sql, int64_t *value) {
+    int rc = db_retention_query(db, sql, value);
+    sqlite3_free(sql);
+    return rc;
+}
+
+/**
+ * @brief Create the row counter of a table and its triggers, and seed it with the current count.
+ */
+static int db_retention_install_counter(sqlite3 *db, const char *schema, const char *table) {
+    char *sql = sqlite3_mprintf(
+        "SAVEPOINT db_retention;"
+        "CREATE TABLE IF NOT EXISTS \"%w\".db_retention_rows (tbl TEXT PRIMARY KEY, n INTEGER NOT NULL);"
+        "DROP TRIGGER IF EXISTS \"%w\".\"db_retention_%w_insert\";"
+        "DROP TRIGGER IF EXISTS \"%w\".\"db_retention_%w_delete\";"
+        "CREATE TRIGGER \"%w\".\"db_retention_%w_insert\" BEFORE INSERT ON \"%w\" BEGIN "
+        "UPDATE db_retention_rows SET n = n + 1 - EXISTS (SELECT 1 FROM \"%w\" WHERE rowid = NEW.rowid) "
+        "WHERE tbl = %Q; END;"
+        "CREATE TRIGGER \"%w\".\"db_retention_%w_delete\" AFTER DELETE ON \"%w\" BEGIN "
+        "UPDATE db_retention_rows SET n = n - 1 WHERE tbl = %Q; END;"
+        "INSERT OR REPLACE INTO \"%w\".db_retention_rows VALUES (%Q, (SELECT count(*) FROM \"%w\".\"%w\"));"
+        "RELEASE db_retention;",
+        schema, schema, table, schema, table, schema, table, table, table, table, schema, table, table, table,
+        schema, table, schema, table);
+    if (sql == NULL) {
+        return SQLITE_NOMEM;
+    }
+    int rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    sqlite3_free(sql);
+    if (rc != SQLITE_OK) {
+        sqlite3_exec(db, "ROLLBACK TO db_retention; RELEASE db_retention", NULL, NULL, NULL);
+        return rc;
+    }
+    ESP_LOGI(TAG, "%s: row counter installed", table);
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Number of rows of a table, from its counter.
+ *
+ * The counter is (re)installed when it or its insert trigger is missing, e.g.
+ * on the first call or after the table was dropped and created again.
+ */
+static int db_retention_rows(sqlite3 *db, const char *schema, const char *table, int64_t *rows) {
+    const char *query = "SELECT n FROM \"%w\".db_retention_rows WHERE tbl = %Q AND EXISTS "
+                        "(SELECT 1 FROM \"%w\".sqlite_master WHERE type = 'trigger' AND name = 'db_retention_' || %Q "
+                        "|| '_insert')";
+    // Checked in the schema cache, without reading the file
+    int rc = sqlite3_table_column_metadata(db, schema, "db_retention_rows", NULL, NULL, NULL, NULL, NULL, NULL);
+    if (rc == SQLITE_OK) {
+        rc = db_retention_query_free(db, sqlite3_mprintf(query, schema, table, schema, table), rows);
+    } else {
+        rc = SQLITE_DONE;
+    }
+    if (rc == SQLITE_DONE) {
+        rc = db_retention_install_counter(db, schema, table);
+        if (rc == SQLITE_OK) {
+            rc = db_retention_query_free(db, sqlite3_mprintf(query, schema, table, schema, table), rows);
+        }
+    }
+    return rc;
+}
+
+/**
+ * @brief Number of the oldest rows to evict, capped to `batch`.
+ */
+static int db_retention_excess(sqlite3 *db, const db_retention_policy_t *policy, const char *schema, uint32_t batch,
+                               int64_t *excess, bool *by_age) {
+    int64_t n = 0;
+    int rc;
+
+    if (policy->max_rows) {
+        int64_t rows;
+        rc = db_retention_rows(db, schema, policy->table, &rows);
+        if (rc != SQLITE_OK) {
+            return rc;
+        }
+        if (rows > policy->max_rows) {
+            n = rows - policy->max_rows;
+        }
+    }
+    if (policy->max_bytes && n < batch) {
+        int64_t page_size, pages, free_pages;
+        if ((rc = db_retention_query_free(db, sqlite3_mprintf("PRAGMA \"%w\".page_size", schema), &page_size)) !=
+                SQLITE_OK ||
+            (rc = db_retention_query_free(db, sqlite3_mprintf("PRAGMA \"%w\".page_count", schema), &pages)) !=
+                SQLITE_OK ||
+            (rc = db_retention_query_free(db, sqlite3_mprintf("PRAGMA \"%w\".freelist_count", schema),
+                                          &free_pages)) != SQLITE_OK) {
+            return rc;
+        }
+        if ((pages - free_pages) * page_size > policy->max_bytes) {
+            // Size is only known per page: evict a full batch and check again next call
+            n = batch;
+        }
+    }
+    if (policy->max_age && policy->time_column && n < batch) {
+        int64_t newest, oldest;
+        rc = db_retention_query_free(db,
+                                     sqlite3_mprintf("SELECT \"%w\" FROM \"%w\".\"%w\" ORDER BY rowid DESC LIMIT 1",
+                                                     policy->time_column, schema, policy->table),
+                                     &newest);
+        if (rc != SQLITE_OK) {
+            return rc;
+        }
+        rc = db_retention_query_free(db,
+                                     sqlite3_mprintf("SELECT \"%w\" FROM \"%w\".\"%w\" ORDER BY rowid LIMIT 1",
+                                                     policy->time_column, schema, policy->table),
+                                     &oldest);
+        if (rc != SQLITE_OK) {
+            return rc;
+        }
+        if (oldest < newest - policy->max_age) {
+            // Only rows older than the cutoff are deleted, see db_retention_apply()
+            *by_age = (n == 0);
+            n = batch;
+        }
+    }
+    *excess = n < batch ? n : batch;
+    return SQLITE_OK;
+}
+
+int db_retention_apply(sqlite3 *db, const db_retention_policy_t *policy, uint32_t *evicted) {
+    const char *schema = policy->schema ? policy->schema : "main";
+    uint32_t batch = policy->batch_rows ? policy->batch_rows : DB_RETENTION_DEFAULT_BATCH_ROWS;
+    int64_t min_rowid, excess, cutoff;
+    bool by_age = false;
+    if (evicted) {
+        *evicted = 0;
+    }
+
+    int rc = db_retention_query_free(db, sqlite3_mprintf("SELECT min(rowid) FROM \"%w\".\"%w\"", schema,
+                                                         policy->table), &min_rowid);
+    if (rc == SQLITE_DONE) {
+        // Empty table
+        return SQLITE_OK;
+    }
+    if (rc == SQLITE_OK) {
+        rc = db_retention_excess(db, policy, schema, batch, &excess, &by_age);
+    }
+    if (rc == SQLITE_OK && excess > 0) {
+        // Rowid of the first row kept, none if every row goes
+        rc = db_retention_query_free(db, sqlite3_mprintf("SELECT rowid FROM \"%w\".\"%w\" ORDER BY rowid "
+                                                         "LIMIT 1 OFFSET %lld", schema, policy->table, excess),
+                                     &cutoff);
+        if (rc == SQLITE_DONE) {
+            cutoff = INT64_MAX;
+            rc = SQLITE_OK;
+        }
+    }
+    if (rc != SQLITE_OK) {
+        ESP_LOGE(TAG, "%s: %s", policy->table, sqlite3_errmsg(db));
+        return rc;
+    }
+    if (excess == 0) {
+        return SQLITE_OK;
+    }
+
+    // Range delete at the start of the rowid B-tree
+    char *where = cutoff == INT64_MAX ? sqlite3_mprintf("rowid >= %lld", min_rowid)
+                                      : sqlite3_mprintf("rowid < %lld", cutoff);
+    if (where == NULL) {
+        return SQLITE_NOMEM;
+    }
+    char *sql;
+    if (by_age) {
+        sql = sqlite3_mprintf("DELETE FROM \"%w\".\"%w\" WHERE %s AND \"%w\" < "
+                              "(SELECT \"%w\" FROM \"%w\".\"%w\" ORDER BY rowid DESC LIMIT 1) - %lld",
+                              schema, policy->table, where, policy->time_column, policy->time_column, schema,
+                              policy->table, policy->max_age);
+    } else {
+        sql = sqlite3_mprintf("DELETE FROM \"%w\".\"%w\" WHERE %s", schema, policy->table, where);
+    }
+    sqlite3_free(where);
+    if (sql == NULL) {
+        return SQLITE_NOMEM;
+    }
+    rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+    sqlite3_free(sql);
+    if (rc != SQLITE_OK) {
+        ESP_LOGE(TAG, "%s: eviction failed: %s", policy->table, sqlite3_errmsg(db));
+        return rc;
+    }
+    uint32_t n = sqlite3_changes(db);
+    ESP_LOGD(TAG, "%s: evicted %d row(s)", policy->table, (int)n);
+    if (evicted) {
+        *evicted = n;
+    }
+    return SQLITE_OK;
+}
@@ -0,0 +1,63 @@
+/* Ring-buffer retention for regular tables
+ *
+ * Keeps a rowid table bounded by row count, database size or age by evicting
+ * its oldest rows in small batches. Deleted pages go to the SQLite freelist
+ * and are reused by the next inserts, so the file stops growing and each call
+ * costs at most `batch_rows` deletions at the start of the rowid B-tree,
+ * instead of one large `DELETE ... WHERE id < ?`.
+ *
+ * Time-series tables (ts_vtab.h) have their own segment-based retention.
+ */
+#pragma once
+
+#include <stdint.h>
+#include "sqlite3.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Default number of rows evicted per `db_retention_apply` call. */
+#define DB_RETENTION_DEFAULT_BATCH_ROWS 64
+
+/**
+ * @brief Retention policy of a table. Limits set to 0 are disabled.
+ *
+ * Rows are assumed to be inserted in rowid order, oldest first.
+ *
+ * With `max_rows` the first call creates the table `db_retention_rows` and two
+ * triggers on `table` in its database, and counts the rows once; afterwards
+ * the triggers keep the count, so it is read without a scan. The count
+ * assumes `recursive_triggers` is off and that conflicting inserts only
+ * conflict on the rowid.
+ */
+typedef struct {
+    const char *schema;         /*!< Attached database holding the table, NULL for "main" */
+    const char *table;          /*!< Table to keep bounded */
+    uint32_t max_rows;          /*!< Maximum number of rows, counted by triggers, see below */
+    uint32_t max_bytes;         /*!< Maximum bytes used by the database file, excluding free pages */
+    const char *time_column;    /*!< Column holding the row time, required by `max_age` */
+    int64_t max_age;            /*!< Rows with time_column < newest time - max_age are evicted */
+    uint32_t batch_rows;        /*!< Rows evicted per call, 0 for DB_RETENTION_DEFAULT_BATCH_ROWS */
+} db_retention_policy_t;
+
+/**
+ * @brief Evict the oldest rows of a table that exceed its retention policy.
+ *
+ * Does at most one batch of work, so it can be called after every insert (or
+ * from an idle task) with a bounded cost. Runs in the caller's transaction if
+ * one is open.
+ *
+ * @param db - A pointer to the SQLite database connection.
+ * @param policy - Retention policy.
+ * @param evicted - Optional, receives the number of rows deleted.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success, including when nothing had to be evicted.
+ *  - An SQLite error code on failure.
+ */
+int db_retention_apply(sqlite3 *db, const db_retention_policy_t *policy, uint32_t *evicted);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,211 @@
+/* Table layout templates
+ *
+ * See db_schema.h.
+ */
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "db_schema.h"
+
+static const char *TAG = "db_schema";
+
+static const char *const template_names[] = {
+    [DB_SCHEMA_PLAIN] = "plain",
+    [DB_SCHEMA_ROWID_ALIAS] = "rowid",
+    [DB_SCHEMA_WITHOUT_ROWID] = "without_rowid",
+};
+
+int db_schema_template_from_name(const char *name, db_schema_template_t *tmpl) {
+    for (size_t i = 0; i < sizeof(template_names) / sizeof(template_names[0]); i++) {
+        if (strcasecmp(name, template_names[i]) == 0) {
+            *tmpl = (db_schema_template_t)i;
+            return SQLITE_OK;
+        }
+    }
+    return SQLITE_NOTFOUND;
+}
+
+const char *db_schema_template_name(db_schema_template_t tmpl) {
+    return (size_t)tmpl < sizeof(template_names) / sizeof(template_names[0]) ? template_names[tmpl] : "?";
+}
+
+char *db_schema_table_sql(const char *table, const char *key, const char *columns, db_schema_template_t tmpl) {
+    const char *sep = columns[0] ? ", " : "";
+    switch (tmpl) {
+    case DB_SCHEMA_ROWID_ALIAS:
+        return sqlite3_mprintf("CREATE TABLE \"%w\" (\"%w\" INTEGER PRIMARY KEY%s%s)", table, key, sep, columns);
+    case DB_SCHEMA_WITHOUT_ROWID:
+        return sqlite3_mprintf("CREATE TABLE \"%w\" (\"%w\" INTEGER PRIMARY KEY%s%s) WITHOUT ROWID", table, key, sep,
+                               columns);
+    default:
+        return sqlite3_mprintf("CREATE TABLE \"%w\" (\"%w\" INTEGER%s%s)", table, key, sep, columns);
+    }
+}
+
+int db_schema_detect(sqlite3 *db, const char *table, const char *key, db_schema_template_t *tmpl) {
+    sqlite3_stmt *stmt;
+    char *sql = sqlite3_mprintf("PRAGMA table_info(\"%w\")", table);
+    int rc = sql ? sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) : SQLITE_NOMEM;
+    sqlite3_free(sql);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    bool found = false;
+    bool integer_key = false;
+    int pk_columns = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        if (sqlite3_column_int(stmt, 5) != 0) {
+            pk_columns++;
+        }
+        const char *name = (const char *)sqlite3_column_text(stmt, 1);
+        if (name && strcasecmp(name, key) == 0) {
+            const char *type = (const char *)sqlite3_column_text(stmt, 2);
+            found = true;
+            integer_key = sqlite3_column_int(stmt, 5) == 1 && type && strcasecmp(type, "INTEGER") == 0;
+        }
+    }
+    sqlite3_finalize(stmt);
+    if (!found) {
+        return SQLITE_NOTFOUND;
+    }
+
+    // Only WITHOUT ROWID tables have no rowid to select
+    sql = sqlite3_mprintf("SELECT rowid FROM \"%w\" LIMIT 0", table);
+    rc = sql ? sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) : SQLITE_NOMEM;
+    sqlite3_free(sql);
+    if (rc == SQLITE_NOMEM) {
+        return rc;
+    }
+    if (rc != SQLITE_OK) {
+        *tmpl = DB_SCHEMA_WITHOUT_ROWID;
+    } else {
+        sqlite3_finalize(stmt);
+        *tmpl = integer_key && pk_columns == 1 ? DB_SCHEMA_ROWID_ALIAS : DB_SCHEMA_PLAIN;
+    }
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Build the definitions and the names of the non-key columns of a table.
+ */
+static int db_schema_columns(sqlite3 *db, const char *table, const char *key, char **defs, char **names) {
+    sqlite3_stmt *stmt;
+    char *sql = sqlite3_mprintf("PRAGMA table_info(\"%w\")", table);
+    int rc = sql ? sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) : SQLITE_NOMEM;
+    sqlite3_free(sql);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    *defs = sqlite3_mprintf("");
+    *names = sqlite3_mprintf("\"%w\"", key);
+    while (*defs && *names && sqlite3_step(stmt) == SQLITE_ROW) {
+        const char *name = (const char *)sqlite3_column_text(stmt, 1);
+        const char *type = (const char *)sqlite3_column_text(stmt, 2);
+        if (name == NULL || strcasecmp(name, key) == 0) {
+            continue;
+        }
+        char *d = sqlite3_mprintf("%s%s\"%w\"%s%s", *defs, (*defs)[0] ? ", " : "", name, type && type[0] ? " " : "",
+                                  type ? type : "");
+        char *n = sqlite3_mprintf("%s, \"%w\"", *names, name);
+        sqlite3_free(*defs);
+        sqlite3_free(*names);
+        *defs = d;
+        *names = n;
+    }
+    sqlite3_finalize(stmt);
+    if (*defs == NULL || *names == NULL) {
+        sqlite3_free(*defs);
+        sqlite3_free(*names);
+        return SQLITE_NOMEM;
+    }
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Read the CREATE INDEX statements of a table, joined with ';'.
+ */
+static int db_schema_indexes(sqlite3 *db, const char *table, char **indexes) {
+    sqlite3_stmt *stmt;
+    int rc = sqlite3_prepare_v2(db,
+                                "SELECT group_concat(sql, ';') FROM sqlite_master "
+                                "WHERE type = 'index' AND tbl_name = ? AND sql IS NOT NULL",
+                                -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    sqlite3_bind_text(stmt, 1, table, -1, SQLITE_STATIC);
+    *indexes = NULL;
+    if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
+        *indexes = sqlite3_mprintf("%s", (const char *)sqlite3_column_text(stmt, 0));
+        if (*indexes == NULL) {
+            rc = SQLITE_NOMEM;
+        }
+    }
+    sqlite3_finalize(stmt);
+    return rc;
+}
+
+int db_schema_apply(sqlite3 *db, const char *table, const char *key, db_schema_template_t tmpl) {
+    db_schema_template_t current;
+    int rc = db_schema_detect(db, table, key, &current);
+    if (rc != SQLITE_OK || current == tmpl) {
+        return rc;
+    }
+
+    int64_t start = esp_timer_get_time();
+    char *defs = NULL;
+    char *names = NULL;
+    char *indexes = NULL;
+    char *sql = NULL;
+    char *new_table = sqlite3_mprintf("%s_rebuild", table);
+    rc = new_table ? sqlite3_exec(db, "BEGIN IMMEDIATE", NULL, NULL, NULL) : SQLITE_NOMEM;
+    if (rc == SQLITE_OK) {
+        rc = db_schema_columns(db, table, key, &defs, &names);
+    }
+    if (rc == SQLITE_OK) {
+        rc = db_schema_indexes(db, table, &indexes);
+    }
+    if (rc == SQLITE_OK) {
+        sql = db_schema_table_sql(new_table, key, defs, tmpl);
+        rc = sql ? sqlite3_exec(db, sql, NULL, NULL, NULL) : SQLITE_NOMEM;
+        sqlite3_free(sql);
+    }
+    if (rc == SQLITE_OK) {
+        // Insertion order, so the last row wins when ids repeat
+        sql = sqlite3_mprintf("INSERT OR REPLACE INTO \"%w\" (%s) SELECT %s FROM \"%w\"%s%w%s ORDER BY %s",
+                              new_table, names, names, table,
+                              tmpl == DB_SCHEMA_WITHOUT_ROWID ? " WHERE \"" : "",
+                              tmpl == DB_SCHEMA_WITHOUT_ROWID ? key : "",
+                              tmpl == DB_SCHEMA_WITHOUT_ROWID ? "\" IS NOT NULL" : "",
+                              current == DB_SCHEMA_WITHOUT_ROWID ? "1" : "rowid");
+        rc = sql ? sqlite3_exec(db, sql, NULL, NULL, NULL) : SQLITE_NOMEM;
+        sqlite3_free(sql);
+    }
+    if (rc == SQLITE_OK) {
+        sql = sqlite3_mprintf("DROP TABLE \"%w\"; ALTER TABLE \"%w\" RENAME TO \"%w\"", table, new_table, table);
+        rc = sql ? sqlite3_exec(db, sql, NULL, NULL, NULL) : SQLITE_NOMEM;
+        sqlite3_free(sql);
+    }
+    if (rc == SQLITE_OK && indexes) {
+        rc = sqlite3_exec(db, indexes, NULL, NULL, NULL);
+    }
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+    }
+    if (rc != SQLITE_OK) {
+        ESP_LOGE(TAG, "Rebuilding %s as %s failed: %s", table, db_schema_template_name(tmpl), sqlite3_errmsg(db));
+        if (!sqlite3_get_autocommit(db)) {
+            sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+        }
+    } else {
+        ESP_LOGI(TAG, "Rebuilt %s from %s to %s in %lld us", table, db_schema_template_name(current),
+                 db_schema_template_name(tmpl), esp_timer_get_time() - start);
+    }
+    sqlite3_free(new_table);
+    sqlite3_free(defs);
+    sqlite3_free(names);
+    sqlite3_free(indexes);
+    return rc;
+}
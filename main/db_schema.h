@@ -0,0 +1,99 @@
+/* Table layout templates
+ *
+ * The migrations in main/schema declare keyed tables as `(id INTEGER, ...)`,
+ * which stores a hidden rowid next to `id` and needs an index for lookups by
+ * id. A template picks how such a table is actually laid out:
+ *
+ *  - DB_SCHEMA_PLAIN:          as declared, rowid B-tree keyed by a hidden rowid.
+ *  - DB_SCHEMA_ROWID_ALIAS:    `id INTEGER PRIMARY KEY`, `id` is the rowid itself.
+ *  - DB_SCHEMA_WITHOUT_ROWID:  `PRIMARY KEY (id) WITHOUT ROWID`, rows are stored
+ *                              in a B-tree keyed by `id`.
+ *
+ * `db_schema_apply` rebuilds a table into the selected layout once, after the
+ * migrations ran; tools/mkdbimage.py --schema-template does the same for
+ * provisioned images, so flashed databases need no rebuild at boot.
+ *
+ * Keyed templates reject duplicate ids, and WITHOUT ROWID tables also reject
+ * NULL ids and cannot be used with db_blob.h or db_retention.h, which address
+ * rows by rowid.
+ */
+#pragma once
+
+#include "sqlite3.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    DB_SCHEMA_PLAIN,
+    DB_SCHEMA_ROWID_ALIAS,
+    DB_SCHEMA_WITHOUT_ROWID,
+} db_schema_template_t;
+
+/**
+ * @brief Parse a template name: "plain", "rowid" or "without_rowid".
+ *
+ * @param name - Template name.
+ * @param tmpl - Receives the template.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - SQLITE_NOTFOUND for an unknown name.
+ */
+int db_schema_template_from_name(const char *name, db_schema_template_t *tmpl);
+
+/**
+ * @brief Name of a template, as accepted by `db_schema_template_from_name`.
+ */
+const char *db_schema_template_name(db_schema_template_t tmpl);
+
+/**
+ * @brief Build the CREATE TABLE statement of a table for a template.
+ *
+ * @param table - Table name.
+ * @param key - Key column, declared INTEGER.
+ * @param columns - Definitions of the other columns, e.g. `"content"` or `"a TEXT, b REAL"`.
+ * @param tmpl - Template.
+ *
+ * @return The statement, to be freed with sqlite3_free(), or NULL if out of memory.
+ */
+char *db_schema_table_sql(const char *table, const char *key, const char *columns, db_schema_template_t tmpl);
+
+/**
+ * @brief Detect the layout of an existing table.
+ *
+ * @param db - A pointer to the SQLite database connection.
+ * @param table - Table name.
+ * @param key - Key column.
+ * @param tmpl - Receives the layout.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - SQLITE_NOTFOUND if the table or key column does not exist.
+ *  - An SQLite error code on failure.
+ */
+int db_schema_detect(sqlite3 *db, const char *table, const char *key, db_schema_template_t *tmpl);
+
+/**
+ * @brief Rebuild a table into the layout of a template, if needed.
+ *
+ * Copies the rows into a new table with the template's layout, keeping the
+ * last row for duplicate ids, then replaces the old table and recreates its
+ * indexes, all in one transaction. Does nothing if the table already has the
+ * layout.
+ *
+ * @param db - A pointer to the SQLite database connection.
+ * @param table - Table name.
+ * @param key - Key column.
+ * @param tmpl - Template.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - An SQLite error code on failure, the table is left unchanged.
+ */
+int db_schema_apply(sqlite3 *db, const char *table, const char *key, db_schema_template_t tmpl);
+
+#ifdef __cplusplus
+}
+#endif
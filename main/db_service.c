@@ -0,0 +1,310 @@
+/* Database service task
+ *
+ * See db_service.h. Requests are passed through a FreeRTOS queue; the caller
+ * blocks on a binary semaphore that lives on its own stack, so a call does not
+ * allocate.
+ *
+ * A write request starts a group: the task keeps taking the writes to the
+ * same connection at the head of the queue until the group window ends, then
+ * runs them in one transaction, each under its own savepoint.
+ */
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "db_service.h"
+
+static const char *TAG = "db_service";
+
+typedef struct {
+    db_service_fn fn;           /* NULL asks the task to stop */
+    void *arg;
+    sqlite3 *db;                /* set for writes, which are group-committed */
+    int *result;
+    SemaphoreHandle_t done;
+} db_request_t;
+
+typedef struct {
+    const char *name;
+    db_idle_fn fn;
+    void *arg;
+} db_idle_job_t;
+
+static db_service_config_t service_config;
+static QueueHandle_t request_queue = NULL;
+static TaskHandle_t service_task = NULL;
+static db_idle_job_t idle_jobs[DB_SERVICE_MAX_IDLE_JOBS];
+static int idle_job_count = 0;
+static SemaphoreHandle_t idle_lock = NULL;  /* guards idle_jobs, held while a slice runs */
+static db_service_stats_t service_stats;
+
+/**
+ * @brief Run idle job slices until there is no more work or a request arrives.
+ */
+static void db_service_run_idle(void) {
+    if (idle_lock == NULL) {
+        return;
+    }
+    bool pending = true;
+    while (pending && uxQueueMessagesWaiting(request_queue) == 0) {
+        pending = false;
+        for (int i = 0; uxQueueMessagesWaiting(request_queue) == 0; i++) {
+            // The lock is held during the slice so a job is not removed while it runs
+            xSemaphoreTake(idle_lock, portMAX_DELAY);
+            if (i >= idle_job_count) {
+                xSemaphoreGive(idle_lock);
+                break;
+            }
+            int64_t start = esp_timer_get_time();
+            bool more = idle_jobs[i].fn(idle_jobs[i].arg, service_config.slice_budget_us);
+            int64_t elapsed = esp_timer_get_time() - start;
+            if (elapsed > service_config.slice_budget_us * 2) {
+                ESP_LOGW(TAG, "Idle job %s overran its budget: %lld us", idle_jobs[i].name, elapsed);
+            }
+            xSemaphoreGive(idle_lock);
+            pending |= more;
+        }
+    }
+}
+
+int db_service_run_savepoint(sqlite3 *db, db_service_fn fn, void *arg) {
+    int rc = sqlite3_exec(db, "SAVEPOINT db_service_write", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    int result = fn(arg);
+    if (result != SQLITE_OK) {
+        sqlite3_exec(db, "ROLLBACK TO db_service_write", NULL, NULL, NULL);
+    }
+    rc = sqlite3_exec(db, "RELEASE db_service_write", NULL, NULL, NULL);
+    return result != SQLITE_OK ? result : rc;
+}
+
+/**
+ * @brief Commit a group of writes together.
+ *
+ * On SQLITE_FULL, SQLITE_IOERR and similar errors SQLite rolls the whole
+ * transaction back by itself. The writes after that are not run, as they would
+ * each commit on their own, and every write of the group reports the error.
+ *
+ * @param group - Writes to the same connection, results are stored in them.
+ * @param count - Number of writes.
+ */
+static void db_service_commit_group(db_request_t *group, int count) {
+    sqlite3 *db = group[0].db;
+    int rc = sqlite3_exec(db, "BEGIN IMMEDIATE", NULL, NULL, NULL);
+    int ran = 0;
+    while (ran < count && rc == SQLITE_OK) {
+        int result = db_service_run_savepoint(db, group[ran].fn, group[ran].arg);
+        *group[ran++].result = result;
+        if (sqlite3_get_autocommit(db)) {
+            rc = result != SQLITE_OK ? result : SQLITE_ABORT;
+            ESP_LOGE(TAG, "Group of %d writes rolled back after %d: %s", count, ran, sqlite3_errstr(rc));
+        }
+    }
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+        if (rc != SQLITE_OK) {
+            ESP_LOGE(TAG, "Group commit of %d writes failed: %s", count, sqlite3_errmsg(db));
+            if (!sqlite3_get_autocommit(db)) {
+                sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+            }
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        // Nothing of the group is committed: writes that succeeded or did not run get the error
+        if (rc != SQLITE_OK && (i >= ran || *group[i].result == SQLITE_OK)) {
+            *group[i].result = rc;
+        }
+        if (*group[i].result != SQLITE_OK) {
+            service_stats.failed++;
+        }
+    }
+    service_stats.writes += count;
+    service_stats.commits++;
+    if ((uint32_t)count > service_stats.max_group) {
+        service_stats.max_group = count;
+    }
+}
+
+/**
+ * @brief Collect the writes that join a group within the window, commit them and release their callers.
+ */
+static void db_service_group_commit(const db_request_t *first) {
+    db_request_t group[DB_SERVICE_MAX_GROUP];
+    int count = 0;
+    group[count++] = *first;
+    int max = service_config.group_max < DB_SERVICE_MAX_GROUP ? (int)service_config.group_max : DB_SERVICE_MAX_GROUP;
+    int64_t deadline = esp_timer_get_time() + service_config.group_window_us;
+    const int64_t tick_us = portTICK_PERIOD_MS * 1000;
+    while (count < max) {
+        int64_t remaining = deadline - esp_timer_get_time();
+        TickType_t wait = remaining > 0 ? (TickType_t)((remaining + tick_us - 1) / tick_us) : 0;
+        db_request_t next;
+        // Only writes to the same connection join; anything else ends the group
+        if (xQueuePeek(request_queue, &next, wait) != pdTRUE || next.fn == NULL || next.db != first->db) {
+            break;
+        }
+        xQueueReceive(request_queue, &next, 0);
+        group[count++] = next;
+    }
+    db_service_commit_group(group, count);
+    for (int i = 0; i < count; i++) {
+        xSemaphoreGive(group[i].done);
+    }
+}
+
+static void db_service_task(void *arg) {
+    db_request_t req;
+    bool idle_done = false;
+    while (true) {
+        // Wait for the idle period after activity, then forever once idle work is done
+        TickType_t wait = idle_done ? portMAX_DELAY : pdMS_TO_TICKS(service_config.idle_ms);
+        if (xQueueReceive(request_queue, &req, wait) != pdTRUE) {
+            db_service_run_idle();
+            idle_done = uxQueueMessagesWaiting(request_queue) == 0;
+            continue;
+        }
+        idle_done = false;
+        if (req.fn == NULL) {
+            break;
+        }
+        if (req.db != NULL) {
+            db_service_group_commit(&req);
+            continue;
+        }
+        *req.result = req.fn(req.arg);
+        xSemaphoreGive(req.done);
+    }
+    if (service_stats.commits > 0) {
+        ESP_LOGI(TAG, "%d writes in %d commits, up to %d per commit", (int)service_stats.writes,
+                 (int)service_stats.commits, (int)service_stats.max_group);
+    }
+    ESP_LOGI(TAG, "Stopped");
+    xSemaphoreGive(req.done);
+    vTaskDelete(NULL);
+}
+
+esp_err_t db_service_start(const db_service_config_t *config) {
+    if (service_task != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    service_config = *config;
+    request_queue = xQueueCreate(config->queue_len, sizeof(db_request_t));
+    if (request_queue == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(db_service_task, "db_service", config->stack_size, NULL, config->priority,
+                    &service_task) != pdPASS) {
+        vQueueDelete(request_queue);
+        request_queue = NULL;
+        service_task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Started, idle after %d ms", (int)config->idle_ms);
+    return ESP_OK;
+}
+
+void db_service_stop(void) {
+    if (service_task == NULL) {
+        return;
+    }
+    StaticSemaphore_t done_buf;
+    db_request_t req = {
+        .fn = NULL,
+        .done = xSemaphoreCreateBinaryStatic(&done_buf),
+    };
+    xQueueSend(request_queue, &req, portMAX_DELAY);
+    xSemaphoreTake(req.done, portMAX_DELAY);
+    vQueueDelete(request_queue);
+    request_queue = NULL;
+    service_task = NULL;
+}
+
+bool db_service_running(void) {
+    return service_task != NULL;
+}
+
+int db_service_call(db_service_fn fn, void *arg) {
+    if (service_task == NULL || xTaskGetCurrentTaskHandle() == service_task) {
+        return fn(arg);
+    }
+    int result = 0;
+    StaticSemaphore_t done_buf;
+    db_request_t req = {
+        .fn = fn,
+        .arg = arg,
+        .result = &result,
+        .done = xSemaphoreCreateBinaryStatic(&done_buf),
+    };
+    xQueueSend(request_queue, &req, portMAX_DELAY);
+    xSemaphoreTake(req.done, portMAX_DELAY);
+    return result;
+}
+
+int db_service_write(sqlite3 *db, db_service_fn fn, void *arg) {
+    int result = 0;
+    StaticSemaphore_t done_buf;
+    db_request_t req = {
+        .fn = fn,
+        .arg = arg,
+        .db = db,
+        .result = &result,
+    };
+    if (service_task == NULL || xTaskGetCurrentTaskHandle() == service_task) {
+        db_service_commit_group(&req, 1);
+        return result;
+    }
+    req.done = xSemaphoreCreateBinaryStatic(&done_buf);
+    xQueueSend(request_queue, &req, portMAX_DELAY);
+    xSemaphoreTake(req.done, portMAX_DELAY);
+    return result;
+}
+
+void db_service_get_stats(db_service_stats_t *stats) {
+    *stats = service_stats;
+}
+
+esp_err_t db_service_add_idle_job(const char *name, db_idle_fn fn, void *arg) {
+    if (idle_lock == NULL) {
+        idle_lock = xSemaphoreCreateMutex();
+        if (idle_lock == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    xSemaphoreTake(idle_lock, portMAX_DELAY);
+    if (idle_job_count == DB_SERVICE_MAX_IDLE_JOBS) {
+        xSemaphoreGive(idle_lock);
+        return ESP_ERR_NO_MEM;
+    }
+    idle_jobs[idle_job_count++] = (db_idle_job_t) {
+        .name = name,
+        .fn = fn,
+        .arg = arg,
+    };
+    xSemaphoreGive(idle_lock);
+    ESP_LOGI(TAG, "Idle job %s registered", name);
+    return ESP_OK;
+}
+
+esp_err_t db_service_remove_idle_job(db_idle_fn fn, void *arg) {
+    if (idle_lock == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    xSemaphoreTake(idle_lock, portMAX_DELAY);
+    for (int i = 0; i < idle_job_count; i++) {
+        if (idle_jobs[i].fn == fn && idle_jobs[i].arg == arg) {
+            ESP_LOGI(TAG, "Idle job %s removed", idle_jobs[i].name);
+            memmove(&idle_jobs[i], &idle_jobs[i + 1], (idle_job_count - i - 1) * sizeof(db_idle_job_t));
+            idle_job_count--;
+            xSemaphoreGive(idle_lock);
+            return ESP_OK;
+        }
+    }
+    xSemaphoreGive(idle_lock);
+    return ESP_ERR_NOT_FOUND;
+}
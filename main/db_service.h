@@ -0,0 +1,196 @@
+/* Database service task
+ *
+ * A single task owns all database work. Other tasks hand it requests with
+ * `db_service_call`, which runs a function on the service task and waits for
+ * its result. When no request has arrived for `idle_ms`, the task runs the
+ * registered idle jobs (vacuum, checkpoints, ...) in small time-bounded
+ * slices, checking for new requests between slices.
+ *
+ * Writes submitted with `db_service_write` are group-committed: the writes
+ * to one connection that arrive within `group_window_us` of the first one run
+ * in a single transaction with a single sync, and every caller is released
+ * once that transaction has committed.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "sqlite3.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Function executed on the service task.
+ *
+ * @param arg - Argument given to `db_service_call`.
+ *
+ * @return Result returned to the caller of `db_service_call`, usually an SQLite result code.
+ */
+typedef int (*db_service_fn)(void *arg);
+
+/**
+ * @brief Idle job slice.
+ *
+ * @param arg - Argument given to `db_service_add_idle_job`.
+ * @param budget_us - Time the slice should not exceed, in microseconds.
+ *
+ * @return true if the job has more work pending and wants another slice.
+ */
+typedef bool (*db_idle_fn)(void *arg, int64_t budget_us);
+
+/**
+ * @brief Service configuration.
+ */
+typedef struct {
+    uint32_t idle_ms;           /*!< Time without requests after which idle jobs run */
+    int64_t slice_budget_us;    /*!< Time budget passed to every idle job slice */
+    uint32_t stack_size;        /*!< Stack size of the service task */
+    uint32_t priority;          /*!< Priority of the service task */
+    uint32_t queue_len;         /*!< Number of requests that can be queued */
+    int64_t group_window_us;    /*!< Time a write waits for others to share its commit, 0 to only take queued ones */
+    uint32_t group_max;         /*!< Maximum writes per group commit, at most DB_SERVICE_MAX_GROUP */
+} db_service_config_t;
+
+/** Default configuration, from Kconfig. */
+#define DB_SERVICE_CONFIG_DEFAULT() {                               \
+    .idle_ms = CONFIG_EXAMPLE_DB_SERVICE_IDLE_MS,                   \
+    .slice_budget_us = CONFIG_EXAMPLE_DB_SERVICE_SLICE_BUDGET_MS * 1000, \
+    .stack_size = CONFIG_EXAMPLE_DB_SERVICE_STACK_SIZE,             \
+    .priority = CONFIG_EXAMPLE_DB_SERVICE_PRIORITY,                 \
+    .queue_len = 8,                                                 \
+    .group_window_us = CONFIG_EXAMPLE_DB_SERVICE_GROUP_WINDOW_US,   \
+    .group_max = DB_SERVICE_MAX_GROUP,                              \
+}
+
+/** Maximum number of writes sharing one commit. */
+#define DB_SERVICE_MAX_GROUP 16
+
+/**
+ * @brief Group commit metrics.
+ */
+typedef struct {
+    uint32_t writes;            /*!< Writes run with `db_service_write` */
+    uint32_t commits;           /*!< Transactions they were committed in */
+    uint32_t max_group;         /*!< Most writes committed together */
+    uint32_t failed;            /*!< Writes rolled back, by their own error or with their group */
+} db_service_stats_t;
+
+/** Maximum number of idle jobs. */
+#define DB_SERVICE_MAX_IDLE_JOBS 8
+
+/**
+ * @brief Start the service task.
+ *
+ * @param config - Service configuration.
+ *
+ * @return
+ *  - ESP_OK on success.
+ *  - ESP_ERR_INVALID_STATE if the service is already running.
+ *  - ESP_ERR_NO_MEM if the task or its queue could not be created.
+ */
+esp_err_t db_service_start(const db_service_config_t *config);
+
+/**
+ * @brief Stop the service task after the queued requests have run.
+ *
+ * Idle jobs stay registered but do not run until the service is started again.
+ */
+void db_service_stop(void);
+
+/**
+ * @brief Check whether the service task is running.
+ */
+bool db_service_running(void);
+
+/**
+ * @brief Run a function on the service task and wait for it.
+ *
+ * If the service is not running, or the caller is the service task itself,
+ * the function is run directly in the calling task.
+ *
+ * @param fn - Function to run.
+ * @param arg - Argument passed to `fn`.
+ *
+ * @return The value returned by `fn`.
+ */
+int db_service_call(db_service_fn fn, void *arg);
+
+/**
+ * @brief Run a write on the service task as part of a group commit, and wait until it is durable.
+ *
+ * `fn` runs inside a transaction shared with the other writes to `db` queued
+ * within the group window, under its own savepoint: if it returns an error its
+ * changes are rolled back and the others still commit. It must not begin or
+ * end transactions itself. The call returns after COMMIT, i.e. after the
+ * journal sync of the whole group. If the service is not running, or the
+ * caller is the service task, the write runs directly in its own transaction.
+ *
+ * @param db - Connection the write uses.
+ * @param fn - Function issuing the statements.
+ * @param arg - Argument passed to `fn`.
+ *
+ * @return
+ *  - The error returned by `fn`, whose changes were rolled back.
+ *  - The error with which SQLite rolled back the whole group, e.g. SQLITE_FULL,
+ *    also for the writes of the group that had succeeded or had not run yet.
+ *  - Otherwise the result of BEGIN or COMMIT, SQLITE_OK (0) once committed.
+ */
+int db_service_write(sqlite3 *db, db_service_fn fn, void *arg);
+
+/**
+ * @brief Run a function under a savepoint, rolling its changes back if it fails.
+ *
+ * Used inside a transaction to isolate one write from the others sharing it.
+ *
+ * @param db - Connection `fn` uses.
+ * @param fn - Function issuing the statements.
+ * @param arg - Argument passed to `fn`.
+ *
+ * @return The error returned by `fn`, or the result of the savepoint statements.
+ */
+int db_service_run_savepoint(sqlite3 *db, db_service_fn fn, void *arg);
+
+/**
+ * @brief Read the group commit metrics.
+ */
+void db_service_get_stats(db_service_stats_t *stats);
+
+/**
+ * @brief Register a job run by the service task while idle.
+ *
+ * Jobs are run round-robin, one slice at a time, until none of them reports
+ * pending work. They are polled again after the next idle period. May be
+ * called from any task, also while the service is running.
+ *
+ * @param name - Job name, used for logging.
+ * @param fn - Job slice function.
+ * @param arg - Argument passed to `fn`.
+ *
+ * @return
+ *  - ESP_OK on success.
+ *  - ESP_ERR_NO_MEM if DB_SERVICE_MAX_IDLE_JOBS jobs are already registered.
+ */
+esp_err_t db_service_add_idle_job(const char *name, db_idle_fn fn, void *arg);
+
+/**
+ * @brief Unregister an idle job.
+ *
+ * May be called from any task. If a slice of the job is running, waits for it
+ * to return, so `arg` can be freed afterwards.
+ *
+ * @param fn - Job slice function given to `db_service_add_idle_job`.
+ * @param arg - Argument given to `db_service_add_idle_job`.
+ *
+ * @return
+ *  - ESP_OK on success.
+ *  - ESP_ERR_NOT_FOUND if no such job is registered.
+ */
+esp_err_t db_service_remove_idle_job(db_idle_fn fn, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
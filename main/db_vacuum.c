@@ -0,0 +1,116 @@
+/* Incremental auto-vacuum
+ *
+ * See db_vacuum.h. Each step is its own short transaction, so a request
+ * arriving on the service queue waits for at most one step.
+ */
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "db_service.h"
+#include "db_vacuum.h"
+
+static const char *TAG = "db_vacuum";
+
+#define DB_AUTO_VACUUM_INCREMENTAL 2
+
+typedef struct {
+    db_vacuum_config_t config;
+    bool active;        /* freelist reached min_free_pages, vacuum until empty */
+} db_vacuum_job_t;
+
+static int db_vacuum_pragma(sqlite3 *db, const char *sql, int *value) {
+    sqlite3_stmt *stmt;
+    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW) {
+        *value = sqlite3_column_int(stmt, 0);
+        rc = SQLITE_OK;
+    }
+    sqlite3_finalize(stmt);
+    return rc;
+}
+
+int db_vacuum_enable_incremental(sqlite3 *db, const char *name) {
+    int mode = 0, pages = 0;
+    int rc = db_vacuum_pragma(db, "PRAGMA auto_vacuum", &mode);
+    if (rc != SQLITE_OK || mode == DB_AUTO_VACUUM_INCREMENTAL) {
+        return rc;
+    }
+    rc = sqlite3_exec(db, "PRAGMA auto_vacuum=INCREMENTAL", NULL, NULL, NULL);
+    if (rc == SQLITE_OK) {
+        rc = db_vacuum_pragma(db, "PRAGMA page_count", &pages);
+    }
+    if (rc != SQLITE_OK || pages == 0) {
+        // Empty file: the mode applies when the first table is created
+        return rc;
+    }
+
+    // The mode of an existing database only changes when it is rebuilt
+    ESP_LOGW(TAG, "%s: converting to incremental auto-vacuum (%d pages)", name, pages);
+    int64_t start = esp_timer_get_time();
+    rc = sqlite3_exec(db, "VACUUM", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) {
+        ESP_LOGE(TAG, "%s: VACUUM failed: %s", name, sqlite3_errmsg(db));
+        return rc;
+    }
+    ESP_LOGI(TAG, "%s: converted in %lld us", name, esp_timer_get_time() - start);
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Idle job: release free pages until the freelist is empty or the budget is spent.
+ */
+static bool db_vacuum_idle(void *arg, int64_t budget_us) {
+    db_vacuum_job_t *job = arg;
+    const db_vacuum_config_t *config = &job->config;
+    const char *schema = config->schema ? config->schema : "main";
+    int free_pages = 0, released = 0;
+    char freelist_sql[48];
+    char sql[64];
+
+    snprintf(freelist_sql, sizeof(freelist_sql), "PRAGMA \"%s\".freelist_count", schema);
+    if (db_vacuum_pragma(config->db, freelist_sql, &free_pages) != SQLITE_OK) {
+        return false;
+    }
+    if (!job->active && free_pages < (int)config->min_free_pages) {
+        return false;
+    }
+    job->active = true;
+
+    snprintf(sql, sizeof(sql), "PRAGMA \"%s\".incremental_vacuum(%d)", schema, (int)config->pages_per_step);
+    int64_t start = esp_timer_get_time();
+    while (free_pages > 0 && esp_timer_get_time() - start < budget_us) {
+        if (sqlite3_exec(config->db, sql, NULL, NULL, NULL) != SQLITE_OK) {
+            ESP_LOGE(TAG, "%s: incremental vacuum failed: %s", config->name, sqlite3_errmsg(config->db));
+            job->active = false;
+            return false;
+        }
+        int before = free_pages;
+        if (db_vacuum_pragma(config->db, freelist_sql, &free_pages) != SQLITE_OK) {
+            break;
+        }
+        released += before - free_pages;
+    }
+    ESP_LOGD(TAG, "%s: released %d pages in %lld us, %d free", config->name, released,
+             esp_timer_get_time() - start, free_pages);
+    job->active = free_pages > 0;
+    return job->active;
+}
+
+esp_err_t db_vacuum_schedule(const db_vacuum_config_t *config) {
+    db_vacuum_job_t *job = calloc(1, sizeof(db_vacuum_job_t));
+    if (job == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    job->config = *config;
+    esp_err_t ret = db_service_add_idle_job(config->name, db_vacuum_idle, job);
+    if (ret != ESP_OK) {
+        free(job);
+    }
+    return ret;
+}
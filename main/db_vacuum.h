@@ -0,0 +1,60 @@
+/* Incremental auto-vacuum
+ *
+ * Databases use `auto_vacuum=INCREMENTAL`, so pages freed by deletes stay on
+ * the freelist until `PRAGMA incremental_vacuum(N)` moves them to the end of
+ * the file and truncates it. The scheduler runs that in small slices from the
+ * database service's idle time instead of a blocking full `VACUUM`.
+ */
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "sqlite3.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Incremental vacuum schedule of one database.
+ */
+typedef struct {
+    sqlite3 *db;                /*!< Database connection, used from the service task only */
+    const char *schema;         /*!< Attached database to vacuum, NULL for "main" */
+    const char *name;           /*!< Database name, used for logging */
+    uint32_t min_free_pages;    /*!< Start vacuuming once the freelist reaches this many pages */
+    uint32_t pages_per_step;    /*!< Pages released by one `incremental_vacuum` transaction */
+} db_vacuum_config_t;
+
+/**
+ * @brief Switch a database to incremental auto-vacuum.
+ *
+ * New databases get the mode before their first table is created. A database
+ * that already has tables in another mode is converted with a one-time full
+ * `VACUUM`. Must be called outside of a transaction.
+ *
+ * @param db - A pointer to the SQLite database connection.
+ * @param name - Database name, used for logging.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - An SQLite error code on failure.
+ */
+int db_vacuum_enable_incremental(sqlite3 *db, const char *name);
+
+/**
+ * @brief Register an incremental vacuum idle job for a database.
+ *
+ * The configuration is copied.
+ *
+ * @param config - Vacuum schedule.
+ *
+ * @return
+ *  - ESP_OK on success.
+ *  - ESP_ERR_NO_MEM if the job could not be registered.
+ */
+esp_err_t db_vacuum_schedule(const db_vacuum_config_t *config);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,700 @@
+/* Buffering VFS layer
+ *
+ * See db_vfs.h. Every file opened through the shim is a `db_vfs_file_t`
+ * followed by the file structure of the wrapped VFS. For main database and
+ * journal files a mutex serializes the I/O of the connection with the
+ * read-ahead task and with flushes started from another file. The read-ahead
+ * task receives prefetch requests through a queue. A file has at most one
+ * request outstanding; `generation` is bumped whenever the buffer is
+ * discarded so a prefetch started before that is dropped.
+ *
+ * The write buffer of a file holds one extent of contiguous data not yet
+ * written to the wrapped file. A rollback journal is linked to the database
+ * file of its connection, found by name on the list of open database files,
+ * and flushing the database flushes the journal first, so the database never
+ * gets ahead of its journal. A failed flush keeps the data and records the
+ * error, which the next write, sync or unlock of that file returns until a
+ * flush succeeds.
+ */
+#include <stdbool.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "db_vfs.h"
+
+static const char *TAG = "db_vfs";
+
+typedef struct db_vfs_file {
+    sqlite3_file base;              /* must be first */
+    sqlite3_file *real;             /* file of the wrapped VFS, right after this struct */
+    SemaphoreHandle_t lock;         /* NULL for pass-through files */
+    bool main_db;
+    bool main_journal;
+    bool readahead;
+    sqlite3_int64 next_offset;      /* offset following the last read */
+    int amount;                     /* size of the last read */
+    uint32_t sequential;            /* consecutive sequential reads */
+    uint8_t *buf;                   /* read-ahead buffer */
+    int buf_size;
+    sqlite3_int64 buf_offset;       /* file offset of buf[0] */
+    int buf_len;                    /* valid bytes in buf */
+    bool pending;                   /* a prefetch request is queued or running */
+    uint32_t generation;
+    uint8_t *wbuf;                  /* write buffer, NULL if writes go through */
+    sqlite3_int64 wbuf_offset;      /* file offset of wbuf[0] */
+    int wbuf_len;                   /* buffered bytes */
+    int error;                      /* result of the last failed flush, SQLITE_OK once one succeeds */
+    const char *name;
+    int lock_level;                 /* SQLITE_LOCK_* held by the connection */
+    struct db_vfs_file *journal;    /* open rollback journal of a database file */
+    struct db_vfs_file *owner;      /* database file of a rollback journal */
+    struct db_vfs_file *next;       /* list of open database files */
+} db_vfs_file_t;
+
+typedef struct {
+    db_vfs_file_t *file;            /* NULL asks the task to stop */
+    sqlite3_int64 offset;
+    uint32_t generation;
+    SemaphoreHandle_t done;
+} db_vfs_prefetch_t;
+
+static struct {
+    sqlite3_vfs vfs;
+    sqlite3_vfs *real;
+    db_vfs_config_t config;
+    QueueHandle_t queue;
+    TaskHandle_t task;
+    db_vfs_stats_t stats;
+    SemaphoreHandle_t files_lock;
+    db_vfs_file_t *files;           /* open main database files */
+    sqlite3_io_methods io_methods[3];   /* one per io_methods version of the wrapped files */
+} s_vfs;
+
+// Guards s_vfs.stats, updated under the lock of whichever file is accessed
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void db_vfs_lock(db_vfs_file_t *file) {
+    if (file->lock) {
+        xSemaphoreTake(file->lock, portMAX_DELAY);
+    }
+}
+
+static void db_vfs_unlock(db_vfs_file_t *file) {
+    if (file->lock) {
+        xSemaphoreGive(file->lock);
+    }
+}
+
+/**
+ * @brief Discard the read-ahead buffer and any prefetch in flight. Called with the lock held.
+ */
+static void db_vfs_invalidate(db_vfs_file_t *file) {
+    file->buf_len = 0;
+    file->generation++;
+}
+
+/**
+ * @brief Write the buffered extent to the wrapped file, after the journal of a database. Called with the lock held.
+ *
+ * @return SQLITE_OK, or the write error. The data stays buffered on error.
+ */
+static int db_vfs_flush(db_vfs_file_t *file) {
+    if (file->journal) {
+        db_vfs_lock(file->journal);
+        int rc = db_vfs_flush(file->journal);
+        db_vfs_unlock(file->journal);
+        if (rc != SQLITE_OK) {
+            return rc;
+        }
+    }
+    if (file->wbuf_len == 0) {
+        return SQLITE_OK;
+    }
+    int rc = file->real->pMethods->xWrite(file->real, file->wbuf, file->wbuf_len, file->wbuf_offset);
+    portENTER_CRITICAL(&s_stats_lock);
+    s_vfs.stats.flushes++;
+    if (rc == SQLITE_OK) {
+        s_vfs.stats.flushed_bytes += file->wbuf_len;
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+    if (rc != SQLITE_OK) {
+        ESP_LOGE(TAG, "Flush of %d bytes to %s failed (%d)", file->wbuf_len, file->name ? file->name : "temp", rc);
+        file->error = rc;
+        return rc;
+    }
+    file->error = SQLITE_OK;
+    file->wbuf_len = 0;
+    db_vfs_invalidate(file);
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Queue a prefetch of the pages from `offset`. Called with the lock held.
+ */
+static void db_vfs_queue_prefetch(db_vfs_file_t *file, sqlite3_int64 offset, int page_size) {
+    int size = (int)s_vfs.config.readahead_pages * page_size;
+    if (file->buf_size != size) {
+        uint8_t *buf = sqlite3_realloc(file->buf, size);
+        if (buf == NULL) {
+            return;
+        }
+        file->buf = buf;
+        file->buf_size = size;
+        file->buf_len = 0;
+    }
+    db_vfs_prefetch_t req = {
+        .file = file,
+        .offset = offset,
+        .generation = file->generation,
+    };
+    file->pending = true;
+    if (xQueueSend(s_vfs.queue, &req, 0) != pdTRUE) {
+        file->pending = false;
+    }
+}
+
+/**
+ * @brief Fill the read-ahead buffer from `offset`, up to the end of the file. Called with the lock held.
+ */
+static void db_vfs_prefetch(db_vfs_file_t *file, sqlite3_int64 offset) {
+    sqlite3_int64 size;
+    if (file->real->pMethods->xFileSize(file->real, &size) != SQLITE_OK || size <= offset) {
+        return;
+    }
+    int len = size - offset < file->buf_size ? (int)(size - offset) : file->buf_size;
+    if (file->real->pMethods->xRead(file->real, file->buf, len, offset) != SQLITE_OK) {
+        file->buf_len = 0;
+        return;
+    }
+    file->buf_offset = offset;
+    file->buf_len = len;
+    portENTER_CRITICAL(&s_stats_lock);
+    s_vfs.stats.prefetches++;
+    s_vfs.stats.prefetched_bytes += len;
+    portEXIT_CRITICAL(&s_stats_lock);
+}
+
+static void db_vfs_readahead_task(void *arg) {
+    db_vfs_prefetch_t req;
+    while (xQueueReceive(s_vfs.queue, &req, portMAX_DELAY) == pdTRUE && req.file != NULL) {
+        db_vfs_file_t *file = req.file;
+        xSemaphoreTake(file->lock, portMAX_DELAY);
+        if (req.generation == file->generation) {
+            db_vfs_prefetch(file, req.offset);
+        }
+        file->pending = false;
+        xSemaphoreGive(file->lock);
+    }
+    xSemaphoreGive(req.done);
+    vTaskDelete(NULL);
+}
+
+static int db_vfs_close(sqlite3_file *f) {
+    db_vfs_file_t *file = (db_vfs_file_t *)f;
+    int rc = SQLITE_OK;
+    xSemaphoreTake(s_vfs.files_lock, portMAX_DELAY);
+    db_vfs_file_t **link = &s_vfs.files;
+    while (*link && *link != file) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = file->next;
+    }
+    if (file->journal) {
+        file->journal->owner = NULL;
+    }
+    if (file->owner) {
+        db_vfs_lock(file->owner);
+        file->owner->journal = NULL;
+        db_vfs_unlock(file->owner);
+    }
+    xSemaphoreGive(s_vfs.files_lock);
+    if (file->wbuf) {
+        db_vfs_lock(file);
+        rc = db_vfs_flush(file);
+        db_vfs_unlock(file);
+        sqlite3_free(file->wbuf);
+        file->wbuf = NULL;
+    }
+    if (file->lock) {
+        // The request queue may still point to this file
+        bool pending = true;
+        while (pending) {
+            xSemaphoreTake(file->lock, portMAX_DELAY);
+            db_vfs_invalidate(file);
+            pending = file->pending;
+            xSemaphoreGive(file->lock);
+            if (pending) {
+                vTaskDelay(1);
+            }
+        }
+        vSemaphoreDelete(file->lock);
+        file->lock = NULL;
+    }
+    sqlite3_free(file->buf);
+    file->buf = NULL;
+    int close_rc = file->real->pMethods->xClose(file->real);
+    return rc != SQLITE_OK ? rc : close_rc;
+}
+
+static int db_vfs_read(sqlite3_file *f, void *out, int amount, sqlite3_int64 offset) {
+    db_vfs_file_t *file = (db_vfs_file_t *)f;
+    if (file->lock == NULL) {
+        return file->real->pMethods->xRead(file->real, out, amount, offset);
+    }
+    int rc = SQLITE_OK;
+    xSemaphoreTake(file->lock, portMAX_DELAY);
+    // Buffered writes first go to the file, so the read sees them
+    if (file->wbuf_len > 0 && offset < file->wbuf_offset + file->wbuf_len && offset + amount > file->wbuf_offset) {
+        rc = db_vfs_flush(file);
+    }
+    if (file->main_db) {
+        portENTER_CRITICAL(&s_stats_lock);
+        s_vfs.stats.reads++;
+        portEXIT_CRITICAL(&s_stats_lock);
+    }
+    if (rc != SQLITE_OK || !file->readahead) {
+        if (rc == SQLITE_OK) {
+            rc = file->real->pMethods->xRead(file->real, out, amount, offset);
+        }
+        xSemaphoreGive(file->lock);
+        return rc;
+    }
+    if (file->buf_len > 0 && offset >= file->buf_offset && offset + amount <= file->buf_offset + file->buf_len) {
+        memcpy(out, file->buf + (offset - file->buf_offset), amount);
+        portENTER_CRITICAL(&s_stats_lock);
+        s_vfs.stats.readahead_hits++;
+        portEXIT_CRITICAL(&s_stats_lock);
+        rc = SQLITE_OK;
+    } else {
+        rc = file->real->pMethods->xRead(file->real, out, amount, offset);
+    }
+
+    if (offset == file->next_offset && amount == file->amount) {
+        file->sequential++;
+    } else {
+        file->sequential = 0;
+    }
+    file->next_offset = offset + amount;
+    file->amount = amount;
+    // Read the following pages once the scan leaves the buffer
+    sqlite3_int64 next = offset + amount;
+    bool buffered = file->buf_len > 0 && next >= file->buf_offset && next < file->buf_offset + file->buf_len;
+    if (rc == SQLITE_OK && file->sequential >= s_vfs.config.sequential_reads && !buffered && !file->pending) {
+        db_vfs_queue_prefetch(file, next, amount);
+    }
+    xSemaphoreGive(file->lock);
+    return rc;
+}
+
+static int db_vfs_write(sqlite3_file *f, const void *data, int amount, sqlite3_int64 offset) {
+    db_vfs_file_t *file = (db_vfs_file_t *)f;
+    int rc = SQLITE_OK;
+    db_vfs_lock(file);
+    db_vfs_invalidate(file);
+    if (file->main_db || file->main_journal) {
+        portENTER_CRITICAL(&s_stats_lock);
+        s_vfs.stats.writes++;
+        portEXIT_CRITICAL(&s_stats_lock);
+    }
+    if (file->wbuf == NULL) {
+        rc = file->real->pMethods->xWrite(file->real, data, amount, offset);
+        db_vfs_unlock(file);
+        return rc;
+    }
+    // Data of a failed flush goes first, or the write fails with the same error
+    if (file->error != SQLITE_OK) {
+        rc = db_vfs_flush(file);
+        if (rc != SQLITE_OK) {
+            db_vfs_unlock(file);
+            return rc;
+        }
+    }
+    // Merge into the extent if the write overlaps or extends it and still fits
+    sqlite3_int64 end = offset + amount;
+    sqlite3_int64 extent_end = file->wbuf_offset + file->wbuf_len;
+    bool merge = file->wbuf_len > 0 && offset >= file->wbuf_offset && offset <= extent_end &&
+                 (end > extent_end ? end : extent_end) - file->wbuf_offset <= (sqlite3_int64)s_vfs.config.write_buffer_size;
+    if (!merge) {
+        rc = db_vfs_flush(file);
+        if (rc == SQLITE_OK && amount > (int)s_vfs.config.write_buffer_size) {
+            rc = file->real->pMethods->xWrite(file->real, data, amount, offset);
+        } else if (rc == SQLITE_OK) {
+            file->wbuf_offset = offset;
+            merge = true;
+        }
+    }
+    if (merge) {
+        memcpy(file->wbuf + (offset - file->wbuf_offset), data, amount);
+        if (end - file->wbuf_offset > file->wbuf_len) {
+            file->wbuf_len = (int)(end - file->wbuf_offset);
+        }
+    }
+    db_vfs_unlock(file);
+    return rc;
+}
+
+static int db_vfs_truncate(sqlite3_file *f, sqlite3_int64 size) {
+    db_vfs_file_t *file = (db_vfs_file_t *)f;
+    db_vfs_lock(file);
+    db_vfs_invalidate(file);
+    if (file->wbuf_len > 0 && file->wbuf_offset + file->wbuf_len > size) {
+        file->wbuf_len = size > file->wbuf_offset ? (int)(size - file->wbuf_offset) : 0;
+    }
+    int rc = file->real->pMethods->xTruncate(file->real, size);
+    db_vfs_unlock(file);
+    return rc;
+}
+
+static int db_vfs_sync(sqlite3_file *f, int flags) {
+    db_vfs_file_t *file = (db_vfs_file_t *)f;
+    db_vfs_lock(file);
+    int rc = db_vfs_flush(file);
+    if (rc == SQLITE_OK) {
+        rc = file->real->pMethods->xSync(file->real, flags);
+    }
+    db_vfs_unlock(file);
+    return rc;
+}
+
+static int db_vfs_file_size(sqlite3_file *f, sqlite3_int64 *size) {
+    db_vfs_file_t *file = (db_vfs_file_t *)f;
+    db_vfs_lock(file);
+    int rc = file->real->pMethods->xFileSize(file->real, size);
+    if (rc == SQLITE_OK && file->wbuf_len > 0 && file->wbuf_offset + file->wbuf_len > *size) {
+        *size = file->wbuf_offset + file->wbuf_len;
+    }
+    db_vfs_unlock(file);
+    return rc;
+}
+
+static int db_vfs_file_lock(sqlite3_file *f, int level) {
+    db_vfs_file_t *file = (db_vfs_file_t *)f;
+    db_vfs_lock(file);
+    int rc = file->real->pMethods->xLock(file->real, level);
+    if (rc == SQLITE_OK) {
+        file->lock_level = level;
+    }
+    db_vfs_unlock(file);
+    return rc;
+}
+
+static int db_vfs_file_unlock(sqlite3_file *f, int level) {
+    db_vfs_file_t *file = (db_vfs_file_t *)f;
+    db_vfs_lock(file);
+    // The transaction is over: nothing of this connection stays buffered once others may read
+    int rc = db_vfs_flush(file);
+    if (level == SQLITE_LOCK_NONE) {
+        // Another connection may change the file from now on
+        db_vfs_invalidate(file);
+    }
+    int unlock_rc = file->real->pMethods->xUnlock(file->real, level);
+    if (unlock_rc == SQLITE_OK) {
+        file->lock_level = level;
+    }
+    db_vfs_unlock(file);
+    return rc != SQLITE_OK ? rc : unlock_rc;
+}
+
+static int db_vfs_check_reserved_lock(sqlite3_file *f, int *out) {
+    db_vfs_file_t *file = (db_vfs_file_t *)f;
+    db_vfs_lock(file);
+    int rc = file->real->pMethods->xCheckReservedLock(file->real, out);
+    db_vfs_unlock(file);
+    return rc;
+}
+
+static int db_vfs_file_control(sqlite3_file *f, int op, void *arg) {
+    db_vfs_file_t *file = (db_vfs_file_t *)f;
+    db_vfs_lock(file);
+    // Sent instead of xSync with synchronous=OFF: still write at the same point
+    int rc = op == SQLITE_FCNTL_SYNC_OMITTED ? db_vfs_flush(file) : SQLITE_OK;
+    if (rc == SQLITE_OK) {
+        rc = file->real->pMethods->xFileControl(file->real, op, arg);
+    }
+    db_vfs_unlock(file);
+    return rc;
+}
+
+static int db_vfs_sector_size(sqlite3_file *f) {
+    db_vfs_file_t *file = (db_vfs_file_t *)f;
+    return file->real->pMethods->xSectorSize(file->real);
+}
+
+static int db_vfs_device_characteristics(sqlite3_file *f) {
+    db_vfs_file_t *file = (db_vfs_file_t *)f;
+    return file->real->pMethods->xDeviceCharacteristics(file->real);
+}
+
+static int db_vfs_shm_map(sqlite3_file *f, int region, int size, int extend, void volatile **out) {
+    db_vfs_file_t *file = (db_vfs_file_t *)f;
+    return file->real->pMethods->xShmMap(file->real, region, size, extend, out);
+}
+
+static int db_vfs_shm_lock(sqlite3_file *f, int offset, int n, int flags) {
+    db_vfs_file_t *file = (db_vfs_file_t *)f;
+    return file->real->pMethods->xShmLock(file->real, offset, n, flags);
+}
+
+static void db_vfs_shm_barrier(sqlite3_file *f) {
+    db_vfs_file_t *file = (db_vfs_file_t *)f;
+    file->real->pMethods->xShmBarrier(file->real);
+}
+
+static int db_vfs_shm_unmap(sqlite3_file *f, int delete_flag) {
+    db_vfs_file_t *file = (db_vfs_file_t *)f;
+    return file->real->pMethods->xShmUnmap(file->real, delete_flag);
+}
+
+static int db_vfs_fetch(sqlite3_file *f, sqlite3_int64 offset, int amount, void **out) {
+    db_vfs_file_t *file = (db_vfs_file_t *)f;
+    return file->real->pMethods->xFetch(file->real, offset, amount, out);
+}
+
+static int db_vfs_unfetch(sqlite3_file *f, sqlite3_int64 offset, void *p) {
+    db_vfs_file_t *file = (db_vfs_file_t *)f;
+    return file->real->pMethods->xUnfetch(file->real, offset, p);
+}
+
+static const sqlite3_io_methods db_vfs_io_methods = {
+    .iVersion = 3,
+    .xClose = db_vfs_close,
+    .xRead = db_vfs_read,
+    .xWrite = db_vfs_write,
+    .xTruncate = db_vfs_truncate,
+    .xSync = db_vfs_sync,
+    .xFileSize = db_vfs_file_size,
+    .xLock = db_vfs_file_lock,
+    .xUnlock = db_vfs_file_unlock,
+    .xCheckReservedLock = db_vfs_check_reserved_lock,
+    .xFileControl = db_vfs_file_control,
+    .xSectorSize = db_vfs_sector_size,
+    .xDeviceCharacteristics = db_vfs_device_characteristics,
+    .xShmMap = db_vfs_shm_map,
+    .xShmLock = db_vfs_shm_lock,
+    .xShmBarrier = db_vfs_shm_barrier,
+    .xShmUnmap = db_vfs_shm_unmap,
+    .xFetch = db_vfs_fetch,
+    .xUnfetch = db_vfs_unfetch,
+};
+
+/**
+ * @brief Link a rollback journal to its database file. Called with `files_lock` held.
+ *
+ * The journal is "<database>-journal", opened by the connection holding at
+ * least a RESERVED lock on the database.
+ */
+static void db_vfs_link_journal(db_vfs_file_t *journal, const char *name) {
+    size_t len = strlen(name);
+    for (db_vfs_file_t *db = s_vfs.files; db; db = db->next) {
+        size_t db_len = db->name ? strlen(db->name) : 0;
+        if (db->journal == NULL && db->lock_level >= SQLITE_LOCK_RESERVED && db_len > 0 &&
+            len == db_len + strlen("-journal") && strncmp(name, db->name, db_len) == 0 &&
+            strcmp(name + db_len, "-journal") == 0) {
+            db_vfs_lock(db);
+            db->journal = journal;
+            db_vfs_unlock(db);
+            journal->owner = db;
+            return;
+        }
+    }
+}
+
+static int db_vfs_open(sqlite3_vfs *vfs, const char *name, sqlite3_file *f, int flags, int *out_flags) {
+    db_vfs_file_t *file = (db_vfs_file_t *)f;
+    memset(file, 0, sizeof(*file));
+    file->real = (sqlite3_file *)(file + 1);
+    int rc = s_vfs.real->xOpen(s_vfs.real, name, file->real, flags, out_flags);
+    if (file->real->pMethods == NULL) {
+        file->base.pMethods = NULL;
+        return rc;
+    }
+    // Expose the same io_methods version as the wrapped file, e.g. no shared memory if it has none
+    int version = file->real->pMethods->iVersion;
+    file->base.pMethods = &s_vfs.io_methods[(version < 1 ? 1 : version > 3 ? 3 : version) - 1];
+    if (rc != SQLITE_OK) {
+        // SQLite still calls xClose, which closes the wrapped file
+        return rc;
+    }
+
+    file->name = name;
+    file->main_db = (flags & SQLITE_OPEN_MAIN_DB) != 0;
+    file->main_journal = (flags & SQLITE_OPEN_MAIN_JOURNAL) != 0;
+    bool readahead = file->main_db && s_vfs.task != NULL;
+    bool buffered = (file->main_db || file->main_journal) && s_vfs.config.write_buffer_size > 0;
+    if (readahead || buffered) {
+        file->lock = xSemaphoreCreateMutex();
+        if (file->lock == NULL) {
+            ESP_LOGW(TAG, "No buffering for %s", name);
+            return SQLITE_OK;
+        }
+    }
+    file->readahead = readahead;
+    if (buffered) {
+        file->wbuf = sqlite3_malloc(s_vfs.config.write_buffer_size);
+    }
+    xSemaphoreTake(s_vfs.files_lock, portMAX_DELAY);
+    if (file->main_db) {
+        file->next = s_vfs.files;
+        s_vfs.files = file;
+    } else if (file->wbuf && name) {
+        db_vfs_link_journal(file, name);
+    }
+    xSemaphoreGive(s_vfs.files_lock);
+    return SQLITE_OK;
+}
+
+static int db_vfs_delete(sqlite3_vfs *vfs, const char *name, int sync_dir) {
+    return s_vfs.real->xDelete(s_vfs.real, name, sync_dir);
+}
+
+static int db_vfs_access(sqlite3_vfs *vfs, const char *name, int flags, int *out) {
+    return s_vfs.real->xAccess(s_vfs.real, name, flags, out);
+}
+
+static int db_vfs_full_pathname(sqlite3_vfs *vfs, const char *name, int size, char *out) {
+    return s_vfs.real->xFullPathname(s_vfs.real, name, size, out);
+}
+
+static void *db_vfs_dl_open(sqlite3_vfs *vfs, const char *name) {
+    return s_vfs.real->xDlOpen(s_vfs.real, name);
+}
+
+static void db_vfs_dl_error(sqlite3_vfs *vfs, int size, char *out) {
+    s_vfs.real->xDlError(s_vfs.real, size, out);
+}
+
+static void (*db_vfs_dl_sym(sqlite3_vfs *vfs, void *handle, const char *symbol))(void) {
+    return s_vfs.real->xDlSym(s_vfs.real, handle, symbol);
+}
+
+static void db_vfs_dl_close(sqlite3_vfs *vfs, void *handle) {
+    s_vfs.real->xDlClose(s_vfs.real, handle);
+}
+
+static int db_vfs_randomness(sqlite3_vfs *vfs, int size, char *out) {
+    return s_vfs.real->xRandomness(s_vfs.real, size, out);
+}
+
+static int db_vfs_sleep(sqlite3_vfs *vfs, int us) {
+    return s_vfs.real->xSleep(s_vfs.real, us);
+}
+
+static int db_vfs_current_time(sqlite3_vfs *vfs, double *out) {
+    return s_vfs.real->xCurrentTime(s_vfs.real, out);
+}
+
+static int db_vfs_get_last_error(sqlite3_vfs *vfs, int size, char *out) {
+    return s_vfs.real->xGetLastError ? s_vfs.real->xGetLastError(s_vfs.real, size, out) : 0;
+}
+
+static int db_vfs_current_time_int64(sqlite3_vfs *vfs, sqlite3_int64 *out) {
+    return s_vfs.real->xCurrentTimeInt64(s_vfs.real, out);
+}
+
+int db_vfs_register(const db_vfs_config_t *config) {
+    if (s_vfs.real != NULL) {
+        return SQLITE_MISUSE;
+    }
+    sqlite3_vfs *real = sqlite3_vfs_find(NULL);
+    if (real == NULL) {
+        return SQLITE_ERROR;
+    }
+    s_vfs.config = *config;
+    portENTER_CRITICAL(&s_stats_lock);
+    memset(&s_vfs.stats, 0, sizeof(s_vfs.stats));
+    portEXIT_CRITICAL(&s_stats_lock);
+    for (int i = 0; i < 3; i++) {
+        s_vfs.io_methods[i] = db_vfs_io_methods;
+        s_vfs.io_methods[i].iVersion = i + 1;
+    }
+    s_vfs.vfs = (sqlite3_vfs) {
+        .iVersion = real->iVersion < 2 ? 1 : 2,
+        .szOsFile = sizeof(db_vfs_file_t) + real->szOsFile,
+        .mxPathname = real->mxPathname,
+        .zName = DB_VFS_NAME,
+        .xOpen = db_vfs_open,
+        .xDelete = db_vfs_delete,
+        .xAccess = db_vfs_access,
+        .xFullPathname = db_vfs_full_pathname,
+        .xDlOpen = db_vfs_dl_open,
+        .xDlError = db_vfs_dl_error,
+        .xDlSym = db_vfs_dl_sym,
+        .xDlClose = db_vfs_dl_close,
+        .xRandomness = db_vfs_randomness,
+        .xSleep = db_vfs_sleep,
+        .xCurrentTime = db_vfs_current_time,
+        .xGetLastError = db_vfs_get_last_error,
+        .xCurrentTimeInt64 = db_vfs_current_time_int64,
+    };
+
+    if (s_vfs.files_lock == NULL) {
+        s_vfs.files_lock = xSemaphoreCreateMutex();
+        if (s_vfs.files_lock == NULL) {
+            return SQLITE_NOMEM;
+        }
+    }
+    if (config->readahead_pages > 0) {
+        s_vfs.queue = xQueueCreate(4, sizeof(db_vfs_prefetch_t));
+        if (s_vfs.queue == NULL || xTaskCreate(db_vfs_readahead_task, "db_vfs", config->stack_size, NULL,
+                                               config->priority, &s_vfs.task) != pdPASS) {
+            if (s_vfs.queue) {
+                vQueueDelete(s_vfs.queue);
+            }
+            s_vfs.queue = NULL;
+            s_vfs.task = NULL;
+            return SQLITE_NOMEM;
+        }
+    }
+    s_vfs.real = real;
+    int rc = sqlite3_vfs_register(&s_vfs.vfs, 1);
+    if (rc != SQLITE_OK) {
+        db_vfs_unregister();
+        return rc;
+    }
+    ESP_LOGI(TAG, "Wrapping VFS %s, read-ahead %d pages, write buffer %d bytes", real->zName,
+             (int)config->readahead_pages, (int)config->write_buffer_size);
+    return SQLITE_OK;
+}
+
+void db_vfs_unregister(void) {
+    if (s_vfs.real == NULL) {
+        return;
+    }
+    sqlite3_vfs_unregister(&s_vfs.vfs);
+    sqlite3_vfs_register(s_vfs.real, 1);
+    if (s_vfs.task != NULL) {
+        StaticSemaphore_t done_buf;
+        db_vfs_prefetch_t req = {
+            .file = NULL,
+            .done = xSemaphoreCreateBinaryStatic(&done_buf),
+        };
+        xQueueSend(s_vfs.queue, &req, portMAX_DELAY);
+        xSemaphoreTake(req.done, portMAX_DELAY);
+        vQueueDelete(s_vfs.queue);
+        s_vfs.queue = NULL;
+        s_vfs.task = NULL;
+    }
+    s_vfs.real = NULL;
+}
+
+void db_vfs_get_stats(db_vfs_stats_t *stats) {
+    portENTER_CRITICAL(&s_stats_lock);
+    *stats = s_vfs.stats;
+    portEXIT_CRITICAL(&s_stats_lock);
+}
+
+void db_vfs_log_stats(void) {
+    db_vfs_stats_t stats;
+    db_vfs_get_stats(&stats);
+    ESP_LOGI(TAG, "%d reads, %d from read-ahead (%d%%), %d prefetches of %llu bytes", (int)stats.reads,
+             (int)stats.readahead_hits, stats.reads ? (int)(100ULL * stats.readahead_hits / stats.reads) : 0,
+             (int)stats.prefetches, (unsigned long long)stats.prefetched_bytes);
+    if (s_vfs.config.write_buffer_size > 0) {
+        ESP_LOGI(TAG, "%d database and journal writes, %d flushes of %llu bytes", (int)stats.writes, (int)stats.flushes,
+                 (unsigned long long)stats.flushed_bytes);
+    }
+}
@@ -0,0 +1,110 @@
+/* Buffering VFS layer
+ *
+ * A VFS shim registered as the default VFS in front of the platform VFS, so
+ * every database opened afterwards goes through it. Files other than main
+ * database files are passed through unchanged.
+ *
+ * Read-ahead: once a connection reads consecutive pages of a database file,
+ * a background task reads the next `readahead_pages` pages into a buffer with
+ * one flash access, while SQLite decodes the rows of the current page. Reads
+ * that fall into the buffer are served from RAM. Writes, truncation and
+ * releasing the file lock discard the buffer, so it never returns data older
+ * than the file.
+ *
+ * Write coalescing: writes to a database or rollback journal file that
+ * continue or overlap the previous ones are collected in a per-file buffer
+ * and written with one call when the file is synced, when the database lock
+ * is released, when a non-adjacent write arrives or the buffer is full. Data
+ * is on flash whenever SQLite's xSync returns, as without the buffer, so the
+ * durability guarantees of the journal mode and `synchronous` setting hold.
+ * The journal of a connection is always written before its database. If a
+ * buffered write fails, the data is kept and the error is returned by the
+ * next write, sync or unlock of the same file. WAL files are not buffered.
+ *
+ *     sqlite3_initialize();
+ *     db_vfs_config_t config = DB_VFS_CONFIG_DEFAULT();
+ *     db_vfs_register(&config);
+ *     sqlite3_open("/spiffs/test1.db", &db);
+ */
+#pragma once
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "sqlite3.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Name under which the shim is registered. */
+#define DB_VFS_NAME "db_vfs"
+
+/**
+ * @brief VFS configuration.
+ */
+typedef struct {
+    uint32_t readahead_pages;       /*!< Pages read ahead during sequential reads, 0 disables read-ahead */
+    uint32_t sequential_reads;      /*!< Consecutive page reads that start read-ahead */
+    uint32_t write_buffer_size;     /*!< Bytes of adjacent writes merged per file, 0 disables write coalescing */
+    uint32_t priority;              /*!< Priority of the read-ahead task */
+    uint32_t stack_size;            /*!< Stack size of the read-ahead task */
+} db_vfs_config_t;
+
+/** Default configuration, from Kconfig. */
+#define DB_VFS_CONFIG_DEFAULT() {                                   \
+    .readahead_pages = CONFIG_EXAMPLE_DB_VFS_READAHEAD_PAGES,       \
+    .sequential_reads = 2,                                          \
+    .write_buffer_size = CONFIG_EXAMPLE_DB_VFS_WRITE_BUFFER_KB * 1024, \
+    .priority = CONFIG_EXAMPLE_DB_SERVICE_PRIORITY,                 \
+    .stack_size = 3072,                                             \
+}
+
+/**
+ * @brief VFS metrics, summed over all files.
+ */
+typedef struct {
+    uint32_t reads;                 /*!< xRead calls on database files */
+    uint32_t readahead_hits;        /*!< Reads served from the read-ahead buffer */
+    uint32_t prefetches;            /*!< Read-ahead flash reads */
+    uint64_t prefetched_bytes;      /*!< Bytes read ahead */
+    uint32_t writes;                /*!< xWrite calls on database and rollback journal files */
+    uint32_t flushes;               /*!< Writes of a write buffer to the wrapped file */
+    uint64_t flushed_bytes;         /*!< Bytes written from write buffers */
+} db_vfs_stats_t;
+
+/**
+ * @brief Register the shim as the default VFS, wrapping the current default.
+ *
+ * Call after `sqlite3_initialize()` and before opening the databases. Only
+ * databases opened afterwards use it.
+ *
+ * @param config - VFS configuration, copied.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - SQLITE_MISUSE if the shim is already registered.
+ *  - SQLITE_ERROR if there is no default VFS.
+ *  - SQLITE_NOMEM if the read-ahead task or a mutex could not be created.
+ */
+int db_vfs_register(const db_vfs_config_t *config);
+
+/**
+ * @brief Stop the read-ahead task and restore the previous default VFS.
+ *
+ * All databases opened through the shim must be closed.
+ */
+void db_vfs_unregister(void);
+
+/**
+ * @brief Read the VFS metrics.
+ */
+void db_vfs_get_stats(db_vfs_stats_t *stats);
+
+/**
+ * @brief Log the VFS metrics.
+ */
+void db_vfs_log_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1 @@
+CREATE TABLE IF NOT EXISTS test1 (id INTEGER, content);
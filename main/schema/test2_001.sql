@@ -0,0 +1 @@
+CREATE TABLE IF NOT EXISTS test2 (id INTEGER, content);
@@ -2,19 +2,47 @@
   * 
   * This example initializes SPIFFS creates two SQLite databases on SPIFFS,
   * inserts and retrieves data from them and finally unmounts SPIFFS.
+  * Databases are kept across reboots and SPIFFS is only mounted when the
+  * first database is opened.
   * 
   * This is adaptation from siara-cc examples (https://github.com/siara-cc/esp32-idf-sqlite3-examples)
   * for it to work on ESP-IDF v5.X.X
 */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/unistd.h>
 #include <sys/stat.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
 #include "esp_err.h"
 #include "esp_log.h"
-#include "esp_spiffs.h"
+#include "esp_system.h"
+#include "esp_rom_crc.h"
 #include "esp_timer.h"
 #include "sqlite3.h"
+#include "spiffs_gc_task.h"
+#include "db_advisor.h"
+#include "db_async.h"
+#include "db_bench.h"
+#include "db_bind.h"
+#include "db_blob.h"
+#include "db_bulk.h"
+#include "db_cdc.h"
+#include "db_checkpoint.h"
+#include "db_migrate.h"
+#include "db_pcache.h"
+#include "db_qcache.h"
+#include "db_recovery.h"
+#include "db_retention.h"
+#include "db_schema.h"
+#include "db_service.h"
+#include "db_vacuum.h"
+#include "db_vfs.h"
+#include "storage.h"
+#include "ts_vtab.h"
 
 static const char *TAG = "sqlite3_spiffs";
 
@@ -26,6 +54,54 @@ sqlite3 *db1;
 sqlite3 *db2;
 int rc;
 
+#if CONFIG_EXAMPLE_DB_ATTACH
+// Schema name of test2.db once it is attached to the test1 connection
+#define DB2_SCHEMA "test2db"
+#else
+#define DB2_SCHEMA "main"
+#endif
+
+#if CONFIG_EXAMPLE_DB_ADVISOR
+// Record the statements run on each connection for the query-plan advisor
+static db_advisor_t *advisor1;
+static db_advisor_t *advisor2;
+#endif
+
+#if CONFIG_EXAMPLE_DB_QCACHE
+// Results of repeated queries on the test1 connection
+static db_qcache_t *qcache1;
+#endif
+
+// Schema migrations shared with tools/mkdbimage.py, embedded from main/schema.
+// main/schema/<table>_NNN.sql is migration NNN; append new files, never edit applied ones.
+extern const char test1_001_sql_start[] asm("_binary_test1_001_sql_start");
+extern const char test2_001_sql_start[] asm("_binary_test2_001_sql_start");
+
+static const db_migration_t test1_migrations[] = {
+    { .sql = test1_001_sql_start },
+};
+
+static const db_migration_t test2_migrations[] = {
+    { .sql = test2_001_sql_start },
+};
+
+// Set once the first statement has completed, to report boot-to-first-query time
+static bool first_query_done = false;
+
+#if CONFIG_EXAMPLE_TS_LOGGING
+// Set once the "tseries" module is registered on db1
+static bool ts_logging = false;
+#endif
+
+// INSERT statements of `db_insert_stmt`, prepared once per connection and SQL text
+typedef struct {
+    sqlite3 *db;
+    const char *sql;
+    sqlite3_stmt *stmt;
+} insert_stmt_t;
+
+static insert_stmt_t insert_stmts[4];
+
 /**
   * @brief  SQLite Callback Function
   * 
@@ -64,7 +140,8 @@ static int callback(void *data, int argc, char **argv, char **azColName) {
  * @brief Open a SQLite database.
  *  
  * This function opens a SQLite database specified by the filename and provides an SQLite
- * database connection object for further database operations.
+ * database connection object for further database operations. The SPIFFS partition is
+ * mounted on the first call.
  *  
  * @param filename - The name of the database file to open.
  * @param db - A pointer to a pointer to an SQLite database connection object. Upon success,
@@ -81,7 +158,18 @@ static int callback(void *data, int argc, char **argv, char **azColName) {
  * @see sqlite3_open
  */
 int db_open(const char *filename, sqlite3 **db) {
+    if (storage_mount() != ESP_OK) {
+        *db = NULL;
+        return SQLITE_CANTOPEN;
+    }
+#if CONFIG_EXAMPLE_DB_SHARED_PCACHE
+    // Attribute the page cache statistics to the file
+    db_pcache_set_label(filename);
+#endif
     int rc = sqlite3_open(filename, db);
+#if CONFIG_EXAMPLE_DB_SHARED_PCACHE
+    db_pcache_set_label(NULL);
+#endif
     if (rc) {
         printf("Can't open database: %s\n", sqlite3_errmsg(*db));
         return rc;
@@ -91,6 +179,65 @@ int db_open(const char *filename, sqlite3 **db) {
     return rc;
 }
 
+/**
+ * @brief Finalize the statements `db_insert_stmt` prepared on a connection, before it is closed.
+ *
+ * @param db - A pointer to the SQLite database connection.
+ */
+static void db_insert_finalize(sqlite3 *db){
+    for (size_t i = 0; i < sizeof(insert_stmts) / sizeof(insert_stmts[0]); i++) {
+        if (insert_stmts[i].db == db && insert_stmts[i].stmt != NULL) {
+            sqlite3_finalize(insert_stmts[i].stmt);
+            insert_stmts[i] = (insert_stmt_t){0};
+        }
+    }
+}
+
+/**
+ * @brief Close the Database Connections
+ *
+ * This function closes the "test1" and "test2" connections. In ATTACH mode both point to the
+ * same connection, which is closed once. The pointers are reset to NULL, so calling it again
+ * is harmless.
+ */
+void close_databases(){
+    db_insert_finalize(db1);
+    db_insert_finalize(db2);
+    if (db2 != db1) {
+        sqlite3_close(db2);
+    }
+    sqlite3_close(db1);
+    db1 = NULL;
+    db2 = NULL;
+}
+
+/**
+ * @brief Log the Outcome of a Statement
+ *
+ * Prints whether the statement succeeded and the time it took. After the first
+ * successful statement it also logs the time elapsed since boot.
+ *
+ * @param rc - Result of the statement.
+ * @param error - Error message printed if `rc` is not SQLITE_OK.
+ * @param start - `esp_timer_get_time()` when the statement started.
+ */
+static void log_statement(int rc, const char *error, int64_t start) {
+    if (rc != SQLITE_OK) {
+        // Print SQL error message
+        printf("SQL error: %s\n", error ? error : sqlite3_errstr(rc));
+    } else {
+        printf("Operation done successfully\n");
+    }
+    // Print execution time
+    int64_t end = esp_timer_get_time();
+    printf("Time taken: %lld\n", end - start);
+    if (rc == SQLITE_OK && !first_query_done) {
+        first_query_done = true;
+        ESP_LOGI(TAG, "Boot to first query: %lld us (SPIFFS mount: %lld us, recovery: %lld us)", end,
+                 storage_mount_time_us(), db_recovery_time_us());
+    }
+}
+
 /**
  * @brief Execute an SQL statement on an SQLite database.
  *
@@ -107,6 +254,7 @@ int db_open(const char *filename, sqlite3 **db) {
  *
  * @note
  * - The function provides timing information to measure the execution time of the SQL statement.
+ * - The first successful statement also logs the time elapsed since boot.
  * - Error handling is performed, and any SQL errors are printed along with timing information.
  * - The provided `sql` parameter should be a well-formed SQL statement.
  * - The `callback` function, if specified, processes the results of the SQL query.
@@ -117,16 +265,11 @@ int db_exec(sqlite3 *db, const char *sql) {
     // Start measuring time
     int64_t start = esp_timer_get_time();
     int rc = sqlite3_exec(db, sql, callback, (void*)data, &zErrMsg);
+    log_statement(rc, zErrMsg, start);
     if (rc != SQLITE_OK) {
-        // Print SQL error message
-        printf("SQL error: %s\n", zErrMsg);
         // Free the error message string
         sqlite3_free(zErrMsg);
-    } else {
-        printf("Operation done successfully\n");
     }
-    // Print execution time
-    printf("Time taken: %lld\n", esp_timer_get_time()-start);
     return rc;
 }
 
@@ -139,25 +282,270 @@ int db_exec(sqlite3 *db, const char *sql) {
  *
  * @note
  * - The function creates two tables, "test1" and "test2," in the respective databases.
+ * - Only migrations newer than the database's `PRAGMA user_version` are applied, so data
+ *   from a previous boot or a provisioned SPIFFS image is kept and no DDL runs at startup.
+ * - The migration SQL is embedded from main/schema, the same files tools/mkdbimage.py uses.
+ * - New databases get a page size of `CONFIG_EXAMPLE_DB_PAGE_SIZE`, as tools/mkdbimage.py uses.
+ * - With `CONFIG_EXAMPLE_DB_INCREMENTAL_VACUUM` the databases are switched to
+ *   `auto_vacuum=INCREMENTAL` first.
+ * - The journal mode is set to `CONFIG_EXAMPLE_DB_JOURNAL_MODE`.
+ * - The tables are then stored with the `CONFIG_EXAMPLE_DB_SCHEMA_TEMPLATE` layout, which
+ *   rebuilds them once if they were created with another one.
  * - If an error occurs during table creation, both database connections are closed, and
  *   the function returns without creating the second table.
  */
 void create_db(){
-    ESP_LOGI(TAG, "Creating table test1");
-    rc = db_exec(db1, "CREATE TABLE test1 (id INTEGER, content);");
+    // Only applies to a database without tables yet
+    char page_size_sql[48];
+    snprintf(page_size_sql, sizeof(page_size_sql), "PRAGMA page_size=%d", CONFIG_EXAMPLE_DB_PAGE_SIZE);
+    rc = db_exec(db1, page_size_sql);
+    if (rc == SQLITE_OK) {
+        snprintf(page_size_sql, sizeof(page_size_sql), "PRAGMA %s.page_size=%d", DB2_SCHEMA,
+                 CONFIG_EXAMPLE_DB_PAGE_SIZE);
+        rc = db_exec(db2, page_size_sql);
+    }
     if (rc != SQLITE_OK) {
-        sqlite3_close(db1);
-        sqlite3_close(db2);
+        close_databases();
         return;
     }
-    ESP_LOGI(TAG, "Creating table test2");
-    rc = db_exec(db2, "CREATE TABLE test2 (id INTEGER, content);");
+#if CONFIG_EXAMPLE_DB_INCREMENTAL_VACUUM
+    // Must happen before the first table exists, or costs a one-time VACUUM
+    rc = db_vacuum_enable_incremental(db1, "test1");
+    if (rc == SQLITE_OK) {
+        rc = db_vacuum_enable_incremental(db2, "test2");
+    }
     if (rc != SQLITE_OK) {
-        sqlite3_close(db1);
-        sqlite3_close(db2);
+        close_databases();
+        return;
+    }
+#endif
+    rc = db_checkpoint_set_journal_mode(db1, CONFIG_EXAMPLE_DB_JOURNAL_MODE);
+    if (rc == SQLITE_OK) {
+        rc = db_checkpoint_set_journal_mode(db2, CONFIG_EXAMPLE_DB_JOURNAL_MODE);
+    }
+    if (rc != SQLITE_OK) {
+        close_databases();
+        return;
+    }
+    rc = db_migrate(db1, "test1", test1_migrations, sizeof(test1_migrations) / sizeof(test1_migrations[0]));
+    if (rc != SQLITE_OK) {
+        close_databases();
+        return;
+    }
+    rc = db_migrate(db2, "test2", test2_migrations, sizeof(test2_migrations) / sizeof(test2_migrations[0]));
+    if (rc != SQLITE_OK) {
+        close_databases();
+        return;
+    }
+    db_schema_template_t layout;
+    rc = db_schema_template_from_name(CONFIG_EXAMPLE_DB_SCHEMA_TEMPLATE, &layout);
+    if (rc == SQLITE_OK) {
+        rc = db_schema_apply(db1, "test1", "id", layout);
+    }
+    if (rc == SQLITE_OK) {
+        rc = db_schema_apply(db2, "test2", "id", layout);
+    }
+    if (rc != SQLITE_OK) {
+        close_databases();
+        return;
+    }
+#if CONFIG_EXAMPLE_TS_LOGGING
+    if (ts_logging) {
+        // Created outside the migrations: the host tool has no tseries module
+        char sql[96];
+        ESP_LOGI(TAG, "Creating time-series table test1_ts");
+        snprintf(sql, sizeof(sql), "CREATE VIRTUAL TABLE IF NOT EXISTS test1_ts USING tseries('/spiffs/ts1', %d);",
+                 CONFIG_EXAMPLE_TS_HEAD_ROWS);
+        rc = db_exec(db1, sql);
+        if (rc != SQLITE_OK) {
+            close_databases();
+            return;
+        }
+#if CONFIG_EXAMPLE_RETENTION_MAX_ROWS > 0
+        const ts_vtab_retention_t ts_retention = { .max_rows = CONFIG_EXAMPLE_RETENTION_MAX_ROWS };
+        int ts_rc = ts_vtab_set_retention(db1, "test1_ts", &ts_retention);
+        if (ts_rc != SQLITE_OK) {
+            ESP_LOGW(TAG, "Retention of test1_ts not set: %s", sqlite3_errstr(ts_rc));
+        }
+#endif
+    }
+#endif
+    ESP_LOGI(TAG, "Tables ready");
+}
+
+/**
+ * @brief Serve test2 from the test1 Connection
+ *
+ * This function closes the "test2" connection and attaches test2.db to the "test1" one as
+ * schema `DB2_SCHEMA`. Both files then share one connection, with a single schema cache,
+ * statement memory and lookaside allocator, and queries can join test1 with test2. `db2`
+ * points to the same connection as `db1` afterwards.
+ *
+ * @note
+ * - The schema setup in `create_db` runs before, on separate connections, because the
+ *   migration SQL creates unqualified tables.
+ * - The journal mode is set again so it also applies to the attached database.
+ * - If an error occurs, both database connections are closed.
+ */
+void attach_databases(){
+    db_insert_finalize(db2);
+    sqlite3_close(db2);
+    db2 = db1;
+    ESP_LOGI(TAG, "Attaching test2.db to the test1 connection");
+#if CONFIG_EXAMPLE_DB_SHARED_PCACHE
+    db_pcache_set_label("/spiffs/test2.db");
+#endif
+    rc = db_exec(db1, "ATTACH DATABASE '/spiffs/test2.db' AS " DB2_SCHEMA);
+#if CONFIG_EXAMPLE_DB_SHARED_PCACHE
+    db_pcache_set_label(NULL);
+#endif
+    if (rc == SQLITE_OK) {
+        rc = db_checkpoint_set_journal_mode(db1, CONFIG_EXAMPLE_DB_JOURNAL_MODE);
+    }
+    if (rc != SQLITE_OK) {
+        close_databases();
         return;
     }
-    ESP_LOGI(TAG, "Tables created succesfully");
+}
+
+/**
+ * @brief Log SQLite Memory Usage
+ *
+ * This function logs the heap used by SQLite as a whole and, summed over the open
+ * connections, by page caches, schemas and prepared statements, to compare separate
+ * connections with ATTACH mode. With the shared page cache the page cache figure is the
+ * memory its pages take, which SQLite does not count, so it is added to the SQLite heap;
+ * the budget usage, hit rate and evictions of every cache are logged too.
+ *
+ * @param when - Label for the log line.
+ */
+void log_memory_usage(const char *when){
+    int cache = 0, schema = 0, stmt = 0, cur, hi;
+    int connections = 0;
+    sqlite3 *dbs[] = { db1, db2 != db1 ? db2 : NULL };
+    for (int i = 0; i < 2; i++) {
+        if (dbs[i] == NULL) {
+            continue;
+        }
+        connections++;
+        sqlite3_db_status(dbs[i], SQLITE_DBSTATUS_CACHE_USED, &cur, &hi, 0);
+        cache += cur;
+        sqlite3_db_status(dbs[i], SQLITE_DBSTATUS_SCHEMA_USED, &cur, &hi, 0);
+        schema += cur;
+        sqlite3_db_status(dbs[i], SQLITE_DBSTATUS_STMT_USED, &cur, &hi, 0);
+        stmt += cur;
+    }
+    sqlite3_int64 heap = sqlite3_memory_used();
+#if CONFIG_EXAMPLE_DB_SHARED_PCACHE
+    // The shared cache allocates its pages with heap_caps_malloc, which sqlite3_memory_used() does not see
+    cache = (int)db_pcache_memory_used();
+    heap += cache;
+#endif
+    ESP_LOGI(TAG, "%s: %d connection(s), SQLite heap %lld bytes (page cache %d, schema %d, statements %d), "
+             "free heap %lu", when, connections, heap, cache, schema, stmt,
+             (unsigned long)esp_get_free_heap_size());
+#if CONFIG_EXAMPLE_DB_SHARED_PCACHE
+    db_pcache_log_stats();
+#endif
+}
+
+/**
+ * @brief Row layout of the "test1" and "test2" tables.
+ */
+typedef struct {
+    int id;
+    const char *content;
+} test_row_t;
+
+// Binds a `test_row_t` to `INSERT INTO testN VALUES (?, ?)`
+static const db_bind_column_t test_row_columns[] = {
+    DB_BIND_INT(test_row_t, id),
+    DB_BIND_TEXT(test_row_t, content),
+};
+
+/**
+ * @brief Get the INSERT statement of a connection and SQL text.
+ *
+ * The statement is prepared on the first call for a connection and SQL text,
+ * and reused afterwards; `db_bind_exec` resets it and clears its bindings.
+ *
+ * @param db - A pointer to the SQLite database connection.
+ * @param sql - INSERT statement, a string constant.
+ * @param stmt - Receives the statement.
+ * @param cached - Receives false if no slot was left, the caller must then finalize `*stmt`.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - An SQLite error code on failure.
+ */
+static int db_insert_stmt(sqlite3 *db, const char *sql, sqlite3_stmt **stmt, bool *cached) {
+    insert_stmt_t *free_slot = NULL;
+    for (size_t i = 0; i < sizeof(insert_stmts) / sizeof(insert_stmts[0]); i++) {
+        if (insert_stmts[i].stmt == NULL) {
+            free_slot = free_slot ? free_slot : &insert_stmts[i];
+        } else if (insert_stmts[i].db == db && strcmp(insert_stmts[i].sql, sql) == 0) {
+            *stmt = insert_stmts[i].stmt;
+            *cached = true;
+            return SQLITE_OK;
+        }
+    }
+    int rc = sqlite3_prepare_v2(db, sql, -1, stmt, NULL);
+    *cached = rc == SQLITE_OK && free_slot != NULL;
+    if (*cached) {
+        *free_slot = (insert_stmt_t){ .db = db, .sql = sql, .stmt = *stmt };
+    }
+    return rc;
+}
+
+/**
+ * @brief Bind a struct to the INSERT statement of a connection and SQL text and run it.
+ *
+ * @param db - A pointer to the SQLite database connection.
+ * @param sql - INSERT statement with one `?` per column, a string constant.
+ * @param columns - Column descriptors of `data`.
+ * @param count - Number of column descriptors.
+ * @param data - Struct holding the values.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - An SQLite error code on failure.
+ */
+static int db_insert_exec(sqlite3 *db, const char *sql, const db_bind_column_t *columns, size_t count,
+                          const void *data) {
+    sqlite3_stmt *stmt;
+    bool cached;
+    int rc = db_insert_stmt(db, sql, &stmt, &cached);
+    if (rc == SQLITE_OK) {
+        rc = db_bind_exec(stmt, columns, count, data);
+        if (!cached) {
+            // No slot left: prepared for this call only
+            sqlite3_finalize(stmt);
+        }
+    }
+    return rc;
+}
+
+/**
+ * @brief Insert one row with a prepared statement.
+ *
+ * The values are bound with `db_bind_exec` instead of being formatted into the
+ * SQL, so nothing is quoted or copied and the statement text is constant. The
+ * statement is reused across calls, see `db_insert_stmt`.
+ *
+ * @param db - A pointer to the SQLite database connection.
+ * @param sql - INSERT statement with one `?` per `test_row_t` field, a string constant.
+ * @param row - Row to insert.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - An SQLite error code on failure.
+ */
+static int db_insert_row(sqlite3 *db, const char *sql, const test_row_t *row) {
+    printf("%s <- (%d, '%s')\n", sql, row->id, row->content);
+    int64_t start = esp_timer_get_time();
+    int rc = db_insert_exec(db, sql, test_row_columns, sizeof(test_row_columns) / sizeof(test_row_columns[0]), row);
+    log_statement(rc, rc != SQLITE_OK ? sqlite3_errmsg(db) : NULL, start);
+    return rc;
 }
 
 /**
@@ -169,24 +557,223 @@ void create_db(){
  * @note
  * - The function inserts sample data into the "test1" and "test2" tables of the respective
  *   databases.
+ * - Values are bound to a prepared statement, see `db_insert_row`.
+ * - Rows are inserted with INSERT OR REPLACE, so rerunning the example on a keyed table
+ *   layout replaces them instead of failing.
  * - If an error occurs during data insertion, both database connections are closed, and
  *   the function returns without inserting data into the second table.
  */
 void insert_data(){
     ESP_LOGI(TAG, "Inserting data in table test1");
-    rc = db_exec(db1, "INSERT INTO test1 VALUES (1, 'Hello, World from test1, ESP-IDF 5.1.1');");
+    const test_row_t row1 = { 1, "Hello, World from test1, ESP-IDF 5.1.1" };
+    rc = db_insert_row(db1, "INSERT OR REPLACE INTO test1 VALUES (?, ?)", &row1);
     if (rc != SQLITE_OK) {
-        sqlite3_close(db1);
-        sqlite3_close(db2);
+        close_databases();
         return;
     }
     ESP_LOGI(TAG, "Inserting data in table test2");
-    rc = db_exec(db2, "INSERT INTO test2 VALUES (1, 'Hello, World from test2, ESP-IDF 5.1.1');");
+    const test_row_t row2 = { 1, "Hello, World from test2, ESP-IDF 5.1.1" };
+    rc = db_insert_row(db2, "INSERT OR REPLACE INTO test2 VALUES (?, ?)", &row2);
     if (rc != SQLITE_OK) {
-        sqlite3_close(db1);
-        sqlite3_close(db2);
+        close_databases();
+        return;
+    }
+}
+
+/**
+ * @brief Bulk Load Data into test1
+ *
+ * This function inserts `CONFIG_EXAMPLE_BULK_LOAD_ROWS` rows into "test1" with
+ * `db_bulk_load`, which reuses one prepared statement inside one transaction, and
+ * logs the resulting rows/s.
+ *
+ * @note
+ * - Nothing is done when `CONFIG_EXAMPLE_BULK_LOAD_ROWS` is 0.
+ * - If an error occurs, both database connections are closed.
+ */
+void bulk_load_data(){
+#if CONFIG_EXAMPLE_BULK_LOAD_ROWS > 0
+    test_row_t *rows = malloc(CONFIG_EXAMPLE_BULK_LOAD_ROWS * sizeof(test_row_t));
+    if (rows == NULL) {
+        ESP_LOGE(TAG, "Not enough memory for %d rows", CONFIG_EXAMPLE_BULK_LOAD_ROWS);
+        return;
+    }
+    for (int i = 0; i < CONFIG_EXAMPLE_BULK_LOAD_ROWS; i++) {
+        rows[i].id = i + 2;
+        rows[i].content = "Bulk loaded row from test1";
+    }
+
+    ESP_LOGI(TAG, "Bulk loading %d rows in table test1", CONFIG_EXAMPLE_BULK_LOAD_ROWS);
+    const db_bulk_config_t config = {
+        .table = "test1",
+        .sql = "INSERT OR REPLACE INTO test1 VALUES (?, ?)",
+        .columns = test_row_columns,
+        .column_count = sizeof(test_row_columns) / sizeof(test_row_columns[0]),
+        .defer_indexes = true,
+    };
+    rc = db_bulk_load(db1, &config, rows, CONFIG_EXAMPLE_BULK_LOAD_ROWS, sizeof(test_row_t), NULL);
+    free(rows);
+    if (rc != SQLITE_OK) {
+        close_databases();
+        return;
+    }
+#endif
+}
+
+/**
+ * @brief Stream a Blob into test1
+ *
+ * This function inserts a row whose content is a zeroblob of
+ * `CONFIG_EXAMPLE_BLOB_STREAM_BYTES` bytes, fills it chunk by chunk with `db_blob_write`
+ * as a producer writing from a DMA buffer would, then reads it back the same way and
+ * compares CRCs. Only one page-sized chunk is ever held in RAM.
+ *
+ * @note
+ * - Nothing is done when `CONFIG_EXAMPLE_BLOB_STREAM_BYTES` is 0.
+ * - If an error occurs, both database connections are closed.
+ */
+void stream_blob_data(){
+#if CONFIG_EXAMPLE_BLOB_STREAM_BYTES > 0
+    const int size = CONFIG_EXAMPLE_BLOB_STREAM_BYTES;
+    int chunk = db_blob_chunk_size(db1);
+    uint8_t *buf = malloc(chunk);
+    if (buf == NULL) {
+        ESP_LOGE(TAG, "Not enough memory for a %d byte chunk", chunk);
+        return;
+    }
+
+    ESP_LOGI(TAG, "Streaming a %d byte blob into table test1 in %d byte chunks", size, chunk);
+    int64_t start = esp_timer_get_time();
+    sqlite3_stmt *stmt = NULL;
+    // One transaction for the zeroblob insert and the writes, so a partial blob is never stored
+    rc = sqlite3_exec(db1, "BEGIN IMMEDIATE", NULL, NULL, NULL);
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_prepare_v2(db1, "INSERT OR REPLACE INTO test1 VALUES (?, ?)", -1, &stmt, NULL);
+    }
+    if (rc == SQLITE_OK) {
+        rc = db_bind(stmt, "iz", 1000, size);
+        if (rc == SQLITE_OK && sqlite3_step(stmt) != SQLITE_DONE) {
+            rc = sqlite3_errcode(db1);
+        }
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_int64 rowid = sqlite3_last_insert_rowid(db1);
+
+    db_blob_t blob;
+    uint32_t written_crc = 0;
+    if (rc == SQLITE_OK) {
+        rc = db_blob_open(db1, "test1", "content", rowid, true, &blob);
+    }
+    if (rc == SQLITE_OK) {
+        for (int offset = 0; rc == SQLITE_OK && offset < size; offset += chunk) {
+            int len = size - offset < chunk ? size - offset : chunk;
+            for (int i = 0; i < len; i++) {
+                buf[i] = (uint8_t)(offset + i);
+            }
+            written_crc = esp_rom_crc32_le(written_crc, buf, len);
+            rc = db_blob_write(&blob, buf, len);
+        }
+        int close_rc = db_blob_close(&blob);
+        if (rc == SQLITE_OK) {
+            rc = close_rc;
+        }
+    }
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_exec(db1, "COMMIT", NULL, NULL, NULL);
+    }
+    if (rc != SQLITE_OK && !sqlite3_get_autocommit(db1)) {
+        sqlite3_exec(db1, "ROLLBACK", NULL, NULL, NULL);
+    }
+    int64_t write_us = esp_timer_get_time() - start;
+
+    uint32_t read_crc = 0;
+    start = esp_timer_get_time();
+    if (rc == SQLITE_OK) {
+        rc = db_blob_open(db1, "test1", "content", rowid, false, &blob);
+    }
+    if (rc == SQLITE_OK) {
+        int len;
+        while ((rc = db_blob_read(&blob, buf, chunk, &len)) == SQLITE_OK && len > 0) {
+            read_crc = esp_rom_crc32_le(read_crc, buf, len);
+        }
+        db_blob_close(&blob);
+    }
+    int64_t read_us = esp_timer_get_time() - start;
+    free(buf);
+
+    if (rc != SQLITE_OK) {
+        printf("SQL error: %s\n", sqlite3_errmsg(db1));
+        close_databases();
+        return;
+    }
+    ESP_LOGI(TAG, "Blob written in %lld us, read in %lld us, crc %s", write_us, read_us,
+             written_crc == read_crc ? "ok" : "MISMATCH");
+#endif
+}
+
+/**
+ * @brief Log Sensor Data into the Time-Series Table
+ *
+ * This function appends readings with increasing ids to "test1_ts" and reads back the
+ * most recent ones with a range query, which only touches the segments whose id range
+ * can match.
+ *
+ * @note
+ * - Only built with `CONFIG_EXAMPLE_TS_LOGGING`, and skipped if the module could not be registered.
+ * - If an error occurs, both database connections are closed.
+ */
+void log_sensor_data(){
+#if CONFIG_EXAMPLE_TS_LOGGING
+    if (!ts_logging) {
+        return;
+    }
+    char sql[96];
+    ESP_LOGI(TAG, "Logging data in table test1_ts");
+    for (int i = 0; i < 8; i++) {
+        snprintf(sql, sizeof(sql), "INSERT INTO test1_ts(content) VALUES ('Reading %d from test1_ts');", i);
+        rc = db_exec(db1, sql);
+        if (rc != SQLITE_OK) {
+            close_databases();
+            return;
+        }
+    }
+    ESP_LOGI(TAG, "Selecting recent data from test1_ts");
+    rc = db_exec(db1, "SELECT * FROM test1_ts WHERE id > (SELECT max(id) FROM test1_ts) - 4");
+    if (rc != SQLITE_OK) {
+        close_databases();
         return;
     }
+#endif
+}
+
+/**
+ * @brief Apply the Retention Policy to the Database Tables
+ *
+ * This function keeps "test1" and "test2" bounded to `CONFIG_EXAMPLE_RETENTION_MAX_ROWS`
+ * rows by evicting at most one batch of the oldest rows from each, so the cost per call
+ * stays flat however large the tables are.
+ *
+ * @note
+ * - Nothing is done when `CONFIG_EXAMPLE_RETENTION_MAX_ROWS` is 0, or for WITHOUT ROWID
+ *   tables, which have no rowid to evict by.
+ * - Errors are logged but do not close the databases; eviction is retried on the next call.
+ */
+void apply_retention(){
+#if CONFIG_EXAMPLE_RETENTION_MAX_ROWS > 0 && !CONFIG_EXAMPLE_DB_SCHEMA_TEMPLATE_WITHOUT_ROWID
+    db_retention_policy_t policy = {
+        .table = "test1",
+        .max_rows = CONFIG_EXAMPLE_RETENTION_MAX_ROWS,
+    };
+    uint32_t evicted = 0;
+    if (db_retention_apply(db1, &policy, &evicted) == SQLITE_OK && evicted > 0) {
+        ESP_LOGI(TAG, "Evicted %d rows from test1", (int)evicted);
+    }
+    policy.schema = DB2_SCHEMA;
+    policy.table = "test2";
+    if (db_retention_apply(db2, &policy, &evicted) == SQLITE_OK && evicted > 0) {
+        ESP_LOGI(TAG, "Evicted %d rows from test2", (int)evicted);
+    }
+#endif
 }
 
 /**
@@ -198,6 +785,7 @@ void insert_data(){
  * @note
  * - The function retrieves data from the "test1" and "test2" tables of the respective
  *   databases using SQL SELECT queries.
+ * - In ATTACH mode it also joins "test1" with "test2" in a single query.
  * - If an error occurs during data retrieval, both database connections are closed, and
  *   the function returns without completing the second SELECT operation.
  */
@@ -205,90 +793,684 @@ void select_data(){
     ESP_LOGI(TAG, "Selecting data from test1");
     rc = db_exec(db1, "SELECT * FROM test1");
     if (rc != SQLITE_OK) {
-        sqlite3_close(db1);
-        sqlite3_close(db2);
+        close_databases();
         return;
     }
     ESP_LOGI(TAG, "Selecting data from test2");
     rc = db_exec(db2, "SELECT * FROM test2");
     if (rc != SQLITE_OK) {
-        sqlite3_close(db1);
-        sqlite3_close(db2);
+        close_databases();
         return;
     }
+#if CONFIG_EXAMPLE_DB_ATTACH
+    ESP_LOGI(TAG, "Joining test1 with test2");
+    rc = db_exec(db1, "SELECT test1.id, test1.content, test2.content FROM test1 JOIN " DB2_SCHEMA ".test2 USING (id)");
+    if (rc != SQLITE_OK) {
+        close_databases();
+        return;
+    }
+#endif
 }
 
-void app_main()
-{
-    // Initialize and mount SPIFFS filesystem.
-    ESP_LOGI(TAG, "Initializing SPIFFS");
-
-    esp_vfs_spiffs_conf_t conf = {
-        .base_path = "/spiffs",
-        //.partition_label = "storage",
-        .partition_label = NULL,
-        .max_files = 5,
-        .format_if_mount_failed = true
-    };
-    
-    // Use settings defined above to initialize and mount SPIFFS filesystem.
-    // Note: esp_vfs_spiffs_register is an all-in-one convenience function.
-    esp_err_t ret = esp_vfs_spiffs_register(&conf);
-
-    if (ret != ESP_OK) {
-        if (ret == ESP_FAIL) {
-            ESP_LOGE(TAG, "Failed to mount or format filesystem");
-        } else if (ret == ESP_ERR_NOT_FOUND) {
-            ESP_LOGE(TAG, "Failed to find SPIFFS partition");
-        } else {
-            ESP_LOGE(TAG, "Failed to initialize SPIFFS (%s)", esp_err_to_name(ret));
+#if CONFIG_EXAMPLE_DB_BENCHMARK
+/**
+ * @brief Bind a spread of existing ids to `SELECT ... WHERE id = ?`.
+ */
+static int bind_lookup_id(sqlite3_stmt *stmt, uint32_t iteration, void *ctx) {
+    int max_id = *(const int *)ctx;
+    return sqlite3_bind_int(stmt, 1, 1 + (int)((iteration * 7919u) % (uint32_t)max_id));
+}
+
+/**
+ * @brief Time point lookups by id on test1.
+ */
+static void benchmark_lookups(const char *name){
+    sqlite3_stmt *stmt;
+    int max_id = 1;
+    if (sqlite3_prepare_v2(db1, "SELECT max(id) FROM test1", -1, &stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) > 0) {
+            max_id = sqlite3_column_int(stmt, 0);
         }
-        return;
+        sqlite3_finalize(stmt);
     }
+    rc = db_bench_run(db1, name, "SELECT content FROM test1 WHERE id = ?", CONFIG_EXAMPLE_DB_BENCHMARK_RUNS,
+                      bind_lookup_id, &max_id, NULL);
+}
+#endif
 
-    // Retrieve and log partition information.
-    size_t total = 0, used = 0;
-    ret = esp_spiffs_info(NULL, &total, &used);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to get SPIFFS partition information (%s)", esp_err_to_name(ret));
-    } else {
-        ESP_LOGI(TAG, "Partition size: total: %d, used: %d", total, used);
+#if CONFIG_EXAMPLE_DB_BENCHMARK && CONFIG_EXAMPLE_DB_BENCHMARK_SCHEMA_ROWS > 0
+/**
+ * @brief Bind `(id, content)` for benchmark row `iteration`.
+ */
+static int bind_bench_row(sqlite3_stmt *stmt, uint32_t iteration, void *ctx) {
+    return db_bind(stmt, "it", (int)iteration + 1, "Benchmark row stored in every table layout");
+}
+
+/**
+ * @brief Pages in use by the database, excluding the freelist.
+ */
+static int db_pages_used(sqlite3 *db) {
+    static const char *const pragmas[] = { "PRAGMA page_count", "PRAGMA freelist_count" };
+    int pages[2] = { 0, 0 };
+    for (int i = 0; i < 2; i++) {
+        sqlite3_stmt *stmt;
+        if (sqlite3_prepare_v2(db, pragmas[i], -1, &stmt, NULL) == SQLITE_OK) {
+            if (sqlite3_step(stmt) == SQLITE_ROW) {
+                pages[i] = sqlite3_column_int(stmt, 0);
+            }
+            sqlite3_finalize(stmt);
+        }
     }
+    return pages[0] - pages[1];
+}
 
-    // Comment this lines in case you want to remove the DB
-    unlink("/spiffs/test1.db");
-    unlink("/spiffs/test2.db");
+/**
+ * @brief Compare the table layouts on scratch tables in test1.db.
+ */
+static void benchmark_schemas(){
+    const int rows = CONFIG_EXAMPLE_DB_BENCHMARK_SCHEMA_ROWS;
+    for (int t = DB_SCHEMA_PLAIN; t <= DB_SCHEMA_WITHOUT_ROWID; t++) {
+        char name[48];
+        snprintf(name, sizeof(name), "bench_%s", db_schema_template_name(t));
+        char *sql = db_schema_table_sql(name, "id", "content", t);
+        sqlite3_exec(db1, "DROP TABLE IF EXISTS bench_plain; DROP TABLE IF EXISTS bench_rowid;"
+                          "DROP TABLE IF EXISTS bench_without_rowid", NULL, NULL, NULL);
+        int pages = db_pages_used(db1);
+        rc = sql ? sqlite3_exec(db1, sql, NULL, NULL, NULL) : SQLITE_NOMEM;
+        sqlite3_free(sql);
 
-    // Initialize SQLite library.
-    sqlite3_initialize();
+        db_bench_result_t insert = {0};
+        db_bench_result_t lookup = {0};
+        char label[64];
+        if (rc == SQLITE_OK) {
+            // One transaction, so the insert latency is B-tree work rather than commits
+            sqlite3_exec(db1, "BEGIN", NULL, NULL, NULL);
+            sql = sqlite3_mprintf("INSERT INTO \"%w\" VALUES (?, ?)", name);
+            snprintf(label, sizeof(label), "%s insert", name);
+            rc = db_bench_run(db1, label, sql, rows, bind_bench_row, NULL, &insert);
+            sqlite3_free(sql);
+            sqlite3_exec(db1, rc == SQLITE_OK ? "COMMIT" : "ROLLBACK", NULL, NULL, NULL);
+        }
+        if (rc == SQLITE_OK) {
+            pages = db_pages_used(db1) - pages;
+            sql = sqlite3_mprintf("SELECT content FROM \"%w\" WHERE id = ?", name);
+            snprintf(label, sizeof(label), "%s lookup by id", name);
+            int max_id = rows;
+            rc = db_bench_run(db1, label, sql, CONFIG_EXAMPLE_DB_BENCHMARK_RUNS, bind_lookup_id, &max_id, &lookup);
+            sqlite3_free(sql);
+        }
+        if (rc != SQLITE_OK) {
+            break;
+        }
+        ESP_LOGI(TAG, "%-13s %d rows: %d pages, insert avg %lld us, lookup avg %lld us",
+                 db_schema_template_name(t), rows, pages, insert.avg_us, lookup.avg_us);
+    }
+    sqlite3_exec(db1, "DROP TABLE IF EXISTS bench_plain; DROP TABLE IF EXISTS bench_rowid;"
+                      "DROP TABLE IF EXISTS bench_without_rowid", NULL, NULL, NULL);
+}
+#endif
 
-    // Open SQLite databases.
-    ESP_LOGI(TAG, "Opening table test1");
-    if (db_open("/spiffs/test1.db", &db1))
+/**
+ * @brief Benchmark Queries and Suggest Indexes
+ *
+ * This function times point lookups by id on "test1" and runs the query-plan advisor over
+ * every statement executed so far, logging full scans, temp B-trees and the indexes that
+ * would remove them. When the advisor creates its suggestions, the lookups are timed again
+ * to show the before/after latency. The table layouts of `db_schema.h` are compared on
+ * scratch tables of `CONFIG_EXAMPLE_DB_BENCHMARK_SCHEMA_ROWS` rows.
+ *
+ * @note
+ * - The benchmark needs `CONFIG_EXAMPLE_DB_BENCHMARK`, the advisor `CONFIG_EXAMPLE_DB_ADVISOR`.
+ * - Created indexes persist; add the logged CREATE INDEX to main/schema to keep them in
+ *   provisioned images too.
+ */
+void benchmark_queries(){
+#if CONFIG_EXAMPLE_DB_BENCHMARK
+    ESP_LOGI(TAG, "Benchmarking table test1");
+    benchmark_lookups("test1 lookup by id");
+#if CONFIG_EXAMPLE_DB_BENCHMARK_SCHEMA_ROWS > 0
+    ESP_LOGI(TAG, "Comparing table layouts");
+    benchmark_schemas();
+#endif
+#endif
+#if CONFIG_EXAMPLE_DB_ADVISOR
+    const db_advisor_options_t options = {
+#if CONFIG_EXAMPLE_DB_ADVISOR_CREATE_INDEXES
+        .create_indexes = true,
+#endif
+#if CONFIG_EXAMPLE_DB_ADVISOR_COVERING
+        .covering = true,
+#endif
+    };
+    int suggested = 0;
+    if (advisor1) {
+        ESP_LOGI(TAG, "Analyzing query plans of test1");
+        db_advisor_analyze(advisor1, &options, &suggested);
+    }
+    if (advisor2) {
+        ESP_LOGI(TAG, "Analyzing query plans of test2");
+        db_advisor_analyze(advisor2, &options, NULL);
+    }
+#if CONFIG_EXAMPLE_DB_BENCHMARK
+    if (options.create_indexes && suggested > 0) {
+        benchmark_lookups("test1 lookup by id, advisor indexes");
+    }
+#endif
+#endif
+}
+
+#if CONFIG_EXAMPLE_DB_QCACHE
+/**
+ * @brief Count the rows of a query, as a `db_qcache_exec` callback.
+ */
+static int count_rows(void *arg, int argc, char **argv, char **azColName) {
+    (*(int *)arg)++;
+    return 0;
+}
+
+/**
+ * @brief Run the dashboard query through the result cache and log its latency.
+ */
+static void run_dashboard_query(const char *label) {
+    int rows = 0;
+    int64_t start = esp_timer_get_time();
+    rc = db_qcache_exec(qcache1, "SELECT id, content FROM test1 ORDER BY id DESC LIMIT 10", NULL, NULL, count_rows,
+                        &rows);
+    ESP_LOGI(TAG, "%s: %d rows in %lld us (%s)", label, rows, esp_timer_get_time() - start, sqlite3_errstr(rc));
+}
+#endif
+
+/**
+ * @brief Run Repeated Queries through the Result Cache
+ *
+ * This function runs the same dashboard query on "test1" several times through
+ * `db_qcache_exec`, inserts a row, runs it again and logs each latency and the cache
+ * metrics, showing hits served from RAM and the invalidation by the write.
+ *
+ * @note
+ * - Nothing is done unless `CONFIG_EXAMPLE_DB_QCACHE` is enabled.
+ */
+void cached_queries(){
+#if CONFIG_EXAMPLE_DB_QCACHE
+    if (qcache1 == NULL) {
         return;
-    ESP_LOGI(TAG, "Opening table test2");
-    if (db_open("/spiffs/test2.db", &db2))
+    }
+    run_dashboard_query("Dashboard query, cold");
+    for (int i = 0; i < 3; i++) {
+        run_dashboard_query("Dashboard query, cached");
+    }
+    const test_row_t row = { 9999, "Written after the dashboard query" };
+    rc = db_insert_row(db1, "INSERT OR REPLACE INTO test1 VALUES (?, ?)", &row);
+    run_dashboard_query("Dashboard query, after a write to test1");
+    run_dashboard_query("Dashboard query, cached");
+    db_qcache_stats_t stats;
+    db_qcache_get_stats(qcache1, &stats);
+    ESP_LOGI(TAG, "Query cache: %d hits, %d misses, %d invalidated, %d results in %d bytes", (int)stats.hits,
+             (int)stats.misses, (int)stats.invalidations, (int)stats.entries, (int)stats.used);
+#endif
+}
+
+#if CONFIG_EXAMPLE_DB_GROUP_COMMIT_WRITERS > 0
+static SemaphoreHandle_t writers_done;
+static bool writers_grouped;
+
+/**
+ * @brief Insert one `test_row_t` into "test1", as a `db_service_write` function.
+ */
+static int insert_writer_row(void *arg) {
+    return db_insert_exec(db1, "INSERT OR REPLACE INTO test1 VALUES (?, ?)", test_row_columns,
+                          sizeof(test_row_columns) / sizeof(test_row_columns[0]), arg);
+}
+
+/**
+ * @brief Writer task: insert rows one durable write at a time.
+ *
+ * Grouped writes share commits through `db_service_write`; otherwise each row
+ * is committed on its own through `db_service_call`.
+ *
+ * @param arg - Writer number.
+ */
+static void writer_task(void *arg) {
+    int writer = (int)(intptr_t)arg;
+    char content[48];
+    for (int i = 0; i < CONFIG_EXAMPLE_DB_GROUP_COMMIT_ROWS; i++) {
+        snprintf(content, sizeof(content), "Row %d from writer %d", i, writer);
+        test_row_t row = { 10000 + writer * CONFIG_EXAMPLE_DB_GROUP_COMMIT_ROWS + i, content };
+        int rc = writers_grouped ? db_service_write(db1, insert_writer_row, &row)
+                                 : db_service_call(insert_writer_row, &row);
+        if (rc != SQLITE_OK) {
+            ESP_LOGW(TAG, "Writer %d: insert %d failed", writer, row.id);
+        }
+    }
+    xSemaphoreGive(writers_done);
+}
+
+static void writer_task_main(void *arg) {
+    writer_task(arg);
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Run the writer tasks until all rows are inserted.
+ *
+ * Without the database service the writers run one after another in the calling task.
+ *
+ * @param grouped - Whether the writes go through the group commit.
+ *
+ * @return Time taken in microseconds.
+ */
+static int64_t run_writers(bool grouped) {
+    const int writers = CONFIG_EXAMPLE_DB_GROUP_COMMIT_WRITERS;
+    writers_grouped = grouped;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < writers; i++) {
+        if (!db_service_running()) {
+            // The writes would run inline in each task, on the same connection
+            writer_task((void *)(intptr_t)i);
+        } else if (xTaskCreate(writer_task_main, "db_writer", CONFIG_EXAMPLE_DB_GROUP_COMMIT_STACK_SIZE,
+                        (void *)(intptr_t)i, CONFIG_EXAMPLE_DB_SERVICE_PRIORITY, NULL) != pdPASS) {
+            writer_task((void *)(intptr_t)i);
+        }
+    }
+    for (int i = 0; i < writers; i++) {
+        xSemaphoreTake(writers_done, portMAX_DELAY);
+    }
+    return esp_timer_get_time() - start;
+}
+#endif
+
+/**
+ * @brief Run Concurrent Writers with and without Group Commit
+ *
+ * This function starts `CONFIG_EXAMPLE_DB_GROUP_COMMIT_WRITERS` tasks that each insert
+ * rows into "test1", first with one commit per row as a baseline, then through
+ * `db_service_write`, and logs the throughput of both and how many commits the
+ * database service needed for the grouped writes.
+ *
+ * @note
+ * - It must run outside the database service task, which commits the writes.
+ * - Writers that cannot be started as tasks run in the calling task, and so do all of
+ *   them when the database service is not running.
+ */
+void group_commit_writers(){
+#if CONFIG_EXAMPLE_DB_GROUP_COMMIT_WRITERS > 0
+    const int writers = CONFIG_EXAMPLE_DB_GROUP_COMMIT_WRITERS;
+    const int rows = writers * CONFIG_EXAMPLE_DB_GROUP_COMMIT_ROWS;
+    writers_done = xSemaphoreCreateCounting(writers, 0);
+    if (writers_done == NULL) {
         return;
+    }
+    ESP_LOGI(TAG, "Starting %d writers of %d rows", writers, CONFIG_EXAMPLE_DB_GROUP_COMMIT_ROWS);
+    int64_t elapsed = run_writers(false);
+    ESP_LOGI(TAG, "Ungrouped: %d rows in %lld us (%lld rows/s), %d commits", rows, elapsed,
+             elapsed > 0 ? rows * 1000000LL / elapsed : 0, rows);
 
+    db_service_stats_t before, after;
+    db_service_get_stats(&before);
+    elapsed = run_writers(true);
+    db_service_get_stats(&after);
+    ESP_LOGI(TAG, "Grouped: %d rows in %lld us (%lld rows/s), %d commits", rows, elapsed,
+             elapsed > 0 ? rows * 1000000LL / elapsed : 0, (int)(after.commits - before.commits));
+    vSemaphoreDelete(writers_done);
+#endif
+}
 
-    // Creating DBs
-    create_db();
+#if CONFIG_EXAMPLE_DB_ASYNC
+typedef struct {
+    int id;
+    char content[32];
+} async_row_t;
 
-    // Perform database operations (e.g., create tables, insert data, select data).
+static const db_bind_column_t async_row_columns[] = {
+    DB_BIND_INT(async_row_t, id),
+    DB_BIND_TEXT_ARRAY(async_row_t, content),
+};
 
+/**
+ * @brief Insert one `async_row_t` into "test2", as a `db_async_write` function.
+ */
+static int insert_async_row(void *arg) {
+    return db_insert_exec(db2, "INSERT OR REPLACE INTO " DB2_SCHEMA ".test2 VALUES (?, ?)", async_row_columns,
+                          sizeof(async_row_columns) / sizeof(async_row_columns[0]), arg);
+}
+#endif
+
+/**
+ * @brief Run Telemetry Logging in Asynchronous Durability Mode
+ *
+ * This function writes `CONFIG_EXAMPLE_DB_ASYNC_ROWS` rows into "test2" with
+ * `db_async_write`, logs how long the writes took to be acknowledged, then calls
+ * `db_flush` and logs how long the rows stayed in RAM.
+ *
+ * @note
+ * - It must run outside the database service task, which commits the rows.
+ */
+void async_logging(){
+#if CONFIG_EXAMPLE_DB_ASYNC
+    async_row_t row;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < CONFIG_EXAMPLE_DB_ASYNC_ROWS; i++) {
+        row.id = 20000 + i;
+        snprintf(row.content, sizeof(row.content), "Reading %d", i);
+        if (db_async_write(db2, insert_async_row, &row, sizeof(row)) != SQLITE_OK) {
+            ESP_LOGW(TAG, "Asynchronous insert %d failed", row.id);
+        }
+    }
+    int64_t acked = esp_timer_get_time() - start;
+    int rc = db_flush();
+    int64_t flushed = esp_timer_get_time() - start;
+    db_async_stats_t stats;
+    db_async_get_stats(&stats);
+    ESP_LOGI(TAG, "%d rows acknowledged in %lld us, on flash after %lld us (%s), %d flushes, max %lld us in RAM",
+             CONFIG_EXAMPLE_DB_ASYNC_ROWS, acked, flushed, sqlite3_errstr(rc), (int)stats.flushes,
+             stats.max_loss_us);
+#endif
+}
+
+/**
+ * @brief Read the Captured Changes as a Sync Task Would
+ *
+ * This function drains the change data capture ring and logs, per table, how many
+ * rows were inserted, updated and deleted since capture started, and whether a
+ * full rescan was requested because changes were dropped.
+ *
+ * @note
+ * - Nothing is done unless `CONFIG_EXAMPLE_DB_CDC` is enabled.
+ * - It must run outside the database service task, which produces the changes.
+ */
+void sync_changes(){
+#if CONFIG_EXAMPLE_DB_CDC
+    static uint32_t counts[DB_CDC_MAX_TABLES][3];
+    db_cdc_record_t records[32];
+    uint32_t resyncs = 0;
+    size_t total = 0;
+    size_t n;
+    int64_t start = esp_timer_get_time();
+    while ((n = db_cdc_read(records, sizeof(records) / sizeof(records[0]), 0)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            if (records[i].op == DB_CDC_RESYNC) {
+                resyncs++;
+            } else if (records[i].table < DB_CDC_MAX_TABLES) {
+                int op = records[i].op == SQLITE_INSERT ? 0 : records[i].op == SQLITE_UPDATE ? 1 : 2;
+                counts[records[i].table][op]++;
+            }
+        }
+        total += n;
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    ESP_LOGI(TAG, "%d changes read in %lld us, %d resyncs", (int)total, elapsed, (int)resyncs);
+    for (int i = 0; i < DB_CDC_MAX_TABLES; i++) {
+        const char *schema;
+        const char *table = db_cdc_table(i, NULL, &schema);
+        if (table == NULL) {
+            break;
+        }
+        ESP_LOGI(TAG, "  %s.%s: %d inserted, %d updated, %d deleted", schema, table, (int)counts[i][0],
+                 (int)counts[i][1], (int)counts[i][2]);
+    }
+#endif
+}
+
+/**
+ * @brief Run the Example Database Operations
+ *
+ * This function performs the example inserts and selects. It is run on the database
+ * service task through `db_service_call`, which owns the connections while the
+ * service is running.
+ *
+ * @param arg - Unused.
+ *
+ * @return The result code of the last database operation.
+ */
+static int run_example(void *arg) {
     // Inserting data
     insert_data();
+    bulk_load_data();
+    stream_blob_data();
+    log_sensor_data();
+    apply_retention();
 
     // Selecting data
     select_data();
+    cached_queries();
+    log_memory_usage("After the example");
+    benchmark_queries();
+#if CONFIG_EXAMPLE_DB_VFS
+    db_vfs_log_stats();
+#endif
+    return rc;
+}
+
+/**
+ * @brief Register the Database Maintenance Idle Jobs
+ *
+ * This function schedules the maintenance run by the database service while no
+ * requests are queued.
+ */
+static void schedule_maintenance(){
+#if CONFIG_EXAMPLE_DB_IDLE_CHECKPOINT
+    db_checkpoint_config_t checkpoint = {
+        .db = db1,
+        .name = "test1_checkpoint",
+        .wal_autocheckpoint = CONFIG_EXAMPLE_DB_WAL_AUTOCHECKPOINT,
+    };
+    db_checkpoint_schedule(&checkpoint);
+    checkpoint.db = db2;
+    checkpoint.schema = DB2_SCHEMA;
+    checkpoint.name = "test2_checkpoint";
+    db_checkpoint_schedule(&checkpoint);
+#if !CONFIG_EXAMPLE_SPIFFS_GC_TASK
+    // Without the GC task, collect SPIFFS from the database service's idle time
+    db_checkpoint_schedule_spiffs_gc(NULL, CONFIG_EXAMPLE_DB_IDLE_SPIFFS_GC_BYTES);
+#endif
+#endif
+#if CONFIG_EXAMPLE_DB_INCREMENTAL_VACUUM
+    db_vacuum_config_t vacuum = {
+        .db = db1,
+        .name = "test1",
+        .min_free_pages = CONFIG_EXAMPLE_DB_VACUUM_MIN_FREE_PAGES,
+        .pages_per_step = CONFIG_EXAMPLE_DB_VACUUM_PAGES_PER_STEP,
+    };
+    db_vacuum_schedule(&vacuum);
+    vacuum.db = db2;
+    vacuum.schema = DB2_SCHEMA;
+    vacuum.name = "test2";
+    db_vacuum_schedule(&vacuum);
+#endif
+}
+
+/**
+ * @brief Replay Hot Journals and WALs after an Unclean Shutdown
+ *
+ * This function mounts SPIFFS and, if the previous session did not unmount it, replays
+ * the hot journals and WALs of "test1" and "test2" with `db_recovery_run` within
+ * `CONFIG_EXAMPLE_DB_RECOVERY_BUDGET_MS`, so the first queries run at their normal speed.
+ *
+ * @note
+ * - It must run before the databases are opened.
+ * - A failed replay is logged; SQLite retries it when the database is opened.
+ */
+void recover_databases(){
+#if CONFIG_EXAMPLE_DB_RECOVERY
+    if (storage_mount() != ESP_OK || !storage_was_unclean()) {
+        return;
+    }
+    db_recovery_file_t files[] = {
+        { .path = "/spiffs/test1.db" },
+        { .path = "/spiffs/test2.db" },
+    };
+    db_recovery_config_t config = DB_RECOVERY_CONFIG_DEFAULT();
+    db_recovery_run(files, sizeof(files) / sizeof(files[0]), &config);
+#endif
+}
+
+/**
+ * @brief Run the Example on the Open Databases
+ *
+ * This function starts the optional helpers (advisor, query cache, change data capture),
+ * hands the connections to the database service task, runs the example workloads and
+ * stops everything again, leaving only the connections to close.
+ *
+ * @note
+ * - It must only run once `create_db` (and `attach_databases`) succeeded.
+ */
+void run_databases(){
+#if CONFIG_EXAMPLE_DB_ADVISOR
+    if (db_advisor_start(db1, &advisor1) != SQLITE_OK) {
+        ESP_LOGW(TAG, "Query-plan advisor not started on test1");
+        advisor1 = NULL;
+    }
+    if (db2 != db1 && db_advisor_start(db2, &advisor2) != SQLITE_OK) {
+        ESP_LOGW(TAG, "Query-plan advisor not started on test2");
+        advisor2 = NULL;
+    }
+#endif
+
+#if CONFIG_EXAMPLE_DB_QCACHE
+    db_qcache_config_t qcache_config = DB_QCACHE_CONFIG_DEFAULT();
+    if (db_qcache_create(db1, &qcache_config, &qcache1) != SQLITE_OK) {
+        ESP_LOGW(TAG, "Query result cache not created");
+    }
+#endif
+#if CONFIG_EXAMPLE_DB_CDC
+    db_cdc_config_t cdc_config = DB_CDC_CONFIG_DEFAULT();
+    if (db_cdc_start(&cdc_config) != ESP_OK || db_cdc_attach(db1) != SQLITE_OK ||
+        (db2 != db1 && db_cdc_attach(db2) != SQLITE_OK)) {
+        ESP_LOGW(TAG, "Change data capture not started");
+    }
+#endif
+
+    // From here on the database service task owns the connections.
+    schedule_maintenance();
+    db_service_config_t service_config = DB_SERVICE_CONFIG_DEFAULT();
+    if (db_service_start(&service_config) != ESP_OK) {
+        ESP_LOGW(TAG, "Database service not started, running in app_main");
+    }
+#if CONFIG_EXAMPLE_DB_ASYNC
+    db_async_config_t async_config = DB_ASYNC_CONFIG_DEFAULT();
+    if (db_async_start(&async_config) != ESP_OK) {
+        ESP_LOGW(TAG, "Asynchronous writer not started, writes are synchronous");
+    }
+#endif
+
+    // Perform database operations (e.g., create tables, insert data, select data).
+    db_service_call(run_example, NULL);
+    group_commit_writers();
+    async_logging();
+    sync_changes();
+
+#if CONFIG_EXAMPLE_DB_SERVICE_RUN_SECONDS > 0
+    // Leave the service idle for a while so the maintenance jobs can run
+    vTaskDelay(pdMS_TO_TICKS(CONFIG_EXAMPLE_DB_SERVICE_RUN_SECONDS * 1000));
+#endif
+#if CONFIG_EXAMPLE_DB_ASYNC
+    db_async_stop();
+#endif
+    db_service_stop();
+
+#if CONFIG_EXAMPLE_DB_ADVISOR
+    if (advisor1) {
+        db_advisor_stop(advisor1);
+        advisor1 = NULL;
+    }
+    if (advisor2) {
+        db_advisor_stop(advisor2);
+        advisor2 = NULL;
+    }
+#endif
+
+#if CONFIG_EXAMPLE_DB_QCACHE
+    db_qcache_destroy(qcache1);
+    qcache1 = NULL;
+#endif
+
+#if CONFIG_EXAMPLE_DB_CDC
+    db_cdc_stop();
+#endif
+}
+
+void app_main()
+{
+#if CONFIG_EXAMPLE_DB_RESET_ON_BOOT
+    // Start from empty databases on every boot
+    if (storage_mount() != ESP_OK)
+        return;
+    unlink("/spiffs/test1.db");
+    unlink("/spiffs/test2.db");
+#endif
+
+#if CONFIG_EXAMPLE_DB_SHARED_PCACHE
+    // One page cache budget for all databases, installed before initializing
+#if CONFIG_EXAMPLE_DB_PCACHE_PSRAM_KB > 0
+    db_pcache_install_tiered(CONFIG_EXAMPLE_DB_PCACHE_BUDGET_KB * 1024, CONFIG_EXAMPLE_DB_PCACHE_PSRAM_KB * 1024);
+#else
+    db_pcache_install(CONFIG_EXAMPLE_DB_PCACHE_BUDGET_KB * 1024);
+#endif
+#endif
+
+    // Initialize SQLite library.
+    sqlite3_initialize();
+    ESP_LOGI(TAG, "SQLite %s", sqlite3_libversion());
+#if CONFIG_EXAMPLE_DB_VFS
+    db_vfs_config_t vfs_config = DB_VFS_CONFIG_DEFAULT();
+    if (db_vfs_register(&vfs_config) != SQLITE_OK) {
+        ESP_LOGW(TAG, "Buffering VFS not registered, using the default VFS");
+    }
+#endif
+
+    // Bounded replay of interrupted transactions, before anything uses the databases
+    recover_databases();
+
+    // Open SQLite databases. SPIFFS is mounted by the first db_open().
+    // A failure skips to the cleanup at the end, which handles what was set up.
+    ESP_LOGI(TAG, "Opening table test1");
+    rc = db_open("/spiffs/test1.db", &db1);
+#if CONFIG_EXAMPLE_TS_LOGGING
+    if (rc == SQLITE_OK) {
+        int ts_rc = ts_vtab_register(db1);
+        ts_logging = ts_rc == SQLITE_OK;
+        if (!ts_logging) {
+            ESP_LOGW(TAG, "Time-series module not registered, logging skipped: %s", sqlite3_errstr(ts_rc));
+        }
+    }
+#endif
+    if (rc == SQLITE_OK) {
+        ESP_LOGI(TAG, "Opening table test2");
+        rc = db_open("/spiffs/test2.db", &db2);
+    }
+
+#if CONFIG_EXAMPLE_SPIFFS_GC_TASK
+    // Keep erased pages available so commits rarely garbage-collect inline
+    spiffs_gc_task_config_t gc_config = SPIFFS_GC_TASK_CONFIG_DEFAULT();
+    if (rc == SQLITE_OK) {
+        spiffs_gc_task_start(&gc_config);
+    }
+#endif
+
+    // Creating DBs
+    if (rc == SQLITE_OK) {
+        create_db();
+    }
+#if CONFIG_EXAMPLE_DB_ATTACH
+    // One connection for both files from here on
+    if (rc == SQLITE_OK) {
+        attach_databases();
+    }
+#endif
+    if (rc == SQLITE_OK) {
+        run_databases();
+    }
 
     // Close SQLite databases.
-    sqlite3_close(db1);
-    sqlite3_close(db2);
+    close_databases();
+#if CONFIG_EXAMPLE_DB_VFS
+    db_vfs_unregister();
+#endif
 
     // Unmount partition and disable SPIFFS
-    esp_vfs_spiffs_unregister(NULL);
-    ESP_LOGI(TAG, "SPIFFS unmounted");
+    spiffs_gc_task_stop();
+    storage_unmount();
 
     //while(1);
 }
@@ -0,0 +1,129 @@
+/* SPIFFS storage management
+ *
+ * The partition is mounted on first use instead of unconditionally at the
+ * start of app_main(). A marker file is created after mounting and removed on
+ * a clean unmount; if it is still present at the next mount the previous
+ * session ended with a reset or power loss and `esp_spiffs_check` is run.
+ */
+#include <stdio.h>
+#include <sys/unistd.h>
+#include <sys/stat.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_spiffs.h"
+#include "esp_timer.h"
+#include "storage.h"
+
+static const char *TAG = "storage";
+
+#define STORAGE_DIRTY_MARKER STORAGE_BASE_PATH "/.dirty"
+
+#if CONFIG_EXAMPLE_SPIFFS_FORMAT_IF_MOUNT_FAILED
+#define STORAGE_FORMAT_IF_MOUNT_FAILED true
+#else
+#define STORAGE_FORMAT_IF_MOUNT_FAILED false
+#endif
+
+static bool mounted = false;
+static bool unclean = false;
+static int64_t mount_time_us = 0;
+
+/**
+ * @brief Create the unclean-shutdown marker.
+ *
+ * @return true if the marker file was written.
+ */
+static bool storage_mark_dirty(void) {
+    FILE *f = fopen(STORAGE_DIRTY_MARKER, "w");
+    if (f == NULL) {
+        return false;
+    }
+    fclose(f);
+    return true;
+}
+
+esp_err_t storage_mount(void) {
+    if (mounted) {
+        return ESP_OK;
+    }
+
+    ESP_LOGI(TAG, "Initializing SPIFFS");
+    int64_t start = esp_timer_get_time();
+
+    esp_vfs_spiffs_conf_t conf = {
+        .base_path = STORAGE_BASE_PATH,
+        .partition_label = NULL,
+        .max_files = CONFIG_EXAMPLE_SPIFFS_MAX_FILES,
+        .format_if_mount_failed = STORAGE_FORMAT_IF_MOUNT_FAILED
+    };
+
+    // Use settings defined above to initialize and mount SPIFFS filesystem.
+    // Note: esp_vfs_spiffs_register is an all-in-one convenience function.
+    esp_err_t ret = esp_vfs_spiffs_register(&conf);
+    if (ret != ESP_OK) {
+        if (ret == ESP_FAIL) {
+            ESP_LOGE(TAG, "Failed to mount or format filesystem");
+        } else if (ret == ESP_ERR_NOT_FOUND) {
+            ESP_LOGE(TAG, "Failed to find SPIFFS partition");
+        } else {
+            ESP_LOGE(TAG, "Failed to initialize SPIFFS (%s)", esp_err_to_name(ret));
+        }
+        return ret;
+    }
+
+    // A marker left over from the previous session means it never reached storage_unmount().
+    struct stat st;
+    unclean = (stat(STORAGE_DIRTY_MARKER, &st) == 0);
+    if (unclean) {
+#if CONFIG_EXAMPLE_SPIFFS_CHECK_AFTER_UNCLEAN_SHUTDOWN
+        ESP_LOGW(TAG, "Unclean shutdown detected, checking SPIFFS");
+        int64_t check_start = esp_timer_get_time();
+        ret = esp_spiffs_check(conf.partition_label);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "SPIFFS check failed (%s)", esp_err_to_name(ret));
+        } else {
+            ESP_LOGI(TAG, "SPIFFS check done in %lld us", esp_timer_get_time() - check_start);
+        }
+#else
+        ESP_LOGW(TAG, "Unclean shutdown detected, SPIFFS check disabled");
+#endif
+    } else if (!storage_mark_dirty()) {
+        ESP_LOGW(TAG, "Failed to create shutdown marker");
+    }
+
+    // Retrieve and log partition information.
+    size_t total = 0, used = 0;
+    ret = esp_spiffs_info(conf.partition_label, &total, &used);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to get SPIFFS partition information (%s)", esp_err_to_name(ret));
+    } else {
+        ESP_LOGI(TAG, "Partition size: total: %d, used: %d", total, used);
+    }
+
+    mounted = true;
+    mount_time_us = esp_timer_get_time() - start;
+    ESP_LOGI(TAG, "SPIFFS mounted in %lld us", mount_time_us);
+    return ESP_OK;
+}
+
+void storage_unmount(void) {
+    if (!mounted) {
+        return;
+    }
+    unlink(STORAGE_DIRTY_MARKER);
+    esp_vfs_spiffs_unregister(NULL);
+    mounted = false;
+    ESP_LOGI(TAG, "SPIFFS unmounted");
+}
+
+bool storage_is_mounted(void) {
+    return mounted;
+}
+
+bool storage_was_unclean(void) {
+    return unclean;
+}
+
+int64_t storage_mount_time_us(void) {
+    return mount_time_us;
+}
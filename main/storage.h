@@ -0,0 +1,68 @@
+/* SPIFFS storage management
+ *
+ * Lazy mounting of the SPIFFS partition that holds the SQLite databases, with
+ * an unclean-shutdown marker so the (slow) integrity check only runs when it
+ * is actually needed.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Mount point of the SPIFFS partition. */
+#define STORAGE_BASE_PATH "/spiffs"
+
+/**
+ * @brief Mount the SPIFFS partition if it is not mounted yet.
+ *
+ * The first call registers the SPIFFS VFS, runs `esp_spiffs_check` if the
+ * previous session did not unmount cleanly and then marks the partition as
+ * in use. Subsequent calls return immediately.
+ *
+ * @return
+ *  - ESP_OK if the partition is mounted.
+ *  - ESP_FAIL if mounting (or formatting) failed.
+ *  - ESP_ERR_NOT_FOUND if no SPIFFS partition was found.
+ *  - Other error codes from `esp_vfs_spiffs_register`.
+ */
+esp_err_t storage_mount(void);
+
+/**
+ * @brief Unmount the SPIFFS partition and record a clean shutdown.
+ *
+ * All files on the partition (in particular the databases) must be closed
+ * before calling this function.
+ */
+void storage_unmount(void);
+
+/**
+ * @brief Check whether the SPIFFS partition is currently mounted.
+ *
+ * @return true if `storage_mount` succeeded and `storage_unmount` was not called since.
+ */
+bool storage_is_mounted(void);
+
+/**
+ * @brief Check whether the last session ended without a clean unmount.
+ *
+ * Only meaningful after `storage_mount` returned ESP_OK.
+ *
+ * @return true if the unclean-shutdown marker was found at mount time.
+ */
+bool storage_was_unclean(void);
+
+/**
+ * @brief Time spent in `storage_mount`, in microseconds.
+ *
+ * @return Duration of the last successful mount, including the integrity check.
+ */
+int64_t storage_mount_time_us(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,1087 @@
+/* Append-only time-series tables
+ *
+ * See ts_vtab.h. Segment file layout, all integers little endian:
+ *
+ *     ts_seg_header_t   magic, row count, min/max id, payload length, CRC32
+ *     payload           per row: varint id delta, content type byte, value
+ *
+ * Ids are stored as deltas from the previous row (the first one from
+ * `min_id`), integers as zigzag varints and text/blobs as varint length plus
+ * bytes. A segment is written once with a single sequential write and never
+ * modified, which replaces the random B-tree page updates and journal writes
+ * of a regular table.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/unistd.h>
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "ts_vtab.h"
+
+static const char *TAG = "ts_vtab";
+
+#define TS_SEG_MAGIC        0x31475354  /* "TSG1" */
+#define TS_SEG_NAME_LEN     8           /* hex sequence number */
+#define TS_VARINT_MAX       10
+
+enum {
+    TS_TYPE_NULL = 0,
+    TS_TYPE_INTEGER,
+    TS_TYPE_FLOAT,
+    TS_TYPE_TEXT,
+    TS_TYPE_BLOB,
+};
+
+/* idxNum encoding used between xBestIndex and xFilter */
+#define TS_IDX_LO_MASK      0x03
+#define TS_IDX_LO_GE        0x01
+#define TS_IDX_LO_GT        0x02
+#define TS_IDX_LO_EQ        0x03
+#define TS_IDX_HI_LE        0x04
+#define TS_IDX_HI_LT        0x08
+#define TS_IDX_HI_MASK      0x0c
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t count;
+    int64_t min_id;
+    int64_t max_id;
+    uint32_t payload_len;
+    uint32_t crc;
+} ts_seg_header_t;
+
+/**
+ * @brief In-RAM index entry of a sealed segment.
+ */
+typedef struct {
+    uint32_t seq;
+    uint32_t count;
+    int64_t min_id;
+    int64_t max_id;
+    uint32_t bytes;
+} ts_segment_t;
+
+typedef struct {
+    int64_t id;
+    sqlite3_value *content;
+} ts_row_t;
+
+/**
+ * @brief Head buffer state restored when a transaction or savepoint is rolled back.
+ */
+typedef struct {
+    int nhead;
+    int64_t last_id;
+} ts_mark_t;
+
+typedef struct ts_table {
+    sqlite3_vtab base;
+    sqlite3 *db;
+    char *name;
+    char *dir;
+    int head_max;
+    ts_segment_t *segs;
+    int nseg;
+    int seg_cap;
+    uint32_t next_seq;
+    ts_row_t *head;
+    int nhead;
+    int head_cap;
+    int64_t last_id;        /* largest id in segments or head */
+    ts_mark_t committed;    /* state at xBegin, restored by xRollback; rows past it are uncommitted */
+    ts_mark_t *savepoints;  /* state at each savepoint level, restored by xRollbackTo */
+    int nsavepoint;
+    int savepoint_cap;
+    ts_vtab_retention_t retention;
+    uint32_t seg_rows;      /* rows in all segments */
+    uint32_t seg_bytes;     /* size of all segment files */
+    struct ts_table *next;
+} ts_table_t;
+
+typedef struct {
+    sqlite3_vtab_cursor base;
+    int64_t lo;
+    int64_t hi;
+    int seg;                /* current segment, == nseg once in the head buffer */
+    uint8_t *buf;           /* payload of the current segment */
+    uint32_t len;
+    uint32_t pos;
+    uint32_t remaining;     /* rows left in the current segment */
+    int head_idx;
+    bool eof;
+    /* current row */
+    int64_t id;
+    int type;
+    int64_t ival;
+    double dval;
+    const uint8_t *ptr;
+    uint32_t plen;
+    sqlite3_value *value;   /* set when the row comes from the head buffer */
+} ts_cursor_t;
+
+/**
+ * @brief Retention policy set for a table name, applied whenever the table is connected.
+ */
+typedef struct ts_policy {
+    struct ts_policy *next;
+    char *name;
+    ts_vtab_retention_t retention;
+} ts_policy_t;
+
+/**
+ * @brief Module client data of one connection.
+ */
+typedef struct ts_module_aux {
+    struct ts_module_aux *next;
+    sqlite3 *db;
+    ts_policy_t *policies;
+} ts_module_aux_t;
+
+// Open tables, for ts_vtab_flush()
+static ts_table_t *open_tables = NULL;
+
+// Connections with the module registered, for ts_vtab_set_retention()
+static ts_module_aux_t *registered = NULL;
+
+/* ---- encoding ---------------------------------------------------------- */
+
+static size_t ts_put_varint(uint8_t *p, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+static bool ts_get_varint(const uint8_t *p, uint32_t len, uint32_t *pos, uint64_t *v) {
+    uint64_t r = 0;
+    for (int shift = 0; shift < 64 && *pos < len; shift += 7) {
+        uint8_t b = p[(*pos)++];
+        r |= (uint64_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            *v = r;
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint64_t ts_zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t ts_unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/**
+ * @brief Upper bound of the encoded size of a head row.
+ */
+static size_t ts_row_max_size(const ts_row_t *row) {
+    size_t n = TS_VARINT_MAX + 1;
+    switch (sqlite3_value_type(row->content)) {
+    case SQLITE_TEXT:
+    case SQLITE_BLOB:
+        n += TS_VARINT_MAX + sqlite3_value_bytes(row->content);
+        break;
+    case SQLITE_FLOAT:
+        n += sizeof(double);
+        break;
+    case SQLITE_INTEGER:
+        n += TS_VARINT_MAX;
+        break;
+    default:
+        break;
+    }
+    return n;
+}
+
+static size_t ts_encode_row(uint8_t *p, int64_t prev_id, const ts_row_t *row) {
+    size_t n = ts_put_varint(p, (uint64_t)(row->id - prev_id));
+    sqlite3_value *v = row->content;
+    switch (sqlite3_value_type(v)) {
+    case SQLITE_INTEGER:
+        p[n++] = TS_TYPE_INTEGER;
+        n += ts_put_varint(p + n, ts_zigzag(sqlite3_value_int64(v)));
+        break;
+    case SQLITE_FLOAT: {
+        double d = sqlite3_value_double(v);
+        p[n++] = TS_TYPE_FLOAT;
+        memcpy(p + n, &d, sizeof(d));
+        n += sizeof(d);
+        break;
+    }
+    case SQLITE_TEXT:
+    case SQLITE_BLOB: {
+        bool text = sqlite3_value_type(v) == SQLITE_TEXT;
+        const void *data = text ? (const void *)sqlite3_value_text(v) : sqlite3_value_blob(v);
+        int bytes = sqlite3_value_bytes(v);
+        p[n++] = text ? TS_TYPE_TEXT : TS_TYPE_BLOB;
+        n += ts_put_varint(p + n, (uint64_t)bytes);
+        if (bytes > 0) {
+            memcpy(p + n, data, bytes);
+        }
+        n += bytes;
+        break;
+    }
+    default:
+        p[n++] = TS_TYPE_NULL;
+        break;
+    }
+    return n;
+}
+
+/* ---- segments ---------------------------------------------------------- */
+
+static void ts_segment_path(const ts_table_t *t, uint32_t seq, char *path, size_t size) {
+    snprintf(path, size, "%s/%08x", t->dir, (unsigned)seq);
+}
+
+static int ts_segment_append(ts_table_t *t, const ts_segment_t *seg) {
+    if (t->nseg == t->seg_cap) {
+        int cap = t->seg_cap ? t->seg_cap * 2 : 16;
+        ts_segment_t *segs = sqlite3_realloc(t->segs, cap * sizeof(ts_segment_t));
+        if (segs == NULL) {
+            return SQLITE_NOMEM;
+        }
+        t->segs = segs;
+        t->seg_cap = cap;
+    }
+    t->segs[t->nseg++] = *seg;
+    t->seg_rows += seg->count;
+    t->seg_bytes += seg->bytes;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Whether the table exceeds its retention policy even without its oldest segment.
+ */
+static bool ts_over_retention(const ts_table_t *t, const ts_segment_t *oldest) {
+    const ts_vtab_retention_t *r = &t->retention;
+    if (r->max_rows && t->seg_rows - oldest->count >= r->max_rows) {
+        return true;
+    }
+    if (r->max_bytes && t->seg_bytes - oldest->bytes >= r->max_bytes) {
+        return true;
+    }
+    if (r->max_age && oldest->max_id < t->last_id - r->max_age) {
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Delete the oldest segments while the retention policy is exceeded.
+ */
+static void ts_apply_retention(ts_table_t *t) {
+    int n = 0;
+    char path[64];
+    while (n < t->nseg && ts_over_retention(t, &t->segs[n])) {
+        const ts_segment_t *oldest = &t->segs[n];
+        ts_segment_path(t, oldest->seq, path, sizeof(path));
+        unlink(path);
+        t->seg_rows -= oldest->count;
+        t->seg_bytes -= oldest->bytes;
+        n++;
+    }
+    if (n > 0) {
+        memmove(t->segs, t->segs + n, (t->nseg - n) * sizeof(ts_segment_t));
+        t->nseg -= n;
+        ESP_LOGD(TAG, "%s: evicted %d segment(s), %d rows left", t->name, n, (int)t->seg_rows);
+    }
+}
+
+static void ts_head_clear(ts_table_t *t, int from) {
+    for (int i = from; i < t->nhead; i++) {
+        sqlite3_value_free(t->head[i].content);
+    }
+    t->nhead = from;
+}
+
+/**
+ * @brief Write the first `count` rows of the head buffer as a new segment and remove them.
+ */
+static int ts_seal(ts_table_t *t, int count) {
+    if (count == 0) {
+        return SQLITE_OK;
+    }
+
+    size_t max = sizeof(ts_seg_header_t);
+    for (int i = 0; i < count; i++) {
+        max += ts_row_max_size(&t->head[i]);
+    }
+    uint8_t *buf = sqlite3_malloc64(max);
+    if (buf == NULL) {
+        return SQLITE_NOMEM;
+    }
+
+    ts_seg_header_t hdr = {
+        .magic = TS_SEG_MAGIC,
+        .count = count,
+        .min_id = t->head[0].id,
+        .max_id = t->head[count - 1].id,
+    };
+    uint8_t *payload = buf + sizeof(hdr);
+    size_t len = 0;
+    int64_t prev = hdr.min_id;
+    for (int i = 0; i < count; i++) {
+        len += ts_encode_row(payload + len, prev, &t->head[i]);
+        prev = t->head[i].id;
+    }
+    hdr.payload_len = len;
+    hdr.crc = esp_rom_crc32_le(0, payload, len);
+    memcpy(buf, &hdr, sizeof(hdr));
+
+    char path[64];
+    ts_segment_path(t, t->next_seq, path, sizeof(path));
+    size_t total = sizeof(hdr) + len;
+    int rc = SQLITE_OK;
+    FILE *f = fopen(path, "wb");
+    if (f == NULL || fwrite(buf, 1, total, f) != total || fflush(f) != 0 || fsync(fileno(f)) != 0) {
+        rc = SQLITE_IOERR_WRITE;
+    }
+    if (f != NULL && fclose(f) != 0) {
+        rc = SQLITE_IOERR_WRITE;
+    }
+    sqlite3_free(buf);
+    if (rc != SQLITE_OK) {
+        ESP_LOGE(TAG, "%s: failed to write segment %s", t->name, path);
+        unlink(path);
+        return rc;
+    }
+
+    ts_segment_t seg = {
+        .seq = t->next_seq,
+        .count = hdr.count,
+        .min_id = hdr.min_id,
+        .max_id = hdr.max_id,
+        .bytes = total,
+    };
+    rc = ts_segment_append(t, &seg);
+    if (rc != SQLITE_OK) {
+        unlink(path);
+        return rc;
+    }
+    t->next_seq++;
+    ESP_LOGD(TAG, "%s: sealed segment %08x: %d rows, %d bytes, ids %lld..%lld", t->name, (unsigned)seg.seq,
+             (int)seg.count, (int)total, seg.min_id, seg.max_id);
+    for (int i = 0; i < count; i++) {
+        sqlite3_value_free(t->head[i].content);
+    }
+    memmove(t->head, t->head + count, (t->nhead - count) * sizeof(ts_row_t));
+    t->nhead -= count;
+    t->committed.nhead -= count;
+    for (int i = 0; i < t->nsavepoint; i++) {
+        t->savepoints[i].nhead -= count;
+    }
+    ts_apply_retention(t);
+    return SQLITE_OK;
+}
+
+static int ts_segment_cmp(const void *a, const void *b) {
+    uint32_t x = ((const ts_segment_t *)a)->seq, y = ((const ts_segment_t *)b)->seq;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Build the segment index from the segment file headers.
+ *
+ * Segments whose size does not match their header were torn by a power loss
+ * while being sealed and are removed.
+ */
+static int ts_load_segments(ts_table_t *t) {
+    DIR *dir = opendir(t->dir);
+    if (dir == NULL) {
+        // No segment written yet
+        return SQLITE_OK;
+    }
+    struct dirent *ent;
+    int rc = SQLITE_OK;
+    while (rc == SQLITE_OK && (ent = readdir(dir)) != NULL) {
+        char *end;
+        if (strlen(ent->d_name) != TS_SEG_NAME_LEN) {
+            continue;
+        }
+        uint32_t seq = strtoul(ent->d_name, &end, 16);
+        if (*end != '\0') {
+            continue;
+        }
+        char path[64];
+        ts_segment_path(t, seq, path, sizeof(path));
+        struct stat st;
+        ts_seg_header_t hdr;
+        FILE *f = fopen(path, "rb");
+        bool valid = f != NULL && fread(&hdr, sizeof(hdr), 1, f) == 1 && stat(path, &st) == 0 &&
+                     hdr.magic == TS_SEG_MAGIC && st.st_size == (off_t)(sizeof(hdr) + hdr.payload_len);
+        if (f != NULL) {
+            fclose(f);
+        }
+        if (!valid) {
+            ESP_LOGW(TAG, "%s: removing incomplete segment %s", t->name, path);
+            unlink(path);
+            continue;
+        }
+        ts_segment_t seg = {
+            .seq = seq,
+            .count = hdr.count,
+            .min_id = hdr.min_id,
+            .max_id = hdr.max_id,
+            .bytes = st.st_size,
+        };
+        rc = ts_segment_append(t, &seg);
+    }
+    closedir(dir);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+
+    qsort(t->segs, t->nseg, sizeof(ts_segment_t), ts_segment_cmp);
+    if (t->nseg > 0) {
+        t->next_seq = t->segs[t->nseg - 1].seq + 1;
+        t->last_id = t->segs[t->nseg - 1].max_id;
+    }
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Read and verify the payload of a segment.
+ */
+static int ts_read_segment(const ts_table_t *t, const ts_segment_t *seg, uint8_t **buf, uint32_t *len) {
+    char path[64];
+    ts_segment_path(t, seg->seq, path, sizeof(path));
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return SQLITE_IOERR_READ;
+    }
+    ts_seg_header_t hdr;
+    uint8_t *p = NULL;
+    int rc = SQLITE_OK;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != TS_SEG_MAGIC) {
+        rc = SQLITE_CORRUPT;
+    } else if ((p = sqlite3_malloc64(hdr.payload_len ? hdr.payload_len : 1)) == NULL) {
+        rc = SQLITE_NOMEM;
+    } else if (fread(p, 1, hdr.payload_len, f) != hdr.payload_len) {
+        rc = SQLITE_IOERR_READ;
+    } else if (esp_rom_crc32_le(0, p, hdr.payload_len) != hdr.crc) {
+        ESP_LOGE(TAG, "%s: CRC mismatch in segment %s", t->name, path);
+        rc = SQLITE_CORRUPT;
+    }
+    fclose(f);
+    if (rc != SQLITE_OK) {
+        sqlite3_free(p);
+        return rc;
+    }
+    *buf = p;
+    *len = hdr.payload_len;
+    return SQLITE_OK;
+}
+
+/* ---- table ------------------------------------------------------------- */
+
+static void ts_table_free(ts_table_t *t) {
+    for (ts_table_t **pp = &open_tables; *pp; pp = &(*pp)->next) {
+        if (*pp == t) {
+            *pp = t->next;
+            break;
+        }
+    }
+    ts_head_clear(t, 0);
+    sqlite3_free(t->head);
+    sqlite3_free(t->savepoints);
+    sqlite3_free(t->segs);
+    sqlite3_free(t->name);
+    sqlite3_free(t->dir);
+    sqlite3_free(t);
+}
+
+/**
+ * @brief Copy a module argument, removing SQL quotes.
+ */
+static char *ts_unquote(const char *arg) {
+    size_t len = strlen(arg);
+    if (len >= 2 && (arg[0] == '\'' || arg[0] == '"') && arg[len - 1] == arg[0]) {
+        return sqlite3_mprintf("%.*s", (int)len - 2, arg + 1);
+    }
+    return sqlite3_mprintf("%s", arg);
+}
+
+static int ts_connect(sqlite3 *db, void *aux, int argc, const char *const *argv, sqlite3_vtab **vtab,
+                      char **err) {
+    if (argc < 4) {
+        *err = sqlite3_mprintf("tseries: usage: tseries(directory [, head_rows])");
+        return SQLITE_ERROR;
+    }
+    ts_table_t *t = sqlite3_malloc(sizeof(ts_table_t));
+    if (t == NULL) {
+        return SQLITE_NOMEM;
+    }
+    memset(t, 0, sizeof(*t));
+    t->db = db;
+    t->name = sqlite3_mprintf("%s", argv[2]);
+    t->dir = ts_unquote(argv[3]);
+    t->head_max = argc > 4 ? atoi(argv[4]) : TS_VTAB_DEFAULT_HEAD_ROWS;
+    t->last_id = INT64_MIN;
+    if (t->name == NULL || t->dir == NULL) {
+        ts_table_free(t);
+        return SQLITE_NOMEM;
+    }
+    if (t->head_max <= 0) {
+        *err = sqlite3_mprintf("tseries: head_rows must be positive");
+        ts_table_free(t);
+        return SQLITE_ERROR;
+    }
+
+    int rc = sqlite3_declare_vtab(db, "CREATE TABLE x(id INTEGER, content)");
+    if (rc == SQLITE_OK) {
+        // Directories are implicit on SPIFFS; this only matters for other file systems
+        mkdir(t->dir, 0755);
+        rc = ts_load_segments(t);
+    }
+    if (rc != SQLITE_OK) {
+        ts_table_free(t);
+        return rc;
+    }
+    t->next = open_tables;
+    open_tables = t;
+    ESP_LOGI(TAG, "%s: %d segment(s) in %s", t->name, t->nseg, t->dir);
+    const ts_module_aux_t *module = aux;
+    for (const ts_policy_t *p = module ? module->policies : NULL; p; p = p->next) {
+        if (sqlite3_stricmp(p->name, t->name) == 0) {
+            t->retention = p->retention;
+            ts_apply_retention(t);
+            break;
+        }
+    }
+    *vtab = &t->base;
+    return SQLITE_OK;
+}
+
+static int ts_disconnect(sqlite3_vtab *vtab) {
+    ts_table_t *t = (ts_table_t *)vtab;
+    if (ts_seal(t, t->nhead) != SQLITE_OK) {
+        ESP_LOGE(TAG, "%s: %d buffered row(s) lost", t->name, t->nhead);
+    }
+    ts_table_free(t);
+    return SQLITE_OK;
+}
+
+static int ts_destroy(sqlite3_vtab *vtab) {
+    ts_table_t *t = (ts_table_t *)vtab;
+    char path[64];
+    for (int i = 0; i < t->nseg; i++) {
+        ts_segment_path(t, t->segs[i].seq, path, sizeof(path));
+        unlink(path);
+    }
+    ts_table_free(t);
+    return SQLITE_OK;
+}
+
+static int ts_best_index(sqlite3_vtab *vtab, sqlite3_index_info *info) {
+    int lo = -1, hi = -1, lo_op = 0, hi_op = 0;
+    for (int i = 0; i < info->nConstraint; i++) {
+        const struct sqlite3_index_constraint *c = &info->aConstraint[i];
+        if (!c->usable || (c->iColumn != 0 && c->iColumn != -1)) {
+            continue;
+        }
+        switch (c->op) {
+        case SQLITE_INDEX_CONSTRAINT_EQ:
+            lo = i;
+            lo_op = TS_IDX_LO_EQ;
+            break;
+        case SQLITE_INDEX_CONSTRAINT_GE:
+        case SQLITE_INDEX_CONSTRAINT_GT:
+            if (lo_op != TS_IDX_LO_EQ) {
+                lo = i;
+                lo_op = c->op == SQLITE_INDEX_CONSTRAINT_GE ? TS_IDX_LO_GE : TS_IDX_LO_GT;
+            }
+            break;
+        case SQLITE_INDEX_CONSTRAINT_LE:
+        case SQLITE_INDEX_CONSTRAINT_LT:
+            hi = i;
+            hi_op = c->op == SQLITE_INDEX_CONSTRAINT_LE ? TS_IDX_HI_LE : TS_IDX_HI_LT;
+            break;
+        default:
+            break;
+        }
+    }
+    if (lo_op == TS_IDX_LO_EQ) {
+        hi = -1;
+        hi_op = 0;
+    }
+
+    // Bounds only prune segments; SQLite still checks every constraint
+    int argv_index = 1;
+    if (lo >= 0) {
+        info->aConstraintUsage[lo].argvIndex = argv_index++;
+    }
+    if (hi >= 0) {
+        info->aConstraintUsage[hi].argvIndex = argv_index++;
+    }
+    info->idxNum = lo_op | hi_op;
+    if (lo_op == TS_IDX_LO_EQ) {
+        info->estimatedCost = 10;
+        info->estimatedRows = 1;
+    } else if (lo >= 0 && hi >= 0) {
+        info->estimatedCost = 1000;
+        info->estimatedRows = 1000;
+    } else if (lo >= 0 || hi >= 0) {
+        info->estimatedCost = 100000;
+        info->estimatedRows = 100000;
+    } else {
+        info->estimatedCost = 1000000;
+        info->estimatedRows = 1000000;
+    }
+    if (info->nOrderBy == 1 && (info->aOrderBy[0].iColumn == 0 || info->aOrderBy[0].iColumn == -1) &&
+        !info->aOrderBy[0].desc) {
+        info->orderByConsumed = 1;
+    }
+    return SQLITE_OK;
+}
+
+static int ts_open(sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor) {
+    ts_cursor_t *c = sqlite3_malloc(sizeof(ts_cursor_t));
+    if (c == NULL) {
+        return SQLITE_NOMEM;
+    }
+    memset(c, 0, sizeof(*c));
+    *cursor = &c->base;
+    return SQLITE_OK;
+}
+
+static int ts_close(sqlite3_vtab_cursor *cursor) {
+    ts_cursor_t *c = (ts_cursor_t *)cursor;
+    sqlite3_free(c->buf);
+    sqlite3_free(c);
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Decode the next row of the current segment into the cursor.
+ */
+static int ts_decode_row(ts_cursor_t *c) {
+    uint64_t delta, v;
+    if (!ts_get_varint(c->buf, c->len, &c->pos, &delta) || c->pos >= c->len) {
+        return SQLITE_CORRUPT;
+    }
+    c->id += (int64_t)delta;
+    c->type = c->buf[c->pos++];
+    c->value = NULL;
+    switch (c->type) {
+    case TS_TYPE_NULL:
+        break;
+    case TS_TYPE_INTEGER:
+        if (!ts_get_varint(c->buf, c->len, &c->pos, &v)) {
+            return SQLITE_CORRUPT;
+        }
+        c->ival = ts_unzigzag(v);
+        break;
+    case TS_TYPE_FLOAT:
+        if (c->len - c->pos < sizeof(double)) {
+            return SQLITE_CORRUPT;
+        }
+        memcpy(&c->dval, c->buf + c->pos, sizeof(double));
+        c->pos += sizeof(double);
+        break;
+    case TS_TYPE_TEXT:
+    case TS_TYPE_BLOB:
+        if (!ts_get_varint(c->buf, c->len, &c->pos, &v) || v > c->len - c->pos) {
+            return SQLITE_CORRUPT;
+        }
+        c->ptr = c->buf + c->pos;
+        c->plen = (uint32_t)v;
+        c->pos += c->plen;
+        break;
+    default:
+        return SQLITE_CORRUPT;
+    }
+    c->remaining--;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Advance to the next row in id order, loading segments as needed.
+ */
+static int ts_step(ts_cursor_t *c) {
+    ts_table_t *t = (ts_table_t *)c->base.pVtab;
+    while (true) {
+        if (c->seg < t->nseg) {
+            if (c->buf == NULL) {
+                const ts_segment_t *seg = &t->segs[c->seg];
+                if (seg->min_id > c->hi) {
+                    c->eof = true;
+                    return SQLITE_OK;
+                }
+                int rc = ts_read_segment(t, seg, &c->buf, &c->len);
+                if (rc != SQLITE_OK) {
+                    return rc;
+                }
+                c->pos = 0;
+                c->remaining = seg->count;
+                c->id = seg->min_id;
+            }
+            if (c->remaining == 0) {
+                sqlite3_free(c->buf);
+                c->buf = NULL;
+                c->seg++;
+                continue;
+            }
+            int rc = ts_decode_row(c);
+            if (rc != SQLITE_OK) {
+                return rc;
+            }
+        } else if (c->head_idx < t->nhead) {
+            const ts_row_t *row = &t->head[c->head_idx++];
+            c->id = row->id;
+            c->value = row->content;
+        } else {
+            c->eof = true;
+            return SQLITE_OK;
+        }
+
+        if (c->id > c->hi) {
+            c->eof = true;
+            return SQLITE_OK;
+        }
+        if (c->id >= c->lo) {
+            return SQLITE_OK;
+        }
+    }
+}
+
+/**
+ * @brief Convert a constraint value to an inclusive integer bound.
+ *
+ * Bounds only need to be a superset of the matching rows; non-numeric values
+ * leave the bound open.
+ */
+static int64_t ts_bound(sqlite3_value *v, bool lower, bool strict, int64_t open) {
+    switch (sqlite3_value_numeric_type(v)) {
+    case SQLITE_INTEGER: {
+        int64_t i = sqlite3_value_int64(v);
+        if (strict) {
+            return lower ? (i == INT64_MAX ? i : i + 1) : (i == INT64_MIN ? i : i - 1);
+        }
+        return i;
+    }
+    case SQLITE_FLOAT: {
+        double d = sqlite3_value_double(v);
+        if (d >= 9.2e18 || d <= -9.2e18) {
+            return open;
+        }
+        return lower ? (int64_t)d - 1 : (int64_t)d + 1;
+    }
+    default:
+        return open;
+    }
+}
+
+static int ts_filter(sqlite3_vtab_cursor *cursor, int idx_num, const char *idx_str, int argc,
+                     sqlite3_value **argv) {
+    ts_cursor_t *c = (ts_cursor_t *)cursor;
+    ts_table_t *t = (ts_table_t *)cursor->pVtab;
+    int arg = 0;
+
+    sqlite3_free(c->buf);
+    c->buf = NULL;
+    c->eof = false;
+    c->head_idx = 0;
+    c->lo = INT64_MIN;
+    c->hi = INT64_MAX;
+    switch (idx_num & TS_IDX_LO_MASK) {
+    case TS_IDX_LO_EQ:
+        c->lo = ts_bound(argv[arg], true, false, INT64_MIN);
+        c->hi = ts_bound(argv[arg++], false, false, INT64_MAX);
+        break;
+    case TS_IDX_LO_GE:
+    case TS_IDX_LO_GT:
+        c->lo = ts_bound(argv[arg++], true, (idx_num & TS_IDX_LO_MASK) == TS_IDX_LO_GT, INT64_MIN);
+        break;
+    default:
+        break;
+    }
+    if (idx_num & TS_IDX_HI_MASK) {
+        c->hi = ts_bound(argv[arg++], false, (idx_num & TS_IDX_HI_MASK) == TS_IDX_HI_LT, INT64_MAX);
+    }
+
+    // Segments are ordered by id: skip the ones entirely below the lower bound
+    int first = 0, last = t->nseg;
+    while (first < last) {
+        int mid = (first + last) / 2;
+        if (t->segs[mid].max_id < c->lo) {
+            first = mid + 1;
+        } else {
+            last = mid;
+        }
+    }
+    c->seg = first;
+    return ts_step(c);
+}
+
+static int ts_next(sqlite3_vtab_cursor *cursor) {
+    return ts_step((ts_cursor_t *)cursor);
+}
+
+static int ts_eof(sqlite3_vtab_cursor *cursor) {
+    return ((ts_cursor_t *)cursor)->eof;
+}
+
+static int ts_column(sqlite3_vtab_cursor *cursor, sqlite3_context *ctx, int col) {
+    ts_cursor_t *c = (ts_cursor_t *)cursor;
+    if (col == 0) {
+        sqlite3_result_int64(ctx, c->id);
+        return SQLITE_OK;
+    }
+    if (c->value != NULL) {
+        sqlite3_result_value(ctx, c->value);
+        return SQLITE_OK;
+    }
+    switch (c->type) {
+    case TS_TYPE_INTEGER:
+        sqlite3_result_int64(ctx, c->ival);
+        break;
+    case TS_TYPE_FLOAT:
+        sqlite3_result_double(ctx, c->dval);
+        break;
+    case TS_TYPE_TEXT:
+        sqlite3_result_text(ctx, (const char *)c->ptr, c->plen, SQLITE_TRANSIENT);
+        break;
+    case TS_TYPE_BLOB:
+        sqlite3_result_blob(ctx, c->ptr, c->plen, SQLITE_TRANSIENT);
+        break;
+    default:
+        sqlite3_result_null(ctx);
+        break;
+    }
+    return SQLITE_OK;
+}
+
+static int ts_rowid(sqlite3_vtab_cursor *cursor, sqlite_int64 *rowid) {
+    *rowid = ((ts_cursor_t *)cursor)->id;
+    return SQLITE_OK;
+}
+
+static int ts_update(sqlite3_vtab *vtab, int argc, sqlite3_value **argv, sqlite_int64 *rowid) {
+    ts_table_t *t = (ts_table_t *)vtab;
+    if (argc == 1 || sqlite3_value_type(argv[0]) != SQLITE_NULL) {
+        sqlite3_free(vtab->zErrMsg);
+        vtab->zErrMsg = sqlite3_mprintf("tseries: %s is append-only", t->name);
+        return SQLITE_READONLY;
+    }
+
+    int64_t id;
+    if (sqlite3_value_type(argv[2]) != SQLITE_NULL) {
+        id = sqlite3_value_int64(argv[2]);
+    } else if (sqlite3_value_type(argv[1]) != SQLITE_NULL) {
+        id = sqlite3_value_int64(argv[1]);
+    } else {
+        id = t->last_id == INT64_MIN ? 1 : t->last_id + 1;
+    }
+    if (t->last_id != INT64_MIN && id <= t->last_id) {
+        sqlite3_free(vtab->zErrMsg);
+        vtab->zErrMsg = sqlite3_mprintf("tseries: id %lld is not greater than %lld", id, t->last_id);
+        return SQLITE_CONSTRAINT;
+    }
+
+    if (t->nhead == t->head_cap) {
+        int cap = t->head_cap ? t->head_cap * 2 : t->head_max;
+        ts_row_t *head = sqlite3_realloc(t->head, cap * sizeof(ts_row_t));
+        if (head == NULL) {
+            return SQLITE_NOMEM;
+        }
+        t->head = head;
+        t->head_cap = cap;
+    }
+    sqlite3_value *content = sqlite3_value_dup(argv[3]);
+    if (content == NULL) {
+        return SQLITE_NOMEM;
+    }
+    t->head[t->nhead].id = id;
+    t->head[t->nhead].content = content;
+    t->nhead++;
+    t->last_id = id;
+    *rowid = id;
+    return SQLITE_OK;
+}
+
+static int ts_begin(sqlite3_vtab *vtab) {
+    ts_table_t *t = (ts_table_t *)vtab;
+    t->committed = (ts_mark_t) { .nhead = t->nhead, .last_id = t->last_id };
+    t->nsavepoint = 0;
+    return SQLITE_OK;
+}
+
+static int ts_commit(sqlite3_vtab *vtab) {
+    ts_table_t *t = (ts_table_t *)vtab;
+    t->committed = (ts_mark_t) { .nhead = t->nhead, .last_id = t->last_id };
+    t->nsavepoint = 0;
+    // Seal only once committed, so rolled back rows never reach flash. A failed
+    // seal keeps the rows in the head buffer and is retried on the next commit.
+    if (t->nhead >= t->head_max) {
+        ts_seal(t, t->nhead);
+    }
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Drop the rows written after `mark`.
+ */
+static void ts_restore(ts_table_t *t, const ts_mark_t *mark) {
+    if (t->nhead > mark->nhead) {
+        ts_head_clear(t, mark->nhead);
+        t->last_id = mark->last_id;
+    }
+}
+
+static int ts_rollback(sqlite3_vtab *vtab) {
+    ts_table_t *t = (ts_table_t *)vtab;
+    ts_restore(t, &t->committed);
+    t->nsavepoint = 0;
+    return SQLITE_OK;
+}
+
+static int ts_savepoint(sqlite3_vtab *vtab, int level) {
+    ts_table_t *t = (ts_table_t *)vtab;
+    if (level >= t->savepoint_cap) {
+        int cap = level + 4;
+        ts_mark_t *savepoints = sqlite3_realloc(t->savepoints, cap * sizeof(ts_mark_t));
+        if (savepoints == NULL) {
+            return SQLITE_NOMEM;
+        }
+        t->savepoints = savepoints;
+        t->savepoint_cap = cap;
+    }
+    // Levels opened before the table joined the transaction hold the current state too
+    while (t->nsavepoint < level) {
+        t->savepoints[t->nsavepoint++] = (ts_mark_t) { .nhead = t->nhead, .last_id = t->last_id };
+    }
+    t->savepoints[level] = (ts_mark_t) { .nhead = t->nhead, .last_id = t->last_id };
+    t->nsavepoint = level + 1;
+    return SQLITE_OK;
+}
+
+static int ts_release(sqlite3_vtab *vtab, int level) {
+    ts_table_t *t = (ts_table_t *)vtab;
+    if (level < t->nsavepoint) {
+        t->nsavepoint = level;
+    }
+    return SQLITE_OK;
+}
+
+static int ts_rollback_to(sqlite3_vtab *vtab, int level) {
+    ts_table_t *t = (ts_table_t *)vtab;
+    // Also undoes the rows of a failed statement, which runs under its own savepoint
+    if (level < t->nsavepoint) {
+        ts_restore(t, &t->savepoints[level]);
+        t->nsavepoint = level + 1;
+    }
+    return SQLITE_OK;
+}
+
+static sqlite3_module ts_module = {
+    .iVersion = 2,
+    .xCreate = ts_connect,
+    .xConnect = ts_connect,
+    .xBestIndex = ts_best_index,
+    .xDisconnect = ts_disconnect,
+    .xDestroy = ts_destroy,
+    .xOpen = ts_open,
+    .xClose = ts_close,
+    .xFilter = ts_filter,
+    .xNext = ts_next,
+    .xEof = ts_eof,
+    .xColumn = ts_column,
+    .xRowid = ts_rowid,
+    .xUpdate = ts_update,
+    .xBegin = ts_begin,
+    .xCommit = ts_commit,
+    .xRollback = ts_rollback,
+    .xSavepoint = ts_savepoint,
+    .xRelease = ts_release,
+    .xRollbackTo = ts_rollback_to,
+};
+
+/**
+ * @brief Free the module client data when the connection closes or the module is replaced.
+ */
+static void ts_module_aux_free(void *arg) {
+    ts_module_aux_t *module = arg;
+    for (ts_module_aux_t **pp = &registered; *pp; pp = &(*pp)->next) {
+        if (*pp == module) {
+            *pp = module->next;
+            break;
+        }
+    }
+    while (module->policies) {
+        ts_policy_t *p = module->policies;
+        module->policies = p->next;
+        sqlite3_free(p->name);
+        sqlite3_free(p);
+    }
+    sqlite3_free(module);
+}
+
+int ts_vtab_register(sqlite3 *db) {
+    ts_module_aux_t *module = sqlite3_malloc(sizeof(ts_module_aux_t));
+    if (module == NULL) {
+        return SQLITE_NOMEM;
+    }
+    memset(module, 0, sizeof(*module));
+    module->db = db;
+    module->next = registered;
+    registered = module;
+    // On failure SQLite calls the destructor, which unlinks the client data again
+    return sqlite3_create_module_v2(db, "tseries", &ts_module, module, ts_module_aux_free);
+}
+
+int ts_vtab_set_retention(sqlite3 *db, const char *table, const ts_vtab_retention_t *retention) {
+    ts_module_aux_t *module = registered;
+    while (module && module->db != db) {
+        module = module->next;
+    }
+    if (module == NULL) {
+        return SQLITE_MISUSE;
+    }
+    ts_policy_t *p = module->policies;
+    while (p && sqlite3_stricmp(p->name, table) != 0) {
+        p = p->next;
+    }
+    if (p == NULL) {
+        p = sqlite3_malloc(sizeof(ts_policy_t));
+        if (p == NULL) {
+            return SQLITE_NOMEM;
+        }
+        p->name = sqlite3_mprintf("%s", table);
+        if (p->name == NULL) {
+            sqlite3_free(p);
+            return SQLITE_NOMEM;
+        }
+        p->next = module->policies;
+        module->policies = p;
+    }
+    p->retention = *retention;
+
+    for (ts_table_t *t = open_tables; t; t = t->next) {
+        if (t->db == db && sqlite3_stricmp(t->name, table) == 0) {
+            t->retention = *retention;
+            ts_apply_retention(t);
+        }
+    }
+    return SQLITE_OK;
+}
+
+int ts_vtab_flush(sqlite3 *db, const char *table) {
+    for (ts_table_t *t = open_tables; t; t = t->next) {
+        if (t->db == db && sqlite3_stricmp(t->name, table) == 0) {
+            // Rows of a transaction that has not committed yet stay in the head buffer
+            return ts_seal(t, t->committed.nhead);
+        }
+    }
+    return SQLITE_NOTFOUND;
+}
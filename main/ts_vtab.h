@@ -0,0 +1,104 @@
+/* Append-only time-series tables
+ *
+ * SQLite virtual table module "tseries" for rows with strictly increasing
+ * integer ids, as written by continuous sensor logging. New rows are kept in a
+ * small RAM head buffer; when the buffer is full it is sealed into an
+ * immutable segment file on SPIFFS, with delta-encoded ids and varint
+ * integers; text and blob content is stored as is. Every segment records the
+ * min/max id it holds so range queries on `id` only read the segments that can
+ * match.
+ *
+ *     CREATE VIRTUAL TABLE test1_ts USING tseries('/spiffs/ts1', 64);
+ *     INSERT INTO test1_ts VALUES (1, 'reading');
+ *     SELECT * FROM test1_ts WHERE id BETWEEN 100 AND 200;
+ *
+ * Arguments are the directory prefix of the segment files and the number of
+ * rows buffered in RAM before a segment is sealed. Rows still in the head
+ * buffer are lost on power loss; it is sealed on commit once full, on
+ * `ts_vtab_flush` and when the connection is closed.
+ *
+ * Rows written in a transaction stay in the head buffer until it commits, so
+ * a rolled back transaction or savepoint, or a statement that fails partway,
+ * leaves no rows behind and never reaches flash.
+ *
+ * With a retention policy the table behaves as a ring buffer: once a limit is
+ * exceeded the oldest segments are deleted whole, one file unlink each, so
+ * eviction cost does not grow with the amount of data kept.
+ */
+#pragma once
+
+#include <stdint.h>
+#include "sqlite3.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Default number of rows buffered in RAM before a segment is sealed. */
+#define TS_VTAB_DEFAULT_HEAD_ROWS 64
+
+/**
+ * @brief Retention policy of a time-series table. Limits set to 0 are disabled.
+ *
+ * Limits are enforced with segment granularity: the oldest segment is only
+ * evicted once the table is still over the limit without it.
+ */
+typedef struct {
+    uint32_t max_rows;      /*!< Maximum number of rows kept in segments */
+    uint32_t max_bytes;     /*!< Maximum total size of the segment files */
+    int64_t max_age;        /*!< Segments whose newest id is older than last id - max_age are evicted */
+} ts_vtab_retention_t;
+
+/**
+ * @brief Register the "tseries" module on a database connection.
+ *
+ * Must be called on every connection that uses a time-series table, before
+ * the table is created or queried.
+ *
+ * @param db - A pointer to the SQLite database connection.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - An SQLite error code on failure.
+ */
+int ts_vtab_register(sqlite3 *db);
+
+/**
+ * @brief Seal the head buffer of a time-series table into a segment.
+ *
+ * Use as a durability barrier, e.g. before a planned shutdown. Rows of a
+ * transaction that has not committed yet stay in the head buffer.
+ *
+ * @param db - Connection the table was opened on.
+ * @param table - Name of the virtual table.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success, or if the head buffer was empty.
+ *  - SQLITE_NOTFOUND if no such table is open on `db`.
+ *  - SQLITE_IOERR if the segment could not be written.
+ */
+int ts_vtab_flush(sqlite3 *db, const char *table);
+
+/**
+ * @brief Set the retention policy of a time-series table.
+ *
+ * The policy is kept with the module of the connection and applied whenever
+ * the table is connected, immediately if it is already open, and after every
+ * sealed segment. It may be set before the table is created or first used.
+ * It is not stored in the database and has to be set again after reopening
+ * the connection.
+ *
+ * @param db - Connection the module was registered on.
+ * @param table - Name of the virtual table.
+ * @param retention - Retention policy, copied.
+ *
+ * @return
+ *  - SQLITE_OK (0) on success.
+ *  - SQLITE_MISUSE if `ts_vtab_register` was not called on `db`.
+ *  - SQLITE_NOMEM if the policy cannot be stored.
+ */
+int ts_vtab_set_retention(sqlite3 *db, const char *table, const ts_vtab_retention_t *retention);
+
+#ifdef __cplusplus
+}
+#endif
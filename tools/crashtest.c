@@ -0,0 +1,671 @@
+/* Power-loss crash-consistency harness
+ *
+ * Runs an `insert_data`-style workload (one INSERT OR REPLACE into test1 per
+ * transaction) on the host and cuts the power at the Nth flash write, for
+ * N = step, 2 * step, ... until the workload completes. After each cut the
+ * database is reopened as after a reboot, the hot journal or WAL is recovered
+ * and checked with `PRAGMA integrity_check`, and the rows acknowledged before
+ * the cut are counted. The result is a table of recovery time, corruption and
+ * lost acknowledged transactions per journal mode and `synchronous` setting.
+ *
+ * The write paths of the application are under test, built from main/ with
+ * the host port in tools/host: the "vfs/" modes open the database through the
+ * write-coalescing VFS of db_vfs.h, so cuts also hit writes still buffered in
+ * RAM, and the "async" modes write through db_async.h and the database
+ * service, so cuts hit a batch while it is being committed. In the async
+ * modes a record counts as acknowledged once `db_async_write` returned.
+ *
+ * Flash is modelled by a VFS shim over the host VFS, with the semantics of the
+ * SPIFFS driver: writes reach flash in the order they are issued, the write
+ * that is cut is torn after a random number of bytes, and nothing is written
+ * after it. With `-c` writes are also held in a write cache (`CONFIG_SPIFFS_CACHE_WR`)
+ * until the file is synced, so a cut drops every unsynced write. Syncs are not
+ * passed to the host, which keeps a full sweep to seconds.
+ *
+ * The modules from main/ are built with the warning flags of ESP-IDF, which
+ * include -Wno-unused-parameter.
+ *
+ * Usage:
+ *   cc -O2 -Wall -Wextra -Wno-unused-parameter -Itools/host -Imain -o build/crashtest tools/crashtest.c \
+ *      tools/host/host_port.c main/db_vfs.c main/db_async.c main/db_service.c -lsqlite3 -lpthread
+ *   build/crashtest                     # every mode, a cut at every write
+ *   build/crashtest -n 200 -e 5 -c      # 200 transactions, a cut at every 5th write, write cache
+ *   build/crashtest -m vfs/wal/normal   # one mode
+ *
+ * Exits with 1 if a database was corrupted, or if a mode that promises
+ * durability (synchronous=FULL, or NORMAL in a rollback journal mode) lost an
+ * acknowledged transaction.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "sqlite3.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "db_async.h"
+#include "db_service.h"
+#include "db_vfs.h"
+
+#define CRASH_VFS_NAME "crash"
+#define CRASH_MAX_FILES 8
+
+typedef struct {
+    const char *name;
+    const char *journal_mode;
+    const char *synchronous;
+    bool vfs;                       /* through the write-coalescing VFS */
+    bool async;                     /* through db_async_write, acknowledged before the commit */
+    bool durable;                   /* acknowledged transactions must survive */
+} crash_mode_t;
+
+static const crash_mode_t modes[] = {
+    { "delete/off",          "DELETE",   "OFF",    false, false, false },
+    { "delete/normal",       "DELETE",   "NORMAL", false, false, true },
+    { "delete/full",         "DELETE",   "FULL",   false, false, true },
+    { "truncate/normal",     "TRUNCATE", "NORMAL", false, false, true },
+    { "truncate/full",       "TRUNCATE", "FULL",   false, false, true },
+    { "persist/normal",      "PERSIST",  "NORMAL", false, false, true },
+    { "persist/full",        "PERSIST",  "FULL",   false, false, true },
+    { "wal/off",             "WAL",      "OFF",    false, false, false },
+    { "wal/normal",          "WAL",      "NORMAL", false, false, false },
+    { "wal/full",            "WAL",      "FULL",   false, false, true },
+    { "vfs/delete/normal",   "DELETE",   "NORMAL", true,  false, true },
+    { "vfs/delete/full",     "DELETE",   "FULL",   true,  false, true },
+    { "vfs/truncate/full",   "TRUNCATE", "FULL",   true,  false, true },
+    { "vfs/persist/normal",  "PERSIST",  "NORMAL", true,  false, true },
+    { "vfs/persist/full",    "PERSIST",  "FULL",   true,  false, true },
+    { "vfs/wal/normal",      "WAL",      "NORMAL", true,  false, false },
+    { "vfs/wal/full",        "WAL",      "FULL",   true,  false, true },
+    { "async",               "DELETE",   "NORMAL", false, true,  false },
+    { "vfs/async",           "DELETE",   "NORMAL", true,  true,  false },
+};
+
+/* Record of the async modes, copied by db_async_write */
+typedef struct {
+    sqlite3_stmt *stmt;
+    int id;
+} crash_record_t;
+
+/* Write undone when a cut drops the write cache */
+typedef struct crash_undo {
+    struct crash_undo *next;
+    sqlite3_int64 offset;
+    sqlite3_int64 size_before;      /* file size before the write */
+    int amount;
+    unsigned char data[];           /* previous contents, `amount` bytes or up to the old end */
+} crash_undo_t;
+
+typedef struct {
+    sqlite3_file base;
+    sqlite3_file *real;
+    crash_undo_t *undo;             /* newest first, since the last sync */
+} crash_file_t;
+
+static struct {
+    sqlite3_vfs vfs;
+    sqlite3_vfs *real;
+    sqlite3_io_methods methods;
+    long writes;                    /* flash writes since the workload started */
+    long cut_at;                    /* write that is torn, 0: never */
+    volatile bool powered_off;      /* set by the service task in the async modes */
+    bool write_cache;
+    crash_file_t *files[CRASH_MAX_FILES];
+    unsigned seed;
+} s_crash;
+
+static void crash_drop_undo(crash_file_t *file) {
+    while (file->undo) {
+        crash_undo_t *next = file->undo->next;
+        free(file->undo);
+        file->undo = next;
+    }
+}
+
+static int crash_record_undo(crash_file_t *file, int amount, sqlite3_int64 offset) {
+    sqlite3_int64 size;
+    int rc = file->real->pMethods->xFileSize(file->real, &size);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    crash_undo_t *undo = malloc(sizeof(*undo) + amount);
+    if (undo == NULL) {
+        return SQLITE_IOERR_NOMEM;
+    }
+    undo->offset = offset;
+    undo->size_before = size;
+    undo->amount = offset < size ? (int)(size - offset < amount ? size - offset : amount) : 0;
+    if (undo->amount > 0) {
+        rc = file->real->pMethods->xRead(file->real, undo->data, undo->amount, offset);
+        if (rc != SQLITE_OK) {
+            free(undo);
+            return rc;
+        }
+    }
+    undo->next = file->undo;
+    file->undo = undo;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Cut the power: tear the current write and, with the write cache, undo the unsynced ones.
+ */
+static void crash_power_cut(crash_file_t *file, const void *buf, int amount, sqlite3_int64 offset) {
+    s_crash.powered_off = true;
+    int torn = (int)(rand_r(&s_crash.seed) % (unsigned)amount);
+    if (!s_crash.write_cache && torn > 0) {
+        file->real->pMethods->xWrite(file->real, buf, torn, offset);
+    }
+    if (!s_crash.write_cache) {
+        return;
+    }
+    for (int i = 0; i < CRASH_MAX_FILES; i++) {
+        crash_file_t *f = s_crash.files[i];
+        if (f == NULL) {
+            continue;
+        }
+        for (crash_undo_t *undo = f->undo; undo; undo = undo->next) {
+            if (undo->amount > 0) {
+                f->real->pMethods->xWrite(f->real, undo->data, undo->amount, undo->offset);
+            }
+            f->real->pMethods->xTruncate(f->real, undo->size_before);
+        }
+        crash_drop_undo(f);
+    }
+}
+
+static int crash_close(sqlite3_file *pFile) {
+    crash_file_t *file = (crash_file_t *)pFile;
+    for (int i = 0; i < CRASH_MAX_FILES; i++) {
+        if (s_crash.files[i] == file) {
+            s_crash.files[i] = NULL;
+        }
+    }
+    crash_drop_undo(file);
+    int rc = file->real->pMethods->xClose(file->real);
+    free(file->real);
+    return rc;
+}
+
+static int crash_read(sqlite3_file *pFile, void *buf, int amount, sqlite3_int64 offset) {
+    crash_file_t *file = (crash_file_t *)pFile;
+    if (s_crash.powered_off) {
+        return SQLITE_IOERR_READ;
+    }
+    return file->real->pMethods->xRead(file->real, buf, amount, offset);
+}
+
+static int crash_write(sqlite3_file *pFile, const void *buf, int amount, sqlite3_int64 offset) {
+    crash_file_t *file = (crash_file_t *)pFile;
+    if (s_crash.powered_off) {
+        return SQLITE_IOERR_WRITE;
+    }
+    if (s_crash.cut_at > 0 && ++s_crash.writes == s_crash.cut_at) {
+        crash_power_cut(file, buf, amount, offset);
+        return SQLITE_IOERR_WRITE;
+    }
+    if (s_crash.write_cache) {
+        int rc = crash_record_undo(file, amount, offset);
+        if (rc != SQLITE_OK) {
+            return rc;
+        }
+    }
+    return file->real->pMethods->xWrite(file->real, buf, amount, offset);
+}
+
+static int crash_truncate(sqlite3_file *pFile, sqlite3_int64 size) {
+    crash_file_t *file = (crash_file_t *)pFile;
+    if (s_crash.powered_off) {
+        return SQLITE_IOERR_TRUNCATE;
+    }
+    // Truncation writes the cached data out first and is durable once done
+    crash_drop_undo(file);
+    return file->real->pMethods->xTruncate(file->real, size);
+}
+
+static int crash_sync(sqlite3_file *pFile, int flags) {
+    crash_file_t *file = (crash_file_t *)pFile;
+    (void)flags;
+    if (s_crash.powered_off) {
+        return SQLITE_IOERR_FSYNC;
+    }
+    crash_drop_undo(file);
+    return SQLITE_OK;
+}
+
+static int crash_file_size(sqlite3_file *pFile, sqlite3_int64 *size) {
+    crash_file_t *file = (crash_file_t *)pFile;
+    return file->real->pMethods->xFileSize(file->real, size);
+}
+
+static int crash_lock(sqlite3_file *pFile, int level) {
+    crash_file_t *file = (crash_file_t *)pFile;
+    return file->real->pMethods->xLock(file->real, level);
+}
+
+static int crash_unlock(sqlite3_file *pFile, int level) {
+    crash_file_t *file = (crash_file_t *)pFile;
+    return file->real->pMethods->xUnlock(file->real, level);
+}
+
+static int crash_check_reserved_lock(sqlite3_file *pFile, int *out) {
+    crash_file_t *file = (crash_file_t *)pFile;
+    return file->real->pMethods->xCheckReservedLock(file->real, out);
+}
+
+static int crash_file_control(sqlite3_file *pFile, int op, void *arg) {
+    crash_file_t *file = (crash_file_t *)pFile;
+    return file->real->pMethods->xFileControl(file->real, op, arg);
+}
+
+static int crash_sector_size(sqlite3_file *pFile) {
+    crash_file_t *file = (crash_file_t *)pFile;
+    return file->real->pMethods->xSectorSize(file->real);
+}
+
+static int crash_device_characteristics(sqlite3_file *pFile) {
+    crash_file_t *file = (crash_file_t *)pFile;
+    // No atomic or safe-append guarantees, like SPIFFS
+    return file->real->pMethods->xDeviceCharacteristics(file->real) &
+           ~(SQLITE_IOCAP_ATOMIC | SQLITE_IOCAP_SAFE_APPEND | SQLITE_IOCAP_SEQUENTIAL |
+             SQLITE_IOCAP_POWERSAFE_OVERWRITE | SQLITE_IOCAP_BATCH_ATOMIC);
+}
+
+/* The WAL index lives in RAM on the device and is rebuilt after a cut, so it is passed through */
+static int crash_shm_map(sqlite3_file *pFile, int page, int size, int extend, void volatile **out) {
+    crash_file_t *file = (crash_file_t *)pFile;
+    return file->real->pMethods->xShmMap(file->real, page, size, extend, out);
+}
+
+static int crash_shm_lock(sqlite3_file *pFile, int offset, int n, int flags) {
+    crash_file_t *file = (crash_file_t *)pFile;
+    return file->real->pMethods->xShmLock(file->real, offset, n, flags);
+}
+
+static void crash_shm_barrier(sqlite3_file *pFile) {
+    crash_file_t *file = (crash_file_t *)pFile;
+    file->real->pMethods->xShmBarrier(file->real);
+}
+
+static int crash_shm_unmap(sqlite3_file *pFile, int delete_flag) {
+    crash_file_t *file = (crash_file_t *)pFile;
+    return file->real->pMethods->xShmUnmap(file->real, delete_flag);
+}
+
+static int crash_open(sqlite3_vfs *vfs, const char *name, sqlite3_file *pFile, int flags, int *out_flags) {
+    (void)vfs;
+    crash_file_t *file = (crash_file_t *)pFile;
+    memset(file, 0, sizeof(*file));
+    file->real = calloc(1, s_crash.real->szOsFile);
+    if (file->real == NULL) {
+        return SQLITE_NOMEM;
+    }
+    int rc = s_crash.real->xOpen(s_crash.real, name, file->real, flags, out_flags);
+    if (rc != SQLITE_OK) {
+        free(file->real);
+        file->real = NULL;
+        return rc;
+    }
+    for (int i = 0; i < CRASH_MAX_FILES; i++) {
+        if (s_crash.files[i] == NULL) {
+            s_crash.files[i] = file;
+            break;
+        }
+    }
+    file->base.pMethods = &s_crash.methods;
+    return SQLITE_OK;
+}
+
+static int crash_delete(sqlite3_vfs *vfs, const char *name, int sync_dir) {
+    (void)vfs;
+    if (s_crash.powered_off) {
+        return SQLITE_IOERR_DELETE;
+    }
+    return s_crash.real->xDelete(s_crash.real, name, sync_dir);
+}
+
+static int crash_access(sqlite3_vfs *vfs, const char *name, int flags, int *out) {
+    (void)vfs;
+    return s_crash.real->xAccess(s_crash.real, name, flags, out);
+}
+
+static int crash_full_pathname(sqlite3_vfs *vfs, const char *name, int size, char *out) {
+    (void)vfs;
+    return s_crash.real->xFullPathname(s_crash.real, name, size, out);
+}
+
+static int crash_randomness(sqlite3_vfs *vfs, int size, char *out) {
+    (void)vfs;
+    return s_crash.real->xRandomness(s_crash.real, size, out);
+}
+
+static int crash_sleep(sqlite3_vfs *vfs, int us) {
+    (void)vfs;
+    return s_crash.real->xSleep(s_crash.real, us);
+}
+
+static int crash_current_time(sqlite3_vfs *vfs, double *out) {
+    (void)vfs;
+    return s_crash.real->xCurrentTime(s_crash.real, out);
+}
+
+static int crash_get_last_error(sqlite3_vfs *vfs, int size, char *out) {
+    (void)vfs;
+    return s_crash.real->xGetLastError(s_crash.real, size, out);
+}
+
+static int crash_register(void) {
+    s_crash.real = sqlite3_vfs_find(NULL);
+    if (s_crash.real == NULL) {
+        return SQLITE_ERROR;
+    }
+    s_crash.methods = (sqlite3_io_methods) {
+        .iVersion = 2,
+        .xClose = crash_close,
+        .xRead = crash_read,
+        .xWrite = crash_write,
+        .xTruncate = crash_truncate,
+        .xSync = crash_sync,
+        .xFileSize = crash_file_size,
+        .xLock = crash_lock,
+        .xUnlock = crash_unlock,
+        .xCheckReservedLock = crash_check_reserved_lock,
+        .xFileControl = crash_file_control,
+        .xSectorSize = crash_sector_size,
+        .xDeviceCharacteristics = crash_device_characteristics,
+        .xShmMap = crash_shm_map,
+        .xShmLock = crash_shm_lock,
+        .xShmBarrier = crash_shm_barrier,
+        .xShmUnmap = crash_shm_unmap,
+    };
+    s_crash.vfs = (sqlite3_vfs) {
+        .iVersion = 1,
+        .szOsFile = sizeof(crash_file_t),
+        .mxPathname = s_crash.real->mxPathname,
+        .zName = CRASH_VFS_NAME,
+        .xOpen = crash_open,
+        .xDelete = crash_delete,
+        .xAccess = crash_access,
+        .xFullPathname = crash_full_pathname,
+        .xRandomness = crash_randomness,
+        .xSleep = crash_sleep,
+        .xCurrentTime = crash_current_time,
+        .xGetLastError = crash_get_last_error,
+    };
+    // The default, so that db_vfs_register wraps it
+    return sqlite3_vfs_register(&s_crash.vfs, 1);
+}
+
+static int64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void remove_db(const char *path) {
+    static const char *const suffixes[] = { "", "-journal", "-wal", "-shm" };
+    char name[512];
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        snprintf(name, sizeof(name), "%s%s", path, suffixes[i]);
+        unlink(name);
+    }
+}
+
+static const char *vfs_name(const crash_mode_t *mode) {
+    return mode->vfs ? DB_VFS_NAME : CRASH_VFS_NAME;
+}
+
+static int insert_row(sqlite3_stmt *stmt, int id) {
+    char content[64];
+    snprintf(content, sizeof(content), "Hello, World from test1, row %d", id);
+    sqlite3_bind_int(stmt, 1, id);
+    sqlite3_bind_text(stmt, 2, content, -1, SQLITE_TRANSIENT);
+    int rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+/**
+ * @brief Record function of the async modes. Runs on the database service task.
+ */
+static int insert_record(void *arg) {
+    const crash_record_t *record = arg;
+    return insert_row(record->stmt, record->id);
+}
+
+/**
+ * @brief Acknowledge every row through db_async_write and flush, with the service and the flusher running.
+ *
+ * @return true if every row was committed.
+ */
+static bool run_async(sqlite3 *db, sqlite3_stmt *stmt, int transactions, int flush_rows, int *acked) {
+    db_service_config_t service_config = {
+        .idle_ms = 1000,
+        .slice_budget_us = 20000,
+        .stack_size = 8192,
+        .priority = 5,
+        .queue_len = 8,
+        .group_window_us = 0,
+        .group_max = DB_SERVICE_MAX_GROUP,
+    };
+    db_async_config_t async_config = {
+        .buffer_size = 4096,
+        .max_loss_ms = 5,
+        .flush_rows = flush_rows,
+        .priority = 5,
+        .stack_size = 3072,
+    };
+    if (db_service_start(&service_config) != ESP_OK || db_async_start(&async_config) != ESP_OK) {
+        fprintf(stderr, "Cannot start the database service\n");
+        exit(2);
+    }
+    for (int id = 1; id <= transactions && !s_crash.powered_off; id++) {
+        crash_record_t record = { .stmt = stmt, .id = id };
+        // A record acknowledged after the cut could not have been on the device
+        if (db_async_write(db, insert_record, &record, sizeof(record)) == SQLITE_OK && !s_crash.powered_off) {
+            *acked = id;
+        }
+        // Paced like a logger, so batches are committed while the next ones fill
+        if (id % flush_rows == 0) {
+            vTaskDelay(1);
+        }
+    }
+    bool completed = db_flush() == SQLITE_OK;
+    db_async_stop();
+    db_service_stop();
+    return completed;
+}
+
+/**
+ * @brief Create test1 in `mode` and run the workload until it completes or the power is cut.
+ *
+ * @param cut - Flash write of the workload at which the power is cut.
+ * @param acked - Set to the number of transactions acknowledged to the caller.
+ *
+ * @return true if the workload completed without a cut.
+ */
+static bool run_workload(const char *path, const crash_mode_t *mode, int transactions, int flush_rows, long cut,
+                         int *acked) {
+    sqlite3 *db;
+    char sql[128];
+    *acked = 0;
+    if (sqlite3_open_v2(path, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, vfs_name(mode)) != SQLITE_OK) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, sqlite3_errmsg(db));
+        exit(2);
+    }
+    snprintf(sql, sizeof(sql), "PRAGMA journal_mode=%s; PRAGMA synchronous=%s;", mode->journal_mode,
+             mode->synchronous);
+    sqlite3_exec(db, sql, NULL, NULL, NULL);
+    sqlite3_exec(db, "PRAGMA cache_size=-64; CREATE TABLE IF NOT EXISTS test1 (id INTEGER, content)", NULL, NULL,
+                 NULL);
+
+    // The setup is not part of the sweep, and is on flash before it starts
+    for (int i = 0; i < CRASH_MAX_FILES; i++) {
+        if (s_crash.files[i]) {
+            crash_drop_undo(s_crash.files[i]);
+        }
+    }
+    s_crash.writes = 0;
+    s_crash.cut_at = cut;
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO test1 VALUES (?, ?)", -1, &stmt, NULL);
+    bool completed = true;
+    if (mode->async) {
+        completed = run_async(db, stmt, transactions, flush_rows, acked);
+    } else {
+        for (int id = 1; id <= transactions && completed; id++) {
+            completed = insert_row(stmt, id) == SQLITE_OK;
+            if (completed) {
+                *acked = id;
+            }
+        }
+    }
+    sqlite3_finalize(stmt);
+    // After a cut this fails to write anything, like a reset; buffered writes are lost with the RAM
+    sqlite3_close(db);
+    s_crash.cut_at = 0;
+    return completed && !s_crash.powered_off;
+}
+
+/**
+ * @brief Reopen the database after a cut, recover it and check it.
+ *
+ * @param recovery_us - Set to the time from open until the first query returned.
+ * @param present - Set to the acknowledged rows found.
+ *
+ * @return true if the database could be read and `PRAGMA integrity_check` passed.
+ */
+static bool recover(const char *path, const crash_mode_t *mode, int acked, int64_t *recovery_us, int *present) {
+    sqlite3 *db;
+    sqlite3_stmt *stmt;
+    bool ok = false;
+    *present = 0;
+    int64_t start = now_us();
+    int rc = sqlite3_open_v2(path, &db, SQLITE_OPEN_READWRITE, vfs_name(mode));
+    // The first read rolls back a hot journal or rebuilds the WAL index
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_prepare_v2(db, "SELECT count(*) FROM test1 WHERE id <= ?", -1, &stmt, NULL);
+    }
+    if (rc == SQLITE_OK) {
+        sqlite3_bind_int(stmt, 1, acked);
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            *present = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    *recovery_us = now_us() - start;
+    if (rc == SQLITE_OK && sqlite3_prepare_v2(db, "PRAGMA integrity_check", -1, &stmt, NULL) == SQLITE_OK) {
+        ok = sqlite3_step(stmt) == SQLITE_ROW && strcmp((const char *)sqlite3_column_text(stmt, 0), "ok") == 0;
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_close(db);
+    return ok;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-d DIR] [-n TRANSACTIONS] [-e EVERY] [-f FLUSH_ROWS] [-b KB] [-c] [-m MODE] [-s SEED] [-v]\n"
+            "  -d  directory for test1.db (default /tmp)\n"
+            "  -n  transactions in the workload (default 100)\n"
+            "  -e  cut the power at every EVERYth flash write (default 1)\n"
+            "  -f  records that start a flush in the async modes (default 16)\n"
+            "  -b  write buffer of the vfs modes in KB (default 16)\n"
+            "  -c  model the SPIFFS write cache: unsynced writes are lost\n"
+            "  -m  run one mode only\n"
+            "  -s  seed for the torn write length\n"
+            "  -v  print every cut\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *dir = "/tmp";
+    const char *only = NULL;
+    int transactions = 100;
+    int every = 1;
+    int flush_rows = 16;
+    int buffer_kb = 16;
+    bool verbose = false;
+    int opt;
+    s_crash.seed = 1;
+    while ((opt = getopt(argc, argv, "d:n:e:f:b:cm:s:v")) != -1) {
+        switch (opt) {
+        case 'd': dir = optarg; break;
+        case 'n': transactions = atoi(optarg); break;
+        case 'e': every = atoi(optarg); break;
+        case 'f': flush_rows = atoi(optarg); break;
+        case 'b': buffer_kb = atoi(optarg); break;
+        case 'c': s_crash.write_cache = true; break;
+        case 'm': only = optarg; break;
+        case 's': s_crash.seed = (unsigned)atoi(optarg); break;
+        case 'v': verbose = true; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (transactions < 1 || every < 1 || flush_rows < 1 || buffer_kb < 1) {
+        usage(argv[0]);
+    }
+    // Errors are expected after every cut
+    esp_log_level_set("*", verbose ? ESP_LOG_WARN : ESP_LOG_NONE);
+    db_vfs_config_t vfs_config = {
+        .readahead_pages = 0,
+        .sequential_reads = 2,
+        .write_buffer_size = buffer_kb * 1024,
+    };
+    if (crash_register() != SQLITE_OK || db_vfs_register(&vfs_config) != SQLITE_OK) {
+        fprintf(stderr, "Cannot register the VFS\n");
+        return 2;
+    }
+    char path[512];
+    snprintf(path, sizeof(path), "%s/test1.db", dir);
+
+    printf("%d transactions, a cut every %d writes%s, %d KB VFS write buffer\n\n", transactions, every,
+           s_crash.write_cache ? ", write cache" : "", buffer_kb);
+    printf("%-20s %6s %6s %8s %10s %10s %8s %8s\n", "mode", "writes", "cuts", "corrupt", "recov avg",
+           "recov max", "lost", "max lost");
+    int failures = 0;
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        const crash_mode_t *mode = &modes[m];
+        if (only && strcmp(only, mode->name) != 0) {
+            continue;
+        }
+        int cuts = 0, corrupt = 0, lost = 0, max_lost = 0;
+        int64_t recovery_total = 0, recovery_max = 0;
+        long total_writes = 0;
+        for (long cut = every; ; cut += every) {
+            int acked, present;
+            int64_t recovery_us;
+            remove_db(path);
+            s_crash.powered_off = false;
+            if (run_workload(path, mode, transactions, flush_rows, cut, &acked)) {
+                total_writes = s_crash.writes;
+                break;
+            }
+            s_crash.powered_off = false;
+            bool ok = recover(path, mode, acked, &recovery_us, &present);
+            cuts++;
+            corrupt += !ok;
+            lost += acked - present;
+            max_lost = acked - present > max_lost ? acked - present : max_lost;
+            recovery_total += recovery_us;
+            recovery_max = recovery_us > recovery_max ? recovery_us : recovery_max;
+            if (verbose || !ok || (mode->durable && acked > present)) {
+                printf("  %s: cut at write %ld: %d acknowledged, %d lost, %s, recovered in %lld us\n", mode->name,
+                       cut, acked, acked - present, ok ? "ok" : "CORRUPT", (long long)recovery_us);
+            }
+        }
+        printf("%-20s %6ld %6d %8d %8lldus %8lldus %8d %8d%s\n", mode->name, total_writes, cuts, corrupt,
+               cuts ? (long long)(recovery_total / cuts) : 0LL, (long long)recovery_max, lost, max_lost,
+               mode->durable && lost > 0 ? "  DURABILITY LOST" : "");
+        failures += corrupt + (mode->durable ? lost : 0);
+    }
+    remove_db(path);
+    db_vfs_unregister();
+    return failures > 0;
+}
@@ -0,0 +1,28 @@
+/* Host port: logging to stderr, one level for every tag */
+#pragma once
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+/** Only the level is kept: it applies to every tag. */
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+
+/**
+ * @brief Print one line to stderr if `level` is enabled.
+ *
+ * Not format-checked: the modules print int64_t with %lld, which is only
+ * right where int64_t is long long, as on the device.
+ */
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...);
+
+#define ESP_LOGE(tag, format, ...) esp_log_write(ESP_LOG_ERROR, tag, "E %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) esp_log_write(ESP_LOG_WARN, tag, "W %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) esp_log_write(ESP_LOG_INFO, tag, "I %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) esp_log_write(ESP_LOG_DEBUG, tag, "D %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) esp_log_write(ESP_LOG_VERBOSE, tag, "V %s: " format "\n", tag, ##__VA_ARGS__)
@@ -0,0 +1,7 @@
+/* Host port: monotonic time */
+#pragma once
+
+#include <stdint.h>
+
+/** Microseconds since the program started. */
+int64_t esp_timer_get_time(void);
@@ -0,0 +1,29 @@
+/* Host port: the FreeRTOS types and macros used by the database modules */
+#pragma once
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define portMAX_DELAY ((TickType_t)0xffffffffu)
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms) / portTICK_PERIOD_MS)
+
+/* Critical sections are a mutex; nothing here depends on interrupts being masked */
+typedef pthread_mutex_t portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED PTHREAD_MUTEX_INITIALIZER
+#define portENTER_CRITICAL(mux) pthread_mutex_lock(mux)
+#define portEXIT_CRITICAL(mux) pthread_mutex_unlock(mux)
+
+/** Storage of a semaphore created with `xSemaphoreCreateBinaryStatic`. */
+typedef struct {
+    _Alignas(16) unsigned char storage[192];
+} StaticSemaphore_t;
@@ -0,0 +1,16 @@
+/* Host port: tasks are POSIX threads */
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef struct host_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *arg);
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_size, void *arg, UBaseType_t priority,
+                       TaskHandle_t *task);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait);
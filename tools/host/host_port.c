@@ -0,0 +1,330 @@
+/* Host port of the FreeRTOS and ESP-IDF functions used by the database modules
+ *
+ * Lets tools run main/db_vfs.c, main/db_async.c and main/db_service.c
+ * unchanged on a POSIX host. Tasks are threads with a notification counter,
+ * queues and semaphores are a ring buffer under a mutex and a condition
+ * variable, and a tick is one millisecond. Priorities and stack sizes are
+ * ignored.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+struct host_task {
+    pthread_t thread;
+    TaskFunction_t fn;
+    void *arg;
+    bool created;                   /* by xTaskCreate, freed by vTaskDelete */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notifications;
+};
+
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool is_static;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+    unsigned char items[];
+};
+
+_Static_assert(sizeof(struct host_queue) + 1 <= sizeof(StaticSemaphore_t), "StaticSemaphore_t too small");
+
+static esp_log_level_t s_log_level = ESP_LOG_INFO;
+
+static __thread struct host_task *t_self;
+
+static void host_deadline(struct timespec *ts, TickType_t wait) {
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += wait / 1000;
+    ts->tv_nsec += (long)(wait % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+/**
+ * @brief Wait on `cond` for at most `wait` ticks. Called with `lock` held.
+ *
+ * @return false once the time is up.
+ */
+static bool host_wait(pthread_cond_t *cond, pthread_mutex_t *lock, TickType_t wait, const struct timespec *deadline) {
+    if (wait == 0) {
+        return false;
+    }
+    if (wait == portMAX_DELAY) {
+        pthread_cond_wait(cond, lock);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+static void host_task_init(struct host_task *task) {
+    pthread_mutex_init(&task->lock, NULL);
+    pthread_cond_init(&task->cond, NULL);
+}
+
+static void *host_task_main(void *arg) {
+    struct host_task *task = arg;
+    t_self = task;
+    task->fn(task->arg);
+    vTaskDelete(NULL);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_size, void *arg, UBaseType_t priority,
+                       TaskHandle_t *task) {
+    (void)name;
+    (void)stack_size;
+    (void)priority;
+    struct host_task *t = calloc(1, sizeof(*t));
+    if (t == NULL) {
+        return pdFAIL;
+    }
+    host_task_init(t);
+    t->fn = fn;
+    t->arg = arg;
+    t->created = true;
+    if (task) {
+        *task = t;
+    }
+    if (pthread_create(&t->thread, NULL, host_task_main, t) != 0) {
+        free(t);
+        return pdFAIL;
+    }
+    pthread_detach(t->thread);
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    // Only self-deletion, the way the modules end their tasks
+    if (task != NULL && task != t_self) {
+        return;
+    }
+    struct host_task *self = t_self;
+    t_self = NULL;
+    if (self && self->created) {
+        pthread_cond_destroy(&self->cond);
+        pthread_mutex_destroy(&self->lock);
+        free(self);
+    }
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    struct timespec ts = { .tv_sec = ticks / 1000, .tv_nsec = (long)(ticks % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)(esp_timer_get_time() / 1000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    if (t_self == NULL) {
+        // A thread not created by xTaskCreate, such as the one running main()
+        static __thread struct host_task adopted;
+        host_task_init(&adopted);
+        adopted.thread = pthread_self();
+        t_self = &adopted;
+    }
+    return t_self;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    pthread_mutex_lock(&task->lock);
+    task->notifications++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait) {
+    struct host_task *self = xTaskGetCurrentTaskHandle();
+    struct timespec deadline;
+    host_deadline(&deadline, wait);
+    pthread_mutex_lock(&self->lock);
+    while (self->notifications == 0 && host_wait(&self->cond, &self->lock, wait, &deadline)) {
+    }
+    uint32_t value = self->notifications;
+    if (value > 0) {
+        self->notifications = clear ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&self->lock);
+    return value;
+}
+
+static void host_queue_init(struct host_queue *queue, UBaseType_t length, UBaseType_t item_size) {
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+    queue->length = length;
+    queue->item_size = item_size;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    struct host_queue *queue = calloc(1, sizeof(*queue) + (size_t)length * item_size);
+    if (queue) {
+        host_queue_init(queue, length, item_size);
+    }
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    pthread_cond_destroy(&queue->cond);
+    pthread_mutex_destroy(&queue->lock);
+    if (!queue->is_static) {
+        free(queue);
+    }
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait) {
+    struct timespec deadline;
+    host_deadline(&deadline, wait);
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length) {
+        if (!host_wait(&queue->cond, &queue->lock, wait, &deadline)) {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFALSE;
+        }
+    }
+    if (queue->item_size > 0) {
+        UBaseType_t tail = (queue->head + queue->count) % queue->length;
+        memcpy(queue->items + (size_t)tail * queue->item_size, item, queue->item_size);
+    }
+    queue->count++;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+    return pdTRUE;
+}
+
+static BaseType_t host_queue_take(QueueHandle_t queue, void *item, TickType_t wait, bool remove) {
+    struct timespec deadline;
+    host_deadline(&deadline, wait);
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0) {
+        if (!host_wait(&queue->cond, &queue->lock, wait, &deadline)) {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFALSE;
+        }
+    }
+    if (item && queue->item_size > 0) {
+        memcpy(item, queue->items + (size_t)queue->head * queue->item_size, queue->item_size);
+    }
+    if (remove) {
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        pthread_cond_broadcast(&queue->cond);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait) {
+    return host_queue_take(queue, item, wait, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t wait) {
+    return host_queue_take(queue, item, wait, false);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    pthread_mutex_lock(&queue->lock);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *buffer) {
+    struct host_queue *queue = (struct host_queue *)buffer->storage;
+    memset(queue, 0, sizeof(*queue));
+    host_queue_init(queue, 1, 0);
+    queue->is_static = true;
+    return queue;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    SemaphoreHandle_t sem = xSemaphoreCreateBinary();
+    if (sem) {
+        sem->count = 1;
+    }
+    return sem;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait) {
+    return host_queue_take(sem, NULL, wait, true);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    return xQueueSend(sem, NULL, 0);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) {
+    vQueueDelete(sem);
+}
+
+static struct timespec s_start;
+
+static void host_timer_init(void) {
+    clock_gettime(CLOCK_MONOTONIC, &s_start);
+}
+
+int64_t esp_timer_get_time(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, host_timer_init);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec - s_start.tv_sec) * 1000000LL + (ts.tv_nsec - s_start.tv_nsec) / 1000;
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+    (void)tag;
+    s_log_level = level;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) {
+    (void)tag;
+    if (level > s_log_level) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+    default: return "ERROR";
+    }
+}
@@ -0,0 +1,2 @@
+/* Host port: the tools configure the modules explicitly, without Kconfig defaults */
+#pragma once
@@ -0,0 +1,247 @@
+#!/usr/bin/env python3
+#
+# Creates schema-initialized (and optionally pre-populated) SQLite databases
+# in a directory that is then packed into the SPIFFS `storage` partition
+# image, so devices never have to format the partition, run the schema SQL or
+# insert bulk data at runtime.
+#
+# Usage:
+#   mkdbimage.py --output-dir build/spiffs_image \
+#       test1.db=main/schema/test1_001.sql test2.db=main/schema/test2_001.sql
+#
+#   # Pre-populate test1 from a CSV file and emit a flashable image directly
+#   mkdbimage.py --output-dir /tmp/db --csv test1=data/test1.csv \
+#       --image storage.bin --image-size 0x2f0000 \
+#       test1.db=main/schema/test1_001.sql test2.db=main/schema/test2_001.sql
+#   esptool.py write_flash 0x110000 storage.bin
+#
+#   # Store tables keyed by `id` as INTEGER PRIMARY KEY, like db_schema_apply()
+#   mkdbimage.py --output-dir /tmp/db --schema-template rowid \
+#       test1.db=main/schema/test1_001.sql test2.db=main/schema/test2_001.sql
+#
+# SPDX-License-Identifier: Apache-2.0
+
+import argparse
+import csv
+import os
+import sqlite3
+import subprocess
+import sys
+
+# Size of the `storage` partition in partitions.csv
+DEFAULT_IMAGE_SIZE = 0x2f0000
+
+
+def parse_db_spec(spec):
+    name, sep, schemas = spec.partition('=')
+    if not sep or not name or not schemas:
+        raise argparse.ArgumentTypeError('expected DB=MIGRATION[,MIGRATION...], got "{}"'.format(spec))
+    return name, schemas.split(',')
+
+
+def check_sqlite_version(expected):
+    # Major and minor version must match the device build, e.g. 3.25 for 3.25.2
+    wanted = expected.split('.')[:2]
+    actual = sqlite3.sqlite_version.split('.')[:2]
+    if wanted != actual:
+        print('Host SQLite is {}, the device build is {}'.format(sqlite3.sqlite_version, expected), file=sys.stderr)
+        return False
+    return True
+
+
+def parse_csv_spec(spec):
+    table, sep, path = spec.partition('=')
+    if not sep or not table or not path:
+        raise argparse.ArgumentTypeError('expected TABLE=FILE, got "{}"'.format(spec))
+    return table, path
+
+
+def create_db(path, migrations, user_version, page_size, auto_vacuum):
+    if os.path.exists(path):
+        os.remove(path)
+    conn = sqlite3.connect(path)
+    try:
+        # Rollback journal in DELETE mode, like the device, so no -wal/-journal files end up in the image
+        conn.execute('PRAGMA journal_mode=DELETE')
+        if page_size:
+            conn.execute('PRAGMA page_size={}'.format(page_size))
+        # Must be set before the first table is created
+        conn.execute('PRAGMA auto_vacuum={}'.format(auto_vacuum))
+        # Same migrations, in the same order, as db_migrate() on the device
+        for migration in migrations:
+            with open(migration, 'r') as f:
+                conn.executescript(f.read())
+        conn.execute('PRAGMA user_version={}'.format(user_version or len(migrations)))
+        conn.commit()
+    finally:
+        conn.close()
+
+
+def quote(name):
+    return '"{}"'.format(name.replace('"', '""'))
+
+
+def table_layout(conn, table, key):
+    """Layout of a table as named by db_schema.h, or None if it has no `key` column."""
+    info = conn.execute('PRAGMA table_info({})'.format(quote(table))).fetchall()
+    key_info = [row for row in info if row[1].lower() == key.lower()]
+    if not key_info:
+        return None
+    try:
+        conn.execute('SELECT rowid FROM {} LIMIT 0'.format(quote(table)))
+    except sqlite3.OperationalError:
+        return 'without_rowid'
+    pk_columns = [row for row in info if row[5]]
+    if key_info[0][5] == 1 and len(pk_columns) == 1 and key_info[0][2].upper() == 'INTEGER':
+        return 'rowid'
+    return 'plain'
+
+
+def apply_schema_template(path, template, key):
+    """Rebuild every table with a `key` column into `template`, the same way as db_schema_apply()."""
+    conn = sqlite3.connect(path)
+    try:
+        tables = [row[0] for row in conn.execute(
+            "SELECT name FROM sqlite_master WHERE type = 'table' AND name NOT LIKE 'sqlite_%'")]
+        for table in tables:
+            current = table_layout(conn, table, key)
+            if current is None or current == template:
+                continue
+            info = conn.execute('PRAGMA table_info({})'.format(quote(table))).fetchall()
+            others = [row for row in info if row[1].lower() != key.lower()]
+            defs = ''.join(', {}{}'.format(quote(row[1]), ' ' + row[2] if row[2] else '') for row in others)
+            names = ', '.join([quote(key)] + [quote(row[1]) for row in others])
+            indexes = [row[0] for row in conn.execute(
+                "SELECT sql FROM sqlite_master WHERE type = 'index' AND tbl_name = ? AND sql IS NOT NULL", (table,))]
+            new_table = quote(table + '_rebuild')
+            key_def = quote(key) + (' INTEGER PRIMARY KEY' if template != 'plain' else ' INTEGER')
+            with conn:
+                conn.execute('CREATE TABLE {} ({}{}){}'.format(
+                    new_table, key_def, defs, ' WITHOUT ROWID' if template == 'without_rowid' else ''))
+                # Insertion order, so the last row wins when ids repeat
+                conn.execute('INSERT OR REPLACE INTO {} ({}) SELECT {} FROM {}{} ORDER BY {}'.format(
+                    new_table, names, names, quote(table),
+                    ' WHERE {} IS NOT NULL'.format(quote(key)) if template == 'without_rowid' else '',
+                    '1' if current == 'without_rowid' else 'rowid'))
+                conn.execute('DROP TABLE {}'.format(quote(table)))
+                conn.execute('ALTER TABLE {} RENAME TO {}'.format(new_table, quote(table)))
+                for sql in indexes:
+                    conn.execute(sql)
+            print('Rebuilt {} in {} from {} to {}'.format(table, path, current, template))
+    finally:
+        conn.close()
+
+
+def table_columns(conn, table):
+    return [row[1] for row in conn.execute('PRAGMA table_info("{}")'.format(table.replace('"', '""')))]
+
+
+def find_table(paths, table):
+    for path in paths:
+        conn = sqlite3.connect(path)
+        try:
+            if table_columns(conn, table):
+                return path
+        finally:
+            conn.close()
+    return None
+
+
+def load_csv(db_path, table, csv_path, header):
+    conn = sqlite3.connect(db_path)
+    try:
+        columns = table_columns(conn, table)
+        with open(csv_path, 'r', newline='') as f:
+            reader = csv.reader(f)
+            if header:
+                columns = next(reader)
+            quoted = ', '.join('"{}"'.format(c.replace('"', '""')) for c in columns)
+            sql = 'INSERT INTO "{}" ({}) VALUES ({})'.format(table.replace('"', '""'), quoted,
+                                                            ', '.join('?' * len(columns)))
+            # One statement, one transaction for the whole file
+            with conn:
+                cursor = conn.executemany(sql, reader)
+        count = cursor.rowcount
+    finally:
+        conn.close()
+    return count
+
+
+def compact_db(path):
+    conn = sqlite3.connect(path)
+    try:
+        # Rewrites the file so table pages are contiguous after the bulk load
+        conn.execute('VACUUM')
+    finally:
+        conn.close()
+
+
+def spiffsgen_path():
+    idf_path = os.environ.get('IDF_PATH')
+    if not idf_path:
+        raise RuntimeError('IDF_PATH is not set, cannot locate spiffsgen.py')
+    return os.path.join(idf_path, 'components', 'spiffs', 'spiffsgen.py')
+
+
+def make_image(base_dir, image, size, spiffsgen_args):
+    cmd = [sys.executable, spiffsgen_path(), str(size), base_dir, image] + spiffsgen_args
+    subprocess.check_call(cmd)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Create SQLite databases for the SPIFFS storage partition image')
+    parser.add_argument('--output-dir', required=True, help='Directory packed into the SPIFFS partition image')
+    parser.add_argument('--user-version', type=int, default=0,
+                        help='Value stored in PRAGMA user_version (default: number of migrations)')
+    parser.add_argument('--page-size', type=int, default=0, help='SQLite page size (default: SQLite default)')
+    parser.add_argument('--auto-vacuum', choices=['none', 'full', 'incremental'], default='incremental',
+                        help='auto_vacuum mode of the databases (default: %(default)s)')
+    parser.add_argument('--sqlite-version',
+                        help='SQLite version of the device build; fail if the host major.minor version differs')
+    parser.add_argument('--schema-template', choices=['plain', 'rowid', 'without_rowid'], default='plain',
+                        help='Layout of tables keyed by --key-column, see main/db_schema.h (default: %(default)s)')
+    parser.add_argument('--key-column', default='id', help='Key column of --schema-template (default: %(default)s)')
+    parser.add_argument('--csv', action='append', default=[], type=parse_csv_spec, metavar='TABLE=FILE',
+                        help='Load rows from a CSV file into TABLE, in whichever database defines it')
+    parser.add_argument('--no-header', action='store_true',
+                        help='CSV files have no header row; columns are taken in table order')
+    parser.add_argument('--image', help='Also run spiffsgen.py and write a flashable partition image here')
+    parser.add_argument('--image-size', type=lambda x: int(x, 0), default=DEFAULT_IMAGE_SIZE,
+                        help='Partition size in bytes (default: 0x%(default)x)')
+    parser.add_argument('--spiffsgen-arg', action='append', default=[],
+                        help='Extra argument passed to spiffsgen.py, e.g. --spiffsgen-arg=--page-size=256')
+    parser.add_argument('databases', nargs='+', type=parse_db_spec, metavar='DB=MIGRATION[,MIGRATION...]',
+                        help='Database file name inside the image and its migration SQL files, in version order')
+    args = parser.parse_args()
+    if args.sqlite_version and not check_sqlite_version(args.sqlite_version):
+        return 1
+
+    os.makedirs(args.output_dir, exist_ok=True)
+    paths = []
+    for name, migrations in args.databases:
+        path = os.path.join(args.output_dir, name)
+        create_db(path, migrations, args.user_version, args.page_size, args.auto_vacuum)
+        paths.append(path)
+        print('Created {} from {}'.format(path, ', '.join(migrations)))
+        apply_schema_template(path, args.schema_template, args.key_column)
+
+    loaded = set()
+    for table, csv_path in args.csv:
+        path = find_table(paths, table)
+        if path is None:
+            print('Table {} is not defined by any schema'.format(table), file=sys.stderr)
+            return 1
+        count = load_csv(path, table, csv_path, not args.no_header)
+        loaded.add(path)
+        print('Loaded {} rows into {} from {}'.format(count, table, csv_path))
+    for path in loaded:
+        compact_db(path)
+
+    if args.image:
+        make_image(args.output_dir, args.image, args.image_size, args.spiffsgen_arg)
+        print('Wrote SPIFFS image {}'.format(args.image))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())